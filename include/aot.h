@@ -0,0 +1,73 @@
+// Runtime for C code emitted by --emit-c
+// Translated functions use stack, globals and objects of the VM
+// but run as C code instead of being interpreted
+
+#ifndef clox_aot_h
+#define clox_aot_h
+
+#include <stdio.h>
+
+#include "common.h"
+#include "object.h"
+#include "vm.h"
+
+// Call stack of translated functions, only used for stack traces
+typedef struct {
+    ObjFunction* function;
+    int line;           // Line of instruction being run
+} AotFrame;
+
+extern AotFrame aotFrames[FRAMES_MAX];
+extern int aotFrameCount;
+
+// Stack operations without function calls
+#define AOT_PUSH(value)     (*vm.stackTop++ = (value))
+#define AOT_POP()           (*--vm.stackTop)
+#define AOT_PEEK(distance)  (vm.stackTop[-1 - (distance)])
+
+#define AOT_FALSEY(value) \
+    (IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)))
+
+// Same checks and messages as BINARY_OP of VM
+#define AOT_BINARY_OP(valueType, op) \
+    do { \
+        if (!IS_NUMBER(AOT_PEEK(0)) || !IS_NUMBER(AOT_PEEK(1))) { \
+            aotRuntimeError("Operands must be numbers."); \
+        } \
+        double b = AS_NUMBER(AOT_POP()); \
+        double a = AS_NUMBER(AOT_POP()); \
+        AOT_PUSH(valueType(a op b)); \
+    } while (false)
+
+#define AOT_NUMBER_OP(valueType, op) \
+    do { \
+        double b = AS_NUMBER(AOT_POP()); \
+        double a = AS_NUMBER(AOT_POP()); \
+        AOT_PUSH(valueType(a op b)); \
+    } while (false)
+
+// Prints error with stack trace and exits like interpreter does
+void aotRuntimeError(const char* format, ...);
+
+// Creates function object whose body is translated C code
+ObjFunction* aotFunction(const char* name, int arity, int maxStack, AotFn body);
+
+// Calls value below arguements on top of stack, leaving its result there
+void aotCall(int argCount);
+
+// Adds numbers or concatenates strings on top of stack
+void aotAdd();
+
+// Adds count values on top of stack like OP_CONCAT
+void aotConcat(int count);
+
+// Prints sum of count values on top of stack like OP_PRINT_CONCAT
+void aotPrintConcat(int count);
+
+void aotGetGlobal(ObjString* name);
+void aotSetGlobal(ObjString* name);
+
+// Runs translated script function, result is process exit code
+int aotRun(ObjFunction* script);
+
+#endif
@@ -0,0 +1,31 @@
+// Compiled scripts saved as .loxc files
+// Loading one runs a script without scanning or compiling its source
+
+#ifndef clox_cache_h
+#define clox_cache_h
+
+#include "common.h"
+#include "object.h"
+
+// Changed whenever layout of .loxc files or meaning of bytecode changes
+#define CACHE_VERSION 3
+
+/**
+ * @brief Writes script and every function reachable from its constants
+ * to path along with a hash of the source it was compiled from
+ *
+ * @return bool false if file could not be written or script still
+ * has function bodies waiting to be compiled
+ */
+bool saveCache(ObjFunction* script, const char* source, const char* path);
+
+/**
+ * @brief Maps file at path and rebuilds the script saved in it
+ * Every function is checked by verifier before it is returned
+ *
+ * @return ObjFunction* NULL if file is missing, was written for another
+ * source, version or compiler options, or is damaged
+ */
+ObjFunction* loadCache(const char* source, const char* path);
+
+#endif
@@ -17,13 +17,21 @@ typedef enum {
     OP_GET_LOCAL,       // Reading Local variable from constant table 
     OP_SET_LOCAL,       // setting Local variable value
     OP_JUMP_IF_FALSE,   // specifies offset for IP to jump by
+    OP_JUMP_IF_TRUE,    // Used when false branch is laid out first
     OP_JUMP,            // Unconditional Jump to Offset
     OP_LOOP,
     OP_CALL,
+    OP_CONCAT,          // Adds operand count of values like a chain of OP_ADD
+    OP_PRINT_CONCAT,    // OP_CONCAT followed by OP_PRINT without making the string
+    OP_SWITCH,          // Jumps back to case body found in ObjSwitch constant
+    OP_PROFILE_BRANCH,  // Counts condition on top of stack, 2 byte line and 1 byte index
+    OP_PROFILE_TYPES,   // Records kinds of values on top of stack, line, index and depth of first value
+    OP_GUARD_NUMBERS,   // Jumps by offset in last 2 bytes unless parameters in mask of first byte are numbers
 
     // 1 Byte Instuction
     OP_NEGATE,          // Negates the operand
     OP_ADD,             // Adds the operands at top of stack
+    OP_ADD_GUARDED,     // OP_ADD trying numbers first, where profile saw only numbers
     OP_SUBTRACT,
     OP_MULTIPLY,
     OP_DIVIDE,
@@ -39,14 +47,44 @@ typedef enum {
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
+
+    // Same as above but without type checks
+    // Emitted when compiler proves both operands are numbers
+    OP_NEGATE_NUMBER,
+    OP_ADD_NUMBER,
+    OP_SUBTRACT_NUMBER,
+    OP_MULTIPLY_NUMBER,
+    OP_DIVIDE_NUMBER,
+    OP_GREATER_NUMBER,
+    OP_LESS_NUMBER,
+
     OP_RETURN           // Return from current Function
 } OpCode;
 
+// Start of a run of bytes compiled from same line
+typedef struct {
+    int offset;         // Offset of first byte in the run
+    int line;           // Line number of every byte in the run, -1 - index of an InlinedLine if negative
+} LineStart;
+
+// Line of code copied into chunk from body of an inlined call
+// Stack traces show a frame for the callee from it
+typedef struct {
+    int line;           // Line in body of callee
+    int name;           // Index of name of callee in constants of chunk
+    int callLine;       // Line of the call, negative if call was itself copied from an inlined body
+} InlinedLine;
+
 typedef struct {
     int count;          // Number of used elements
     int capacity;       // Number of allocated elements
     uint8_t* code;      // Dynamic array for ByteCode
-    int* lines;         // Stores line number for every byte in code
+    int lineCount;      // Number of used line runs
+    int lineCapacity;   // Number of allocated line runs
+    LineStart* lines;   // Run length encoded line numbers of code
+    int inlinedCount;
+    int inlinedCapacity;
+    InlinedLine* inlined;   // Lines that negative line numbers refer to
     ValueArray constants;   // Pool of constants values
 } Chunk;
 
@@ -60,6 +98,23 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line);
 // Used to free the memory allocated to Chunk
 void freeChunk(Chunk* chunk);
 
+// Drops bytes from offset count onwards along with their lines
+void truncateChunk(Chunk* chunk, int count);
+
+// Decodes line number of byte at offset
+// Negative for code copied from an inlined call, which sourceLine() resolves
+int getLine(Chunk* chunk, int offset);
+
+// Line in source of byte at offset, which is in body of callee for inlined code
+int sourceLine(Chunk* chunk, int offset);
+
+/**
+ * @brief Records line of code copied from body of an inlined call
+ *
+ * @return int negative line number to write code with
+ */
+int addInlinedLine(Chunk* chunk, int line, int name, int callLine);
+
 /**
  * @brief To add a constant to constant pool
  * 
@@ -67,4 +122,16 @@ void freeChunk(Chunk* chunk);
  */
 int addConstant(Chunk* chunk, Value value);
 
+// Number of operand bytes following the opcode
+int operandCount(uint8_t instruction);
+
+/**
+ * @brief Change in size of operand stack after executing instruction
+ * 
+ * @param operand only used by OP_CALL, OP_CONCAT and OP_PRINT_CONCAT
+ * whose operands count values they pop
+ * @return int number of values pushed minus number of values popped
+ */
+int stackEffect(uint8_t instruction, int operand);
+
 #endif
@@ -5,6 +5,7 @@
 #include "scanner.h"
 #include "object.h"
 #include "vm.h"
+#include "profile.h"
 
 // Function type that takes no arguement and returns nothing
 typedef void (*ParseFn)(bool canAssign);  
@@ -44,11 +45,67 @@ typedef struct {
     Precedence precedence;  // precedence of an infix expression that uses that token as an operator
 } ParseRule;
 
+// Type of a value as far as compiler can prove it
+typedef enum {
+    STATIC_UNKNOWN,
+    STATIC_NUMBER,
+    STATIC_BOOL,
+    STATIC_NIL,
+    STATIC_STRING
+} StaticType;
+
 typedef struct {
     Token name;
     int depth;
+    StaticType type;    // Type held at current point of compilation
+    bool isConst;       // Reads compile to OP_CONSTANT of value below
+    Value constant;
+
+    // Index of next older local in same bucket of Compiler::localBuckets, -1 if none
+    int nextInBucket;
 } Local;
 
+// Number of buckets used to find locals by name, power of 2
+#define LOCAL_BUCKETS 64
+
+// Number of slots for identifier constants of a function, power of 2
+// Twice the largest constant table so that probing always ends
+#define IDENTIFIER_SLOTS 512
+
+// Constant holding name of an identifier in chunk of current function
+typedef struct {
+    const char* start;  // NULL for empty slot
+    int length;
+    uint32_t hash;
+    int constant;
+} IdentifierConstant;
+
+// Most parameters a clone can have constants for
+#define CLONE_MAX_ARITY 8
+
+// Most clones kept track of for one function
+#define CLONES_MAX 8
+
+// Most functions that can be cloned in one compilation
+#define CLONE_TARGETS_MAX 64
+
+// Function compiled again with some parameters fixed to constant arguements
+typedef struct {
+    bool isConstant[CLONE_MAX_ARITY];
+    Value values[CLONE_MAX_ARITY];
+    ObjFunction* function;  // NULL if clone turned out no smaller than original
+} FunctionClone;
+
+// Global function whose calls with constant arguements can use a clone
+typedef struct {
+    ObjString* name;
+    ObjFunction* function;
+    const char* source;     // Parameter list in source, compiled again for clones
+    int line;
+    int cloneCount;
+    FunctionClone clones[CLONES_MAX];
+} CloneTarget;
+
 // Distinction for which type of function is being executed
 typedef enum {
     TYPE_FUNCTION,  // Function body
@@ -73,12 +130,182 @@ typedef struct Compiler {
     // Number of local variables
     int localCount;
 
+    // Newest local for each bucket of name hashes, -1 if empty
+    // Newer locals are first, so shadowing works by taking the first match
+    int localBuckets[LOCAL_BUCKETS];
+
+    // Constants already made for identifier names
+    IdentifierConstant identifiers[IDENTIFIER_SLOTS];
+
     // 0 - Global scope, 1 - first top level block and so on
     int scopeDepth;
+
+    // Number of values on the VM stack for this function's frame
+    // at the current point of emitted code, including slot zero
+    int stackDepth;
+
+    // Operand bytes still expected for the last emitted opcode
+    int pendingOperands;
+    uint8_t pendingOpcode;
+
+    // Stack depth just before the first OP_RETURN, -1 if none emitted yet
+    int returnDepth;
+
+    // Offset of last emitted OP_GET_GLOBAL, used to recognise callee of a call
+    int lastGlobalGet;
+
+    // Offset of OP_ADD or OP_CONCAT ending last + chain, -1 once anything may
+    // jump to or follow it
+    int lastConcat;
+
+    // Type of the value produced by last compiled expression
+    StaticType exprType;
+
+    // Constant parameters when compiling a clone, NULL otherwise
+    FunctionClone* clone;
+
+    // Set when body of a clone assigns one of its constant parameters
+    bool cloneFailed;
+
+    // Set once a call in this function had callee body copied into it
+    bool hasInlined;
 } Compiler;
 
+// Global function whose body can be copied into call sites
+typedef struct {
+    ObjString* name;
+    ObjFunction* function;
+    int bodyOffset;     // Offset of first instruction copied, past the specialized copy if any
+    int returnOffset;   // Offset of the OP_RETURN ending the body
+    int returnDepth;    // Stack depth of callee frame at that OP_RETURN
+} InlineCandidate;
+
+// Switches controlling optimisations done by compile()
+typedef struct {
+    // Inline small global functions at call sites
+    bool inlineFunctions;
+
+    // Largest callee body in bytes that will be inlined
+    int inlineBudget;
+
+    // Move loop invariant computations in front of loops
+    bool hoistInvariants;
+
+    // Emit unchecked arithmetic where operands are proven numbers
+    bool inferTypes;
+
+    // Copies of body made when unrolling counted for loops, below 2 disables
+    int unrollFactor;
+
+    // Most clones of a function made for calls with constant arguements
+    int maxClones;
+
+    // Read values still on the stack instead of computing them again
+    bool eliminateSubexpressions;
+
+    // Add chains of + with one OP_CONCAT instead of an OP_ADD per operator
+    bool concatChains;
+
+    // Only skim function bodies and compile them on first call
+    bool lazyFunctions;
+
+    // Also define global consts at runtime for code compiled by later calls
+    // Always done with lazyFunctions
+    bool constGlobals;
+
+    // Emit OP_PROFILE_BRANCH for every if statement
+    bool profileBranches;
+
+    // Counts of an earlier run, if statements whose condition was mostly
+    // false get their else branch laid out first, NULL if none
+    BranchProfile* branchProfile;
+
+    // Emit OP_PROFILE_TYPES for arithmetic, comparisons, calls and function entries
+    bool profileTypes;
+
+    // Types seen by an earlier run, used to specialize code behind guards, NULL if none
+    TypeProfile* typeProfile;
+} CompilerOptions;
+
+extern CompilerOptions compilerOptions;
+
+// All state of one compilation
+// Every thread compiles with its own context
+typedef struct CompileContext {
+    // Compilation this one was started from on the same thread
+    struct CompileContext* enclosing;
+
+    Parser parser;
+    Scanner scanner;
+
+    // Compiler of innermost function being compiled
+    Compiler* current;
+
+    // Global functions seen so far that are eligible for inlining
+    InlineCandidate inlineCandidates[UINT8_COUNT];
+    int inlineCandidateCount;
+
+    // Global functions seen so far that calls can get clones of
+    CloneTarget cloneTargets[CLONE_TARGETS_MAX];
+    int cloneTargetCount;
+
+    // Number of times each global name is written anywhere in source
+    // A function is only inlined when its name is written exactly once
+    Table globalWrites;
+
+    // Line of last if statement and number of ifs seen on that line
+    // Together they identify the if in a branch profile
+    int siteLine;
+    int siteIndex;
+
+    // Same for operators, calls and functions in a type profile
+    int typeSiteLine;
+    int typeSiteIndex;
+
+    // Values of global consts declared so far
+    Table consts;
+
+    // Global names read or assigned at runtime so far, true once assigned
+    // A const declared after a read is also defined at runtime
+    Table globalUses;
+
+    // Copy of compilerOptions.inlineFunctions, off when compiling again after an overflow
+    bool inlineFunctions;
+
+    // Set when a function with inlined calls ran out of constants
+    // Rest of the pass reports no errors, as source is compiled again without inlining
+    bool inlineOverflow;
+
+#ifdef DEBUG_PRINT_CODE
+    // Functions compiled so far, disassembled once pass is known not to be compiled again
+    ObjFunction** finished;
+    int finishedCount;
+    int finishedCapacity;
+#endif
+} CompileContext;
+
+// Source to be compiled on a worker thread
+typedef struct {
+    const char* source;
+    ObjFunction* function;  // Compiled script, NULL if there were errors
+    Heap heap;              // Owns every object created while compiling
+    char* errors;           // Compile errors, freed by caller, NULL if they went to stderr
+} CompileJob;
+
 ObjFunction* compile(const char* source);
 
+// Same as compile() for one part of a longer script starting at given line
+// Consts declared by earlier parts compiled this way are known
+ObjFunction* compileAt(const char* source, int line);
+
+// Compiles body of a function skimmed by compile() with lazyFunctions on
+// Source passed to compile() has to be alive till then
+bool compileLazyFunction(ObjFunction* function);
+
+// Compiles all jobs on given number of threads
+// Results are handed to VM with interpretCompiled()
+void compileJobs(CompileJob* jobs, int count, int threadCount);
+
 // For Garbage Collector to marks roots to compiler referenced memory
 void markCompilerRoots();
 
@@ -0,0 +1,47 @@
+// Natives that let scripts read files a line or a block at a time
+// Scripts refer to open files by number, nil is returned at end of file,
+// when a file cannot be opened and when arguements are not valid
+
+#ifndef clox_files_h
+#define clox_files_h
+
+#include "common.h"
+#include "value.h"
+
+// Bytes asked for by each read of a file that cannot be mapped
+#define FILE_READ_SIZE (1024 * 1024)
+
+// Pages of mapped files are let go once this many bytes past them are read
+#define FILE_RELEASE_SIZE (64 * 1024 * 1024)
+
+// Regular files are mapped and read in place, pipes go through a buffer
+// that only holds bytes not yet handed out
+typedef struct {
+    bool isOpen;
+    bool isMapped;
+    int fd;                 // -1 once file is mapped
+    bool ended;             // No more bytes can be read into buffer
+
+    char* data;
+    size_t length;
+    size_t capacity;
+    size_t position;        // First byte not handed out
+    size_t released;        // Mapped bytes before this are given back to page cache
+} OpenFile;
+
+// openFile(path) returns number of file or nil if it cannot be opened
+Value openFileNative(int argCount, Value* args);
+
+// readLine(file) returns next line without its '\n', nil at end of file
+Value readLineNative(int argCount, Value* args);
+
+// readBlock(file, size) returns next size bytes or fewer at end of file, nil after it
+Value readBlockNative(int argCount, Value* args);
+
+// closeFile(file) returns false if file was not open
+Value closeFileNative(int argCount, Value* args);
+
+// Closes files scripts left open
+void closeFiles();
+
+#endif
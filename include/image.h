@@ -0,0 +1,31 @@
+// Heap images of a VM taken after a prelude script has run
+// Restoring one gives a fresh VM the globals of the prelude without running it
+
+#ifndef clox_image_h
+#define clox_image_h
+
+#include "common.h"
+
+// Changed whenever layout of images or meaning of bytecode changes
+#define IMAGE_VERSION 2
+
+/**
+ * @brief Writes globals of VM and every object reachable from them to path
+ * Function bodies still waiting to be compiled are compiled first,
+ * so source of the prelude has to be alive
+ *
+ * @return bool false if file could not be written
+ */
+bool saveImage(const char* path);
+
+/**
+ * @brief Maps image at path and defines its globals in VM
+ * Objects are allocated first and then filled in, turning indices
+ * in the image into pointers. Every function is checked by verifier.
+ *
+ * @return bool false if image is missing, of another version or damaged,
+ * in which case VM is left as it was
+ */
+bool loadImage(const char* path);
+
+#endif
@@ -26,6 +26,44 @@
 // Resizes an allocation down to zero bytes
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+// Objects and interned strings owned by one allocator
+// VM owns the main heap, compilations on other threads use their own
+typedef struct {
+    // Head of Linked List of Object Type Values
+    Obj* objects;
+
+    // Objects made permanent, moved here from objects by first sweep after that
+    // Neither marking nor sweeping visits them again
+    Obj* permanent;
+
+    // for string interning
+    Table strings;
+
+    // State for tracking live memory
+    size_t bytesAllocated;
+    size_t nextGC;          // Threshold that triggers next collection
+
+    // Only VM's heap is garbage collected
+    bool canCollect;
+} Heap;
+
+// Heap that new objects are allocated from by calling thread
+extern thread_local Heap* currentHeap;
+
+void initHeap(Heap* heap);
+
+/**
+ * @brief Moves all objects of given heap into VM's heap
+ * Strings already interned by VM replace their duplicates
+ * in functions of the given heap
+ */
+void adoptHeap(Heap* heap);
+
+// Keeps value safe from garbage collector until unprotectValue()
+// Used while a new object is not yet reachable from roots
+void protectValue(Value value);
+void unprotectValue();
+
 /**
  * @brief used for all dynamic memory management in clox
  * - Allocating memory
@@ -49,6 +87,15 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize);
 // For freeing unused memory
 void collectGarbage();
 
+/**
+ * @brief Moves object and every object it refers to into permanent space
+ * Only for objects that live till the end of program, like declared
+ * functions with their string literals, and natives. Nothing reachable
+ * from a permanent object may be collected, so everything it refers to
+ * has to be permanent as well.
+ */
+void makePermanent(Obj* object);
+
 // Marking current object being referred
 void markObject(Obj* object);
 
@@ -4,11 +4,13 @@
 #include "common.h"
 #include "chunk.h"
 #include "value.h"
+#include "table.h"
 
 #define OBJ_TYPE(value)         (AS_OBJ(value)->type)
 #define IS_STRING(value)        isObjType(value, OBJ_STRING)
 #define IS_FUNCTION(value)      isObjType(value, OBJ_FUNCTION)
 #define IS_NATIVE(value)        isObjType(value, OBJ_NATIVE)
+#define IS_SWITCH(value)        isObjType(value, OBJ_SWITCH)
 
 // Expands a valid ObjString pointer on heap
 #define AS_STRING(value)        ((ObjString*)AS_OBJ(value))
@@ -18,12 +20,14 @@
 
 // Expands a valid ObjFunction pointer on heap
 #define AS_FUNCTION(value)      ((ObjFunction*)AS_OBJ(value))
+#define AS_SWITCH(value)        ((ObjSwitch*)AS_OBJ(value))
 
 // Object Types for Obj
 typedef enum {
     OBJ_STRING,
     OBJ_FUNCTION,
-    OBJ_NATIVE
+    OBJ_NATIVE,
+    OBJ_SWITCH
 } ObjType;
 
 /*
@@ -37,6 +41,7 @@ typedef enum {
 struct Obj {
     ObjType type;
     bool isMarked;      // used by Garbage Collector for marking for being referenced
+    bool isPermanent;   // Never collected, stays marked so marking stops at it
     
     // For Linked List node reference
     // Will be used by Garbage Collector
@@ -53,12 +58,22 @@ struct ObjString {
     uint32_t hash;      // Caching Hash
 };
 
+// Body of a function translated to C by --emit-c
+// Runs with arguements in slots like a call frame of VM
+typedef void (*AotFn)(Value* slots);
+
 // Representing Function in Clox
 typedef struct {
     Obj obj;
     int arity;          // Number of arguements
     Chunk chunk;        // Chunk containing bytecode of function
     ObjString* name;    // name of function identifier
+    int maxStack;       // Most stack slots a frame uses, set by verifier
+    AotFn aot;          // Translated body in executables built from C output, else NULL
+
+    // Parameter list in source while body is not compiled yet, NULL after
+    const char* lazySource;
+    int lazyLine;
 } ObjFunction;
 
 // Native Function representation
@@ -72,11 +87,25 @@ typedef struct {
     NativeFn function;  
 } ObjNative;
 
+// Jump table of a switch statement, only referenced from constants of chunk
+// Distances are counted backwards from end of OP_SWITCH instruction
+typedef struct {
+    Obj obj;
+    int low;            // Case value of first entry in distances
+    int count;          // Number of entries in distances
+    int* distances;     // Distances of number cases from low onwards
+    Table strings;      // Distances of string cases
+    int defaultDistance;    // Used when no case matches, 0 to fall through
+} ObjSwitch;
+
 ObjString* takeString(char* chars, int length);
 
 // Making copy of string literal from source code
 ObjString* copyString(const char* chars, int length);
 
+// FNV-1a hash used for interning strings
+uint32_t hashString(const char* key, int length);
+
 // For printing Obj value
 void printObject(Value value);
 
@@ -92,4 +121,7 @@ ObjFunction* newFunction();
 // Defining new Native function object
 ObjNative* newNative(NativeFn function);
 
+// Defining empty jump table for switch statement
+ObjSwitch* newSwitch();
+
 #endif
\ No newline at end of file
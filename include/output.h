@@ -0,0 +1,55 @@
+// Output of print statements, buffered by VM instead of going through
+// printf() for every value
+
+#ifndef clox_output_h
+#define clox_output_h
+
+#include "common.h"
+#include "value.h"
+
+// Size of buffer unless set with --output-buffer
+#define OUTPUT_DEFAULT_SIZE (64 * 1024)
+
+// Output is always written out when full, on errors and on exit
+typedef enum {
+    FLUSH_WHEN_FULL,
+    FLUSH_EACH_LINE     // Also after every print, default for terminals
+} FlushPolicy;
+
+// Written to stdout with fwrite(), so output of printf() stays in order
+// as long as buffer is flushed before it
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    FlushPolicy policy;
+} Output;
+
+void initOutput(Output* output, size_t capacity, FlushPolicy policy);
+
+// Flushes output before freeing buffer
+void freeOutput(Output* output);
+
+// Flushes what is buffered and gives buffer new capacity, at least 1 byte
+void resizeOutput(Output* output, size_t capacity);
+
+void flushOutput(Output* output);
+void writeOutput(Output* output, const char* chars, size_t length);
+
+// Writes value the way printValue() prints it followed by a newline
+void writeLine(Output* output, Value value);
+
+// Same as writeLine() for text that is not a value, like joined strings
+void writeTextLine(Output* output, const char* chars, size_t length);
+
+/**
+ * @brief Formats number exactly like printf("%g") into buffer of at least
+ * 32 bytes. Numbers whose shortest form that reads back as the same
+ * double has at most 6 significant digits, which covers integers and
+ * most literals, are formatted without going through printf()
+ *
+ * @return int length of text, buffer is also '\0' terminated
+ */
+int formatNumber(double number, char* buffer);
+
+#endif
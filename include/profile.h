@@ -0,0 +1,74 @@
+// Branch and type profiles recorded while running a script
+// Used by compiler to lay out hot branches first and to specialize code
+
+#ifndef clox_profile_h
+#define clox_profile_h
+
+#include "common.h"
+
+// Identifies a site by its line and its position among sites of that line
+#define PROFILE_SITE(line, index) (((uint32_t)(line) << 8) | (uint8_t)(index))
+
+// Times the condition of a branch site was true and false
+typedef struct {
+    uint32_t site;      // 0 for empty entry
+    uint64_t trueCount;
+    uint64_t falseCount;
+} BranchCount;
+
+// Hash table of branch sites with linear probing
+// Not managed by garbage collector
+typedef struct {
+    int count;
+    int capacity;       // Power of 2
+    BranchCount* entries;
+} BranchProfile;
+
+void initProfile(BranchProfile* profile);
+void freeProfile(BranchProfile* profile);
+
+// Finds entry of site, adding an empty one if missing
+BranchCount* profileEntry(BranchProfile* profile, uint32_t site);
+
+// Finds entry of site, NULL if site was never recorded
+BranchCount* findProfileEntry(BranchProfile* profile, uint32_t site);
+
+// Profile file has one site per line as "line index trueCount falseCount"
+// Both return false if file cannot be used
+bool saveProfile(BranchProfile* profile, const char* path);
+bool loadProfile(BranchProfile* profile, const char* path);
+
+// Kinds of values seen at a type site, or-ed together over a run
+#define SEEN_NUMBER     0x1
+#define SEEN_STRING     0x2
+#define SEEN_FUNCTION   0x4
+#define SEEN_OTHER      0x8
+
+// Values recorded per type site
+// Operands of arithmetic, callee and first arguements of a call,
+// or first parameters on entry to a function
+#define TYPE_OPERANDS 4
+
+typedef struct {
+    uint32_t site;      // 0 for empty entry
+    uint8_t seen[TYPE_OPERANDS];
+} TypeSite;
+
+// Hash table of type sites, same layout as BranchProfile
+typedef struct {
+    int count;
+    int capacity;       // Power of 2
+    TypeSite* entries;
+} TypeProfile;
+
+void initTypeProfile(TypeProfile* profile);
+void freeTypeProfile(TypeProfile* profile);
+
+TypeSite* typeProfileEntry(TypeProfile* profile, uint32_t site);
+TypeSite* findTypeProfileEntry(TypeProfile* profile, uint32_t site);
+
+// Type profile file has one site per line as "line index seen0 seen1 seen2 seen3"
+bool saveTypeProfile(TypeProfile* profile, const char* path);
+bool loadTypeProfile(TypeProfile* profile, const char* path);
+
+#endif
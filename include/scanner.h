@@ -10,7 +10,7 @@ typedef enum {
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
     TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
-    TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
+    TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR, TOKEN_COLON,
 
     // One or Two character tokens
     TOKEN_BANG, TOKEN_BANG_EQUAL,
@@ -22,10 +22,10 @@ typedef enum {
     TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
 
     // Keywords
-    TOKEN_AND, TOKEN_CLASS, TOKEN_ELSE, TOKEN_FALSE,
-    TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
-    TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
-    TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE,
+    TOKEN_AND, TOKEN_CASE, TOKEN_CLASS, TOKEN_CONST, TOKEN_DEFAULT,
+    TOKEN_ELSE, TOKEN_FALSE, TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL,
+    TOKEN_OR, TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_SWITCH,
+    TOKEN_THIS, TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE,
 
     TOKEN_ERROR,
     TOKEN_EOF
@@ -38,6 +38,7 @@ typedef struct {
     const char* start;  // Pointer to token string in source code
     int length;
     int line;
+    uint32_t hash;      // Hash of lexeme for identifiers, 0 for other tokens
 } Token;
 
 typedef struct {
@@ -46,9 +47,9 @@ typedef struct {
     int line;
 } Scanner;
 
-void initScanner(const char* source);
+void initScanner(Scanner* scanner, const char* source);
 
 // Each call scans and returns the next token in source code
-Token scanToken();
+Token scanToken(Scanner* scanner);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+// Binary files written by clox, like bytecode caches and heap images
+// Integers are 4 bytes in byte order of machine, files are not portable
+
+#ifndef clox_serialize_h
+#define clox_serialize_h
+
+#include <stdio.h>
+
+#include "common.h"
+#include "object.h"
+
+typedef struct {
+    FILE* file;
+    bool failed;        // Set when a write did not go through
+    uint64_t checksum;  // Of every byte written so far
+} BinaryWriter;
+
+// Whole file mapped into memory
+typedef struct {
+    const uint8_t* data;
+    size_t length;
+    size_t position;
+    bool failed;        // Set once anything read runs past end or does not make sense
+} BinaryReader;
+
+// FNV-1a, wider than string hashes so damaged or stale files are unlikely to match
+// Pass CHECKSUM_SEED to start, or checksum of bytes before to carry on
+#define CHECKSUM_SEED 14695981039346656037ULL
+uint64_t checksumBytes(uint64_t hash, const void* bytes, size_t count);
+
+void writeBytes(BinaryWriter* writer, const void* bytes, size_t count);
+void writeInt(BinaryWriter* writer, int value);
+void writeDouble(BinaryWriter* writer, double value);
+
+// NULL is written as length -1
+void writeString(BinaryWriter* writer, ObjString* string);
+
+/**
+ * @brief Writes go to a temporary file next to path, which endFile()
+ * renames to path, so readers never see half of a file
+ *
+ * @return bool false if temporary file could not be created
+ */
+bool beginFile(BinaryWriter* writer, const char* path);
+
+// Closes file and moves it to path, or removes it if any write failed
+bool endFile(BinaryWriter* writer, const char* path);
+
+// Maps file at path read only, false if it is missing or empty
+bool mapFile(BinaryReader* reader, const char* path);
+void unmapFile(BinaryReader* reader);
+
+// Returns next count bytes, NULL if there are not that many left
+const uint8_t* readBytes(BinaryReader* reader, size_t count);
+int readInt(BinaryReader* reader);
+double readDouble(BinaryReader* reader);
+
+// Reads a count, which cannot be more than bytes left in file
+int readCount(BinaryReader* reader);
+
+// Interns string read, NULL for length -1
+ObjString* readString(BinaryReader* reader);
+
+#endif
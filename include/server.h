@@ -0,0 +1,46 @@
+// Scripts run by a server that keeps a VM warmed up, for request driven use
+// Each request runs in a fork of server, so globals it defines do not leak
+// into other requests
+
+#ifndef clox_server_h
+#define clox_server_h
+
+#include "common.h"
+
+/*
+ Both ends are on the same machine, integers are 4 bytes in its byte order
+
+    request     script-length script
+    response    exit-status stdout-length stderr-length stdout stderr
+
+ Exit status is the one clox would exit with after running script alone.
+*/
+
+// Longest script accepted by server
+#define SERVER_MAX_SCRIPT (64 * 1024 * 1024)
+
+// Most bytes of stdout and of stderr kept for one request, rest is dropped
+#define SERVER_MAX_OUTPUT (64 * 1024 * 1024)
+
+// Seconds a request may take, scripts running longer are stopped with exit status 70
+#define SERVER_TIME_LIMIT 30
+
+/**
+ * @brief Listens on Unix domain socket at path, replacing a stale one,
+ * and runs each script sent to it in a forked copy of current VM with
+ * stdout and stderr captured
+ *
+ * @return bool false if socket could not be set up or connections
+ * can no longer be accepted, otherwise never returns
+ */
+bool serve(const char* path);
+
+/**
+ * @brief Sends script to server at path and copies output of script
+ * to stdout and stderr
+ *
+ * @return int exit status of script, -1 if server could not be reached
+ */
+int submit(const char* path, const char* source, size_t length);
+
+#endif
@@ -0,0 +1,73 @@
+// Script sources handed to scanner, which stops at their terminating '\0'
+
+#ifndef clox_source_h
+#define clox_source_h
+
+#include "common.h"
+
+typedef struct {
+    char* text;             // Followed by '\0'
+    size_t length;
+    size_t mappedLength;    // Bytes mapped for text, 0 when text was read into malloc'd buffer
+} SourceFile;
+
+/**
+ * @brief Maps regular files straight into memory so scanner runs over
+ * their pages without a copy. Length is taken when file is opened and
+ * bytes appended after that are not seen. Pipes and other files that
+ * cannot be mapped are read until end of file instead.
+ *
+ * @return bool false if file cannot be opened or read
+ */
+bool openSource(SourceFile* source, const char* path);
+void closeSource(SourceFile* source);
+
+// Bytes asked for by each read of a stream
+#define STREAM_READ_SIZE 65536
+
+typedef enum {
+    STREAM_CODE,
+    STREAM_STRING,
+    STREAM_COMMENT
+} StreamState;
+
+// Script read from a pipe or terminal and handed out one complete top
+// level declaration at a time, so each can run before rest arrives
+// Buffer only holds declarations not yet handed out
+typedef struct {
+    int fd;
+    bool interactive;       // Prompts before reads, lines ending outside brackets are complete
+    bool ended;
+
+    char* buffer;
+    size_t length;
+    size_t capacity;
+
+    size_t start;           // First byte not handed out
+    size_t handedOut;       // End of text handed out by last call, 0 if none
+    char replaced;          // Byte overwritten by '\0' there
+    int line;               // Line of start
+
+    // Scan for ends of declarations carries on where it stopped
+    size_t scanned;
+    StreamState state;
+    int depth;              // Open parentheses and braces
+    size_t candidate;       // End of a declaration that may still go on with else, 0 if none
+    size_t boundary;        // End of first declaration known to be complete, 0 if none
+} SourceStream;
+
+void openStream(SourceStream* stream, int fd, bool interactive);
+void closeStream(SourceStream* stream);
+
+/**
+ * @brief Reads until next declaration is complete, in a REPL until a line
+ * ends outside brackets and strings, which may hold several declarations
+ * Text stays valid until next call, a declaration cut off by end of input
+ * is handed out as it is for compiler to report
+ *
+ * @param line Set to line text handed out starts at
+ * @return const char* NULL once input has ended
+ */
+const char* nextDeclaration(SourceStream* stream, int* line);
+
+#endif
@@ -0,0 +1,20 @@
+// Translates compiled bytecode to C source
+// Output is built together with lib/ into an executable running the script
+
+#ifndef clox_transpiler_h
+#define clox_transpiler_h
+
+#include <stdio.h>
+
+#include "common.h"
+#include "object.h"
+
+/**
+ * @brief Writes script and every function reachable from its constants
+ * as C functions using runtime in aot.h
+ *
+ * @return bool false if a function could not be translated
+ */
+bool emitC(ObjFunction* script, FILE* out);
+
+#endif
@@ -0,0 +1,18 @@
+// Checks bytecode produced by compiler before VM runs it
+
+#ifndef clox_verifier_h
+#define clox_verifier_h
+
+#include "common.h"
+#include "object.h"
+
+/**
+ * @brief Follows every path through function's chunk checking
+ * operands, jump targets and stack depths
+ * Sets maxStack of function when code is valid
+ *
+ * @return const char* NULL if valid otherwise reason it is not
+ */
+const char* verifyFunction(ObjFunction* function);
+
+#endif
@@ -9,6 +9,9 @@
 #include "value.h"
 #include "table.h"
 #include "object.h"
+#include "memory.h"
+#include "output.h"
+#include "profile.h"
 
 #define FRAMES_MAX 64
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
@@ -37,24 +40,36 @@ typedef struct {
     // Will point to index next to top, to where the next pushed element will go
     Value* stackTop;    
 
-    // Head of Linked List of Object Type Values
-    Obj* objects;
+    // Objects and interned strings
+    Heap heap;
 
     // Containing Reference to Global Variables
     Table globals;
-    
-    // for string interning
-    Table strings;
+
+    // Branch counts of OP_PROFILE_BRANCH, NULL when not profiling
+    BranchProfile* branchProfile;
+
+    // Kinds of values seen by OP_PROFILE_TYPES, NULL when not profiling
+    TypeProfile* typeProfile;
+
+    // Output of print statements
+    Output output;
+
+    // Functions declared by scripts run are made permanent
+    // Off when scripts are dropped after running, since functions they redefine become garbage
+    bool permanentFunctions;
+
+    // Strings joined by OP_CONCAT are built here before being interned
+    // Not owned by Garbage Collector
+    char* scratch;
+    int scratchLength;
+    int scratchCapacity;
 
     // Memory of Garbage Collector is not managed by Garbage collector
     // Maintaining Gray stack
     int grayCount;
     int grayCapacity;
     Obj** grayStack;
-
-    // State for tracking live memory
-    size_t bytesAllocated;
-    size_t nextGC;          // Threshold that triggers next collection
 } VM;
 
 // For interpreter to set the exit code of the process
@@ -73,6 +88,29 @@ void freeVM();
 
 InterpretResult interpret(const char* chunk);
 
+// Runs script whose objects are already in VM's heap, like one loaded from a cache
+InterpretResult interpretFunction(ObjFunction* function);
+
+// Native function defined with given name, NULL if there is none
+NativeFn findNative(const char* name, int length);
+
+// Name a native function is defined with, NULL if it is not one of them
+const char* nativeName(NativeFn function);
+
+// Runs script compiled on a separate heap
+// Objects of the heap are moved into VM before running
+InterpretResult interpretCompiled(ObjFunction* function, Heap* heap);
+
+/**
+ * @brief Adds values from left to right like a chain of OP_ADD
+ * Joined strings are left in vm.scratch instead of being allocated
+ *
+ * @param joined set to true if operands were strings
+ * @param sum set to sum if operands were numbers
+ * @return bool false if operands cannot be added
+ */
+bool addValues(Value* operands, int count, bool* joined, double* sum);
+
 // To push value at top pointer
 void push(Value value);
 
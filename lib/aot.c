@@ -0,0 +1,177 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./../include/aot.h"
+#include "./../include/memory.h"
+
+AotFrame aotFrames[FRAMES_MAX];
+int aotFrameCount = 0;
+
+void aotRuntimeError(const char* format, ...)
+{
+    flushOutput(&vm.output);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+
+    fputs("\n", stderr);
+
+    // Same stack trace as interpreter
+    for (int i = aotFrameCount - 1; i >= 0; i--) {
+        AotFrame* frame = &aotFrames[i];
+
+        fprintf(stderr, "[line %d] in ", frame->line);
+
+        if (frame->function->name == NULL) {
+            fprintf(stderr, "script\n");
+        } else {
+            fprintf(stderr, "%s()\n", frame->function->name->chars);
+        }
+    }
+
+    exit(70);
+}
+
+ObjFunction* aotFunction(const char* name, int arity, int maxStack, AotFn body)
+{
+    ObjFunction* function = newFunction();
+    function->arity = arity;
+    function->maxStack = maxStack;
+    function->aot = body;
+
+    if (name != NULL) {
+        function->name = copyString(name, (int)strlen(name));
+    }
+
+    return function;
+}
+
+void aotCall(int argCount)
+{
+    Value callee = AOT_PEEK(argCount);
+
+    if (IS_NATIVE(callee)) {
+        NativeFn native = AS_NATIVE(callee);
+        Value result = native(argCount, vm.stackTop - argCount);
+        vm.stackTop -= argCount + 1;
+        AOT_PUSH(result);
+        return;
+    }
+
+    if (!IS_FUNCTION(callee) || AS_FUNCTION(callee)->aot == NULL) {
+        aotRuntimeError("Can only call functions and classes.");
+    }
+
+    ObjFunction* function = AS_FUNCTION(callee);
+
+    if (argCount != function->arity) {
+        aotRuntimeError("Expected %d arguements but got %d.", function->arity, argCount);
+    }
+
+    Value* slots = vm.stackTop - argCount - 1;
+    if (aotFrameCount == FRAMES_MAX || slots + function->maxStack > vm.stack + STACK_MAX) {
+        aotRuntimeError("Stack overflow.");
+    }
+
+    AotFrame* frame = &aotFrames[aotFrameCount++];
+    frame->function = function;
+    frame->line = 0;
+
+    function->aot(slots);
+
+    aotFrameCount--;
+}
+
+void aotAdd()
+{
+    if (IS_STRING(AOT_PEEK(0)) && IS_STRING(AOT_PEEK(1))) {
+        ObjString* b = AS_STRING(AOT_PEEK(0));
+        ObjString* a = AS_STRING(AOT_PEEK(1));
+
+        int length = a->length + b->length;
+        char* chars = ALLOCATE(char, length + 1);
+        memcpy(chars, a->chars, a->length);
+        memcpy(chars + a->length, b->chars, b->length);
+        chars[length] = '\0';
+
+        // Operands stay on stack until result is allocated
+        ObjString* result = takeString(chars, length);
+        vm.stackTop -= 2;
+        AOT_PUSH(OBJ_VAL(result));
+    } else if (IS_NUMBER(AOT_PEEK(0)) && IS_NUMBER(AOT_PEEK(1))) {
+        double b = AS_NUMBER(AOT_POP());
+        double a = AS_NUMBER(AOT_POP());
+        AOT_PUSH(NUMBER_VAL(a + b));
+    } else {
+        aotRuntimeError("Operands must be two numbers or two strings.");
+    }
+}
+
+void aotConcat(int count)
+{
+    bool joined;
+    double sum;
+
+    if (!addValues(vm.stackTop - count, count, &joined, &sum)) {
+        aotRuntimeError("Operands must be two numbers or two strings.");
+    }
+
+    Value result = joined
+        ? OBJ_VAL(copyString(vm.scratch, vm.scratchLength))
+        : NUMBER_VAL(sum);
+
+    vm.stackTop -= count;
+    AOT_PUSH(result);
+}
+
+void aotPrintConcat(int count)
+{
+    bool joined;
+    double sum;
+
+    if (!addValues(vm.stackTop - count, count, &joined, &sum)) {
+        aotRuntimeError("Operands must be two numbers or two strings.");
+    }
+
+    if (joined) {
+        writeTextLine(&vm.output, vm.scratch, vm.scratchLength);
+    } else {
+        writeLine(&vm.output, NUMBER_VAL(sum));
+    }
+
+    vm.stackTop -= count;
+}
+
+void aotGetGlobal(ObjString* name)
+{
+    Value value;
+    if (!tableGet(&vm.globals, name, &value)) {
+        aotRuntimeError("Undefined variable '%s'.", name->chars);
+    }
+
+    AOT_PUSH(value);
+}
+
+void aotSetGlobal(ObjString* name)
+{
+    // Implicit Variable declaration is not supported
+    if (tableSet(&vm.globals, name, AOT_PEEK(0))) {
+        tableDelete(&vm.globals, name);
+        aotRuntimeError("Undefined variable '%s'.", name->chars);
+    }
+}
+
+int aotRun(ObjFunction* script)
+{
+    AOT_PUSH(OBJ_VAL(script));
+    aotCall(0);
+
+    // Dropping result of script along with script itself
+    vm.stackTop = vm.stack;
+
+    freeVM();
+    return 0;
+}
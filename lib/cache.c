@@ -0,0 +1,402 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "./../include/cache.h"
+#include "./../include/compiler.h"
+#include "./../include/memory.h"
+#include "./../include/serialize.h"
+#include "./../include/verifier.h"
+
+/*
+ Layout of a .loxc file
+
+    "LOXC" version source-hash(8 bytes) source-length options-hash
+    function
+    checksum(8 bytes)
+
+ where each function is
+    arity name code-count code line-count (offset line)...
+    inlined-count (line name call-line)... constant-count constant...
+
+ and each constant starts with one of the tags below. A function seen
+ before is written as a reference to its position in order of writing,
+ so functions shared by several chunks or calling themselves stay shared.
+ Checksum covers every byte before it, so damaged files are not run.
+*/
+
+typedef enum {
+    TAG_NIL,
+    TAG_FALSE,
+    TAG_TRUE,
+    TAG_NUMBER,
+    TAG_STRING,
+    TAG_FUNCTION,
+    TAG_FUNCTION_REF,
+    TAG_SWITCH
+} ConstantTag;
+
+// Functions in order they are written, script is first
+typedef struct {
+    int count;
+    int capacity;
+    ObjFunction** functions;
+} FunctionList;
+
+static void initFunctionList(FunctionList* list)
+{
+    list->count = 0;
+    list->capacity = 0;
+    list->functions = NULL;
+}
+
+static int functionIndex(FunctionList* list, ObjFunction* function)
+{
+    for (int i = 0; i < list->count; i++) {
+        if (list->functions[i] == function) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void addFunction(FunctionList* list, ObjFunction* function)
+{
+    if (list->capacity < list->count + 1) {
+        list->capacity = GROW_CAPACITY(list->capacity);
+        list->functions = (ObjFunction**)realloc(list->functions, sizeof(ObjFunction*) * list->capacity);
+        if (list->functions == NULL) {
+            fprintf(stderr, "Not enough memory for bytecode cache.\n");
+            exit(74);
+        }
+    }
+
+    list->functions[list->count++] = function;
+}
+
+// Bytecode depends on compiler options, so files written with other options are not used
+static uint32_t hashOptions()
+{
+    int options[] = {
+        compilerOptions.inlineFunctions,
+        compilerOptions.inlineBudget,
+        compilerOptions.hoistInvariants,
+        compilerOptions.inferTypes,
+        compilerOptions.maxClones,
+        compilerOptions.eliminateSubexpressions,
+        compilerOptions.unrollFactor,
+        compilerOptions.concatChains,
+        compilerOptions.constGlobals
+    };
+
+    return hashString((const char*)options, (int)sizeof(options));
+}
+
+// WRITING
+
+typedef struct {
+    BinaryWriter file;
+    FunctionList functions;
+} Writer;
+
+static void writeFunction(Writer* writer, ObjFunction* function);
+
+static void writeConstant(Writer* writer, Value value)
+{
+    if (IS_NIL(value)) {
+        writeInt(&writer->file, TAG_NIL);
+    } else if (IS_BOOL(value)) {
+        writeInt(&writer->file, AS_BOOL(value) ? TAG_TRUE : TAG_FALSE);
+    } else if (IS_NUMBER(value)) {
+        writeInt(&writer->file, TAG_NUMBER);
+        writeDouble(&writer->file, AS_NUMBER(value));
+    } else if (IS_STRING(value)) {
+        writeInt(&writer->file, TAG_STRING);
+        writeString(&writer->file, AS_STRING(value));
+    } else if (IS_FUNCTION(value)) {
+        int index = functionIndex(&writer->functions, AS_FUNCTION(value));
+        if (index != -1) {
+            writeInt(&writer->file, TAG_FUNCTION_REF);
+            writeInt(&writer->file, index);
+        } else {
+            writeInt(&writer->file, TAG_FUNCTION);
+            writeFunction(writer, AS_FUNCTION(value));
+        }
+    } else if (IS_SWITCH(value)) {
+        ObjSwitch* jumpTable = AS_SWITCH(value);
+        writeInt(&writer->file, TAG_SWITCH);
+        writeInt(&writer->file, jumpTable->low);
+        writeInt(&writer->file, jumpTable->count);
+        for (int i = 0; i < jumpTable->count; i++) {
+            writeInt(&writer->file, jumpTable->distances[i]);
+        }
+        writeInt(&writer->file, jumpTable->defaultDistance);
+
+        int stringCount = 0;
+        for (int i = 0; i <= jumpTable->strings.capacity; i++) {
+            if (jumpTable->strings.entries[i].key != NULL) {
+                stringCount++;
+            }
+        }
+
+        writeInt(&writer->file, stringCount);
+        for (int i = 0; i <= jumpTable->strings.capacity; i++) {
+            Entry* entry = &jumpTable->strings.entries[i];
+            if (entry->key != NULL) {
+                writeString(&writer->file, entry->key);
+                writeInt(&writer->file, (int)AS_NUMBER(entry->value));
+            }
+        }
+    } else {
+        // Natives only exist at runtime
+        writer->file.failed = true;
+    }
+}
+
+static void writeFunction(Writer* writer, ObjFunction* function)
+{
+    addFunction(&writer->functions, function);
+
+    // Skimmed bodies point into source, which is not kept
+    if (function->lazySource != NULL) {
+        writer->file.failed = true;
+        return;
+    }
+
+    Chunk* chunk = &function->chunk;
+    writeInt(&writer->file, function->arity);
+    writeString(&writer->file, function->name);
+
+    writeInt(&writer->file, chunk->count);
+    writeBytes(&writer->file, chunk->code, chunk->count);
+
+    writeInt(&writer->file, chunk->lineCount);
+    for (int i = 0; i < chunk->lineCount; i++) {
+        writeInt(&writer->file, chunk->lines[i].offset);
+        writeInt(&writer->file, chunk->lines[i].line);
+    }
+
+    writeInt(&writer->file, chunk->inlinedCount);
+    for (int i = 0; i < chunk->inlinedCount; i++) {
+        writeInt(&writer->file, chunk->inlined[i].line);
+        writeInt(&writer->file, chunk->inlined[i].name);
+        writeInt(&writer->file, chunk->inlined[i].callLine);
+    }
+
+    writeInt(&writer->file, chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count && !writer->file.failed; i++) {
+        writeConstant(writer, chunk->constants.values[i]);
+    }
+}
+
+bool saveCache(ObjFunction* script, const char* source, const char* path)
+{
+    Writer writer;
+    if (!beginFile(&writer.file, path)) {
+        return false;
+    }
+    initFunctionList(&writer.functions);
+
+    size_t sourceLength = strlen(source);
+    uint64_t sourceHash = checksumBytes(CHECKSUM_SEED, source, sourceLength);
+
+    writeBytes(&writer.file, "LOXC", 4);
+    writeInt(&writer.file, CACHE_VERSION);
+    writeBytes(&writer.file, &sourceHash, sizeof(sourceHash));
+    writeInt(&writer.file, (int)sourceLength);
+    writeInt(&writer.file, (int)hashOptions());
+    writeFunction(&writer, script);
+
+    uint64_t checksum = writer.file.checksum;
+    writeBytes(&writer.file, &checksum, sizeof(checksum));
+
+    free(writer.functions.functions);
+    return endFile(&writer.file, path);
+}
+
+// READING
+
+typedef struct {
+    BinaryReader file;
+    FunctionList functions;
+} Reader;
+
+static void readFunction(Reader* reader, ObjFunction* function);
+
+// Reads next constant into constants of chunk
+// New objects are added right away so collector can reach them while they are filled
+static void readConstant(Reader* reader, Chunk* chunk)
+{
+    switch (readInt(&reader->file)) {
+        case TAG_NIL: addConstant(chunk, NIL_VAL); break;
+        case TAG_FALSE: addConstant(chunk, BOOL_VAL(false)); break;
+        case TAG_TRUE: addConstant(chunk, BOOL_VAL(true)); break;
+
+        case TAG_NUMBER: {
+            addConstant(chunk, NUMBER_VAL(readDouble(&reader->file)));
+            break;
+        }
+
+        case TAG_STRING: {
+            ObjString* string = readString(&reader->file);
+            if (string == NULL) {
+                reader->file.failed = true;
+                break;
+            }
+            addConstant(chunk, OBJ_VAL(string));
+            break;
+        }
+
+        case TAG_FUNCTION: {
+            ObjFunction* function = newFunction();
+            addConstant(chunk, OBJ_VAL(function));
+            readFunction(reader, function);
+            break;
+        }
+
+        case TAG_FUNCTION_REF: {
+            int index = readInt(&reader->file);
+            if (index < 0 || index >= reader->functions.count) {
+                reader->file.failed = true;
+                break;
+            }
+            addConstant(chunk, OBJ_VAL(reader->functions.functions[index]));
+            break;
+        }
+
+        case TAG_SWITCH: {
+            ObjSwitch* jumpTable = newSwitch();
+            addConstant(chunk, OBJ_VAL(jumpTable));
+
+            jumpTable->low = readInt(&reader->file);
+            int count = readCount(&reader->file);
+            jumpTable->distances = ALLOCATE(int, count);
+            jumpTable->count = count;
+            for (int i = 0; i < count; i++) {
+                jumpTable->distances[i] = readInt(&reader->file);
+            }
+            jumpTable->defaultDistance = readInt(&reader->file);
+
+            int stringCount = readCount(&reader->file);
+            for (int i = 0; i < stringCount && !reader->file.failed; i++) {
+                ObjString* key = readString(&reader->file);
+                int distance = readInt(&reader->file);
+                if (key == NULL) {
+                    reader->file.failed = true;
+                    break;
+                }
+
+                protectValue(OBJ_VAL(key));
+                tableSet(&jumpTable->strings, key, NUMBER_VAL((double)distance));
+                unprotectValue();
+            }
+            break;
+        }
+
+        default:
+            reader->file.failed = true;
+            break;
+    }
+}
+
+static void readFunction(Reader* reader, ObjFunction* function)
+{
+    addFunction(&reader->functions, function);
+
+    Chunk* chunk = &function->chunk;
+    function->arity = readInt(&reader->file);
+    function->name = readString(&reader->file);
+
+    int codeCount = readCount(&reader->file);
+    const uint8_t* code = readBytes(&reader->file, codeCount);
+    if (code == NULL || codeCount == 0) {
+        // Every compiled function ends with a return, so empty code means file is damaged
+        reader->file.failed = true;
+        return;
+    }
+    chunk->code = ALLOCATE(uint8_t, codeCount);
+    chunk->capacity = codeCount;
+    chunk->count = codeCount;
+    memcpy(chunk->code, code, codeCount);
+
+    int lineCount = readCount(&reader->file);
+    chunk->lines = ALLOCATE(LineStart, lineCount);
+    chunk->lineCapacity = lineCount;
+    chunk->lineCount = lineCount;
+    for (int i = 0; i < lineCount; i++) {
+        chunk->lines[i].offset = readInt(&reader->file);
+        chunk->lines[i].line = readInt(&reader->file);
+    }
+
+    int inlinedCount = readCount(&reader->file);
+    chunk->inlined = ALLOCATE(InlinedLine, inlinedCount);
+    chunk->inlinedCapacity = inlinedCount;
+    chunk->inlinedCount = inlinedCount;
+    for (int i = 0; i < inlinedCount; i++) {
+        chunk->inlined[i].line = readInt(&reader->file);
+        chunk->inlined[i].name = readInt(&reader->file);
+        chunk->inlined[i].callLine = readInt(&reader->file);
+    }
+
+    int constantCount = readCount(&reader->file);
+    for (int i = 0; i < constantCount && !reader->file.failed; i++) {
+        readConstant(reader, chunk);
+    }
+}
+
+ObjFunction* loadCache(const char* source, const char* path)
+{
+    Reader reader;
+    if (!mapFile(&reader.file, path)) {
+        return NULL;
+    }
+    initFunctionList(&reader.functions);
+
+    size_t sourceLength = strlen(source);
+    uint64_t sourceHash = 0;
+
+    const uint8_t* magic = readBytes(&reader.file, 4);
+    int version = readInt(&reader.file);
+    const uint8_t* hash = readBytes(&reader.file, sizeof(sourceHash));
+    if (hash != NULL) {
+        memcpy(&sourceHash, hash, sizeof(sourceHash));
+    }
+    int cachedLength = readInt(&reader.file);
+    uint32_t options = (uint32_t)readInt(&reader.file);
+
+    bool current = !reader.file.failed && memcmp(magic, "LOXC", 4) == 0 &&
+        version == CACHE_VERSION && (size_t)cachedLength == sourceLength &&
+        sourceHash == checksumBytes(CHECKSUM_SEED, source, sourceLength) && options == hashOptions();
+
+    ObjFunction* script = NULL;
+    if (current) {
+        script = newFunction();
+        protectValue(OBJ_VAL(script));
+        readFunction(&reader, script);
+
+        size_t checked = reader.file.position;
+        uint64_t checksum = 0;
+        const uint8_t* stored = readBytes(&reader.file, sizeof(checksum));
+        if (stored != NULL) {
+            memcpy(&checksum, stored, sizeof(checksum));
+        }
+
+        // Whole file has to be used and match its checksum, script takes no arguments
+        // like a compiled one, and every function has to pass verifier
+        bool valid = !reader.file.failed && reader.file.position == reader.file.length &&
+            checksum == checksumBytes(CHECKSUM_SEED, reader.file.data, checked) &&
+            script->arity == 0;
+        for (int i = 0; i < reader.functions.count && valid; i++) {
+            valid = verifyFunction(reader.functions.functions[i]) == NULL;
+        }
+
+        unprotectValue();
+        if (!valid) {
+            script = NULL;
+        }
+    }
+
+    free(reader.functions.functions);
+    unmapFile(&reader.file);
+    return script;
+}
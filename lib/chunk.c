@@ -9,7 +9,12 @@ void initChunk(Chunk* chunk)
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
     chunk->lines = NULL;
+    chunk->inlinedCount = 0;
+    chunk->inlinedCapacity = 0;
+    chunk->inlined = NULL;
     initValueArray(&chunk->constants);
 }
 
@@ -26,34 +31,192 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line)
             oldCapacity,
             chunk->capacity
         );
+    }
+
+    chunk->code[chunk->count] = byte;
+    chunk->count++;
+
+    // Byte continues the run of previous byte
+    if (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].line == line) {
+        return;
+    }
+
+    if (chunk->lineCapacity < chunk->lineCount + 1) {
+        int oldCapacity = chunk->lineCapacity;
+        chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
 
         chunk->lines = GROW_ARRAY(
-            int,
+            LineStart,
             chunk->lines,
             oldCapacity,
-            chunk->capacity
+            chunk->lineCapacity
         );
     }
 
-    chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
-    chunk->count++;
+    LineStart* lineStart = &chunk->lines[chunk->lineCount++];
+    lineStart->offset = chunk->count - 1;
+    lineStart->line = line;
 }
 
 void freeChunk(Chunk* chunk)
 {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    FREE_ARRAY(InlinedLine, chunk->inlined, chunk->inlinedCapacity);
     freeValueArray(&chunk->constants);
     initChunk(chunk);
 }
 
+void truncateChunk(Chunk* chunk, int count)
+{
+    chunk->count = count;
+
+    while (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].offset >= count) {
+        chunk->lineCount--;
+    }
+}
+
+int getLine(Chunk* chunk, int offset)
+{
+    // Binary search for last run starting at or before offset
+    int start = 0;
+    int end = chunk->lineCount - 1;
+
+    while (start < end) {
+        int mid = start + (end - start + 1) / 2;
+
+        if (chunk->lines[mid].offset <= offset) {
+            start = mid;
+        } else {
+            end = mid - 1;
+        }
+    }
+
+    return chunk->lines[start].line;
+}
+
+int sourceLine(Chunk* chunk, int offset)
+{
+    int line = getLine(chunk, offset);
+    return line < 0 ? chunk->inlined[-1 - line].line : line;
+}
+
+int addInlinedLine(Chunk* chunk, int line, int name, int callLine)
+{
+    // Every instruction of an inlined body is added, most share a line
+    for (int i = chunk->inlinedCount - 1; i >= 0; i--) {
+        InlinedLine* inlined = &chunk->inlined[i];
+        if (inlined->line == line && inlined->name == name && inlined->callLine == callLine) {
+            return -1 - i;
+        }
+    }
+
+    if (chunk->inlinedCapacity < chunk->inlinedCount + 1) {
+        int oldCapacity = chunk->inlinedCapacity;
+        chunk->inlinedCapacity = GROW_CAPACITY(oldCapacity);
+
+        chunk->inlined = GROW_ARRAY(
+            InlinedLine,
+            chunk->inlined,
+            oldCapacity,
+            chunk->inlinedCapacity
+        );
+    }
+
+    InlinedLine* inlined = &chunk->inlined[chunk->inlinedCount++];
+    inlined->line = line;
+    inlined->name = name;
+    inlined->callLine = callLine;
+    return -chunk->inlinedCount;
+}
+
 int addConstant(Chunk* chunk, Value value)
 {
     // Temporarily pushing string to stack
     // to prevent the bug of resizing and calling GC at same time
-    push(value);
+    protectValue(value);
     writeValueArray(&chunk->constants, value);
-    pop();
+    unprotectValue();
     return chunk->constants.count - 1;
+}
+
+int operandCount(uint8_t instruction)
+{
+    switch (instruction) {
+        case OP_CONSTANT:
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_CALL:
+        case OP_CONCAT:
+        case OP_PRINT_CONCAT:
+        case OP_SWITCH:
+            return 1;
+
+        // 16 bit jump offsets
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP:
+        case OP_LOOP:
+            return 2;
+
+        case OP_PROFILE_BRANCH:
+        case OP_GUARD_NUMBERS:
+            return 3;
+
+        case OP_PROFILE_TYPES:
+            return 4;
+
+        default:
+            return 0;
+    }
+}
+
+int stackEffect(uint8_t instruction, int operand)
+{
+    switch (instruction) {
+        case OP_CONSTANT:
+        case OP_GET_GLOBAL:
+        case OP_GET_LOCAL:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+            return 1;
+
+        case OP_DEFINE_GLOBAL:
+        case OP_ADD:
+        case OP_ADD_GUARDED:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD_NUMBER:
+        case OP_SUBTRACT_NUMBER:
+        case OP_MULTIPLY_NUMBER:
+        case OP_DIVIDE_NUMBER:
+        case OP_GREATER_NUMBER:
+        case OP_LESS_NUMBER:
+        case OP_PRINT:
+        case OP_POP:
+        case OP_RETURN:
+            return -1;
+
+        // Callee and arguements are replaced by the returned value
+        case OP_CALL:
+            return -operand;
+
+        // Operands are replaced by their sum
+        case OP_CONCAT:
+            return 1 - operand;
+
+        case OP_PRINT_CONCAT:
+            return -operand;
+
+        default:
+            return 0;
+    }
 }
\ No newline at end of file
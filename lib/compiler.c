@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,18 +8,53 @@
 #include "./../include/memory.h"
 #include "./../include/compiler.h"
 
+#include "./../include/verifier.h"
+
 #ifdef DEBUG_PRINT_CODE
 #include "./../include/debug.h"
 #endif
 
-Parser parser;
-Compiler* current = NULL;
-Chunk* compilingChunk;
+// Compilation running on this thread
+static thread_local CompileContext* context = NULL;
+
+// Where errors of compilations on this thread go, stderr when NULL
+static thread_local FILE* errorOutput = NULL;
+
+CompilerOptions compilerOptions = {
+    true,   // inlineFunctions
+    32,     // inlineBudget
+    true,   // hoistInvariants
+    true,   // inferTypes
+    4,      // unrollFactor
+    4,      // maxClones
+    true,   // eliminateSubexpressions
+    true,   // concatChains
+    false,  // lazyFunctions
+    false,  // constGlobals
+    false,  // profileBranches
+    NULL,   // branchProfile
+    false,  // profileTypes
+    NULL    // typeProfile
+};
+
+// Token for a name that does not come from source
+static Token syntheticToken(const char* text)
+{
+    Token token;
+    token.type = TOKEN_IDENTIFIER;
+    token.start = text;
+    token.length = (int)strlen(text);
+    token.line = context->parser.previous.line;
+    token.hash = hashString(text, token.length);
+
+    return token;
+}
 
 // COMPILER OPERTATIONS
-static void initCompiler(Compiler* compiler, FunctionType type)
+// function is the object to compile into, NULL creates a new one
+static void initCompiler(Compiler* compiler, FunctionType type, ObjFunction* function)
 {
-    compiler->enclosing = current;
+    compiler->enclosing = context->current;
 
     // Creating function at compile time for top level execution
     compiler->function = NULL;
@@ -27,76 +63,113 @@ static void initCompiler(Compiler* compiler, FunctionType type)
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
 
-    compiler->function = newFunction();
+    for (int i = 0; i < LOCAL_BUCKETS; i++) {
+        compiler->localBuckets[i] = -1;
+    }
+
+    for (int i = 0; i < IDENTIFIER_SLOTS; i++) {
+        compiler->identifiers[i].start = NULL;
+    }
 
-    current = compiler;
+    compiler->stackDepth = 1;
+    compiler->pendingOperands = 0;
+    compiler->pendingOpcode = OP_RETURN;
+    compiler->returnDepth = -1;
+    compiler->lastGlobalGet = -1;
+    compiler->lastConcat = -1;
+    compiler->exprType = STATIC_UNKNOWN;
+    compiler->clone = NULL;
+    compiler->cloneFailed = false;
+    compiler->hasInlined = false;
+
+    if (function != NULL) {
+        compiler->function = function;
+        context->current = compiler;
+    } else {
+        compiler->function = newFunction();
+        context->current = compiler;
+    }
 
-    if (type != TYPE_SCRIPT) {
+    if (type != TYPE_SCRIPT && function == NULL) {
         // Setting function name from previous token
         // We copy string because the source code string will get freed after compiling
         // But we need the string name in runtime to reference
-        current->function->name = copyString(
-            parser.previous.start,
-            parser.previous.length
+        context->current->function->name = copyString(
+            context->parser.previous.start,
+            context->parser.previous.length
         );
     }
 
     // Defining stack slot zero for VM's own internal use
-    Local* local = &current->locals[current->localCount++];
+    // Its empty name can never be referenced, so it is kept out of buckets
+    Local* local = &context->current->locals[context->current->localCount++];
     local->depth = 0;
-    local->name.start = "";
-    local->name.length = 0;
+    local->name = syntheticToken("");
+    local->type = STATIC_UNKNOWN;
+    local->isConst = false;
+    local->nextInBucket = -1;
 }
 
 // PARSER UTILITIES
+// Output of program so far comes before what compiler prints
+// Compilations on worker threads happen before any program runs
+static void flushProgramOutput()
+{
+    if (currentHeap == &vm.heap) {
+        flushOutput(&vm.output);
+    }
+}
+
 static void errorAt(Token* token, const char* message)
 {
-    if (parser.panicMode) {
+    if (context->parser.panicMode || context->inlineOverflow) {
         return;
     }
 
-    parser.panicMode = true;
+    context->parser.panicMode = true;
+    flushProgramOutput();
 
-    fprintf(stderr, "[line %d] Error", token->line);
+    FILE* out = errorOutput != NULL ? errorOutput : stderr;
+    fprintf(out, "[line %d] Error", token->line);
 
     if (token->type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
+        fprintf(out, " at end");
     } else if (token->type == TOKEN_ERROR) {
 
     } else {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(out, " at '%.*s'", token->length, token->start);
     }
 
-    fprintf(stderr, ": %s\n", message);
-    parser.hadError = true;
+    fprintf(out, ": %s\n", message);
+    context->parser.hadError = true;
 }
 
 // Prints current based on current token
 static void error(const char* message)
 {
-    errorAt(&parser.previous, message);
+    errorAt(&context->parser.previous, message);
 }
 
 // Prints current based on previous token
 static void errorAtCurrent(const char* message)
 {
-    errorAt(&parser.current, message);
+    errorAt(&context->parser.current, message);
 }
 
 static void advance()
 {
     // Storing previous token in parser before advancing
-    parser.previous = parser.current;
+    context->parser.previous = context->parser.current;
 
     // Keeps looping until non error token is encountered
     for (;;) {
-        parser.current = scanToken();
-        if (parser.current.type != TOKEN_ERROR) {
+        context->parser.current = scanToken(&context->scanner);
+        if (context->parser.current.type != TOKEN_ERROR) {
             break;
         }
 
         // Parser responsible to report Lexical errors
-        errorAtCurrent(parser.current.start);
+        errorAtCurrent(context->parser.current.start);
     }
 }
 
@@ -105,7 +178,7 @@ static void advance()
 // Prints error if type doesnt match
 static void consume(TokenType type, const char* message)
 {
-    if (parser.current.type == type) {
+    if (context->parser.current.type == type) {
         advance();
         return;
     }
@@ -115,7 +188,7 @@ static void consume(TokenType type, const char* message)
 
 static bool check(TokenType type)
 {
-    return parser.current.type == type;
+    return context->parser.current.type == type;
 }
 
 // If current token has given type, we consume the token
@@ -135,13 +208,46 @@ static Chunk* currentChunk()
 {
     // current chunk is always the chunk owned by the function 
     // we're in middle of compiling
-    return &current->function->chunk;
+    return &context->current->function->chunk;
+}
+
+// Keeps track of stack depth of current function as bytes get emitted
+static void trackStack(uint8_t byte)
+{
+    if (context->current->pendingOperands > 0) {
+        context->current->pendingOperands--;
+
+        // These pop as many values as their operand says
+        uint8_t opcode = context->current->pendingOpcode;
+        if (opcode == OP_CALL || opcode == OP_CONCAT || opcode == OP_PRINT_CONCAT) {
+            context->current->stackDepth += stackEffect(opcode, byte);
+        }
+        return;
+    }
+
+    if (byte == OP_RETURN && context->current->returnDepth == -1) {
+        context->current->returnDepth = context->current->stackDepth;
+    }
+
+    context->current->pendingOpcode = byte;
+    context->current->pendingOperands = operandCount(byte);
+
+    if (byte != OP_CALL && byte != OP_CONCAT && byte != OP_PRINT_CONCAT) {
+        context->current->stackDepth += stackEffect(byte, 0);
+    }
 }
 
 // Writes the given byte to chunk
+// Code copied from other chunks keeps lines it came from
+static void emitByteAt(uint8_t byte, int line)
+{
+    writeChunk(currentChunk(), byte, line);
+    trackStack(byte);
+}
+
 static void emitByte(uint8_t byte)
 {
-    writeChunk(currentChunk(), byte, parser.previous.line);
+    emitByteAt(byte, context->parser.previous.line);
 }
 
 // Helper function to emit opcodes that have operands
@@ -158,12 +264,38 @@ static void emitReturn()
     emitByte(OP_RETURN);
 }
 
+// Constants that are the same value, numbers compared by bits so 0 and -0 stay apart
+static bool sameConstant(Value a, Value b)
+{
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+
+    return valuesEqual(a, b);
+}
+
 static uint8_t makeConstant(Value value)
 {
+    // Literals used many times and constants of inlined bodies share one slot
+    ValueArray* constants = &currentChunk()->constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (sameConstant(constants->values[i], value)) {
+            return (uint8_t)i;
+        }
+    }
+
     int constant = addConstant(currentChunk(), value);
 
     // Restricting max number of constants in chunk
     if (constant > UINT8_MAX) {
+        // Without inlining function may still fit, so source is compiled again
+        if (context->current->hasInlined && !context->parser.hadError) {
+            context->inlineOverflow = true;
+            return 0;
+        }
+
         error("Too many constants in one chunk.");
         return 0;
     }
@@ -179,57 +311,98 @@ static void emitConstant(Value value)
 
 static void beginScope()
 {
-    current->scopeDepth++;
+    context->current->scopeDepth++;
 }
 
 static void endScope()
 {
-    current->scopeDepth--;
+    context->current->scopeDepth--;
 
     // Removing Local variables from top of stack
     while (
-        current->localCount > 0 &&
-        current->locals[current->localCount - 1].depth > current->scopeDepth
+        context->current->localCount > 0 &&
+        context->current->locals[context->current->localCount - 1].depth > context->current->scopeDepth
     ) {
         emitByte(OP_POP);
-        current->localCount--;
+
+        // Popped local is always the newest one in its bucket
+        Local* local = &context->current->locals[--context->current->localCount];
+        context->current->localBuckets[local->name.hash & (LOCAL_BUCKETS - 1)] = local->nextInBucket;
     }
 }
 
 static ObjFunction* endCompiler()
 {
-    // Temporary emit to print the evaluated expression
-    emitReturn();
+    ObjFunction* function = context->current->function;
+
+    // Skimmed bodies get their code once compiled on first call
+    if (function->lazySource == NULL) {
+        // Temporary emit to print the evaluated expression
+        emitReturn();
+
+        // Finding stack size of frames, VM relies on it instead of checking every push
+        const char* invalid = context->parser.hadError || context->inlineOverflow ? NULL : verifyFunction(function);
+        if (invalid != NULL) {
+            error(invalid);
+        }
+    }
+
+#ifdef DEBUG_PRINT_CODE
+    if (!context->parser.hadError && !context->inlineOverflow && function->lazySource == NULL) {
+        if (context->finishedCapacity < context->finishedCount + 1) {
+            context->finishedCapacity = GROW_CAPACITY(context->finishedCapacity);
+            context->finished = (ObjFunction**)realloc(context->finished, sizeof(ObjFunction*) * context->finishedCapacity);
+            if (context->finished == NULL) {
+                fprintf(stderr, "Not enough memory to print code.\n");
+                exit(74);
+            }
+        }
+
+        context->finished[context->finishedCount++] = function;
+    }
+#endif
 
-    ObjFunction* function = current->function;
+    context->current = context->current->enclosing;
+    return function;
+}
 
 #ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError) {
+// Disassembles functions finished by pass if its code is kept, nothing of a pass compiled again is printed
+static void printFinished(bool kept)
+{
+    if (kept) {
+        flushProgramOutput();
+    }
+
+    for (int i = 0; i < context->finishedCount && kept; i++) {
+        ObjFunction* function = context->finished[i];
+
         // Handling Implicit function since it does not have name
-        disassembleChunk(currentChunk(), 
+        disassembleChunk(&function->chunk,
             function->name != NULL ? function->name->chars : "<script>"
         );
     }
-#endif
 
-    current = current->enclosing;
-    return function;
+    free(context->finished);
 }
+#endif
 
 // PARSING FUNCTIONS
 
 // Forward declaration of functions for parser
 static void expression();
 static void statement();
+static void switchStatement();
 static void declaration();
 static void varDeclaration();
 static ParseRule* getRule(TokenType type);
+static bool foldConstant(int start, Value* result);
 
 // Parses any expression at the given precedence level or higher
 static void parsePrecedence(Precedence precedence)
 {
     advance();
-    ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+    ParseFn prefixRule = getRule(context->parser.previous.type)->prefix;
 
     // Syntax Error
     if (prefixRule == NULL) {
@@ -244,10 +417,10 @@ static void parsePrecedence(Precedence precedence)
     prefixRule(canAssign);
 
     // Infix expressions evaluated based on Precedence
-    while (precedence <= getRule(parser.current.type)->precedence) {
+    while (precedence <= getRule(context->parser.current.type)->precedence) {
         advance();
 
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
+        ParseFn infixRule = getRule(context->parser.previous.type)->infix;
         infixRule(canAssign);
     }
 
@@ -260,60 +433,117 @@ static void parsePrecedence(Precedence precedence)
 // Defining Variable string name in chunk constant table
 static uint8_t identifierConstant(Token* name)
 {
+    Chunk* chunk = currentChunk();
+    uint32_t index = name->hash & (IDENTIFIER_SLOTS - 1);
+
+    // Reusing constant made for an earlier use of same name
+    for (;;) {
+        IdentifierConstant* slot = &context->current->identifiers[index];
+
+        if (slot->start == NULL) {
+            break;
+        }
+
+        if (slot->hash == name->hash && slot->length == name->length &&
+            memcmp(slot->start, name->start, name->length) == 0) {
+            // Constant may have been dropped when compiler rewound the chunk
+            Value constant = slot->constant < chunk->constants.count
+                ? chunk->constants.values[slot->constant]
+                : NIL_VAL;
+
+            if (IS_STRING(constant) && AS_STRING(constant)->length == name->length &&
+                memcmp(AS_CSTRING(constant), name->start, name->length) == 0) {
+                return (uint8_t)slot->constant;
+            }
+            break;
+        }
+
+        index = (index + 1) & (IDENTIFIER_SLOTS - 1);
+    }
+
     // Since whole string for variable name is too big
     // to put in 1 byte code
     // We use Constant Table
-    return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+    uint8_t constant = makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+
+    IdentifierConstant* slot = &context->current->identifiers[index];
+    slot->start = name->start;
+    slot->length = name->length;
+    slot->hash = name->hash;
+    slot->constant = constant;
+
+    return constant;
 }
 
 // Comparing names of two identifiers
 static bool identifiersEqual(Token* a, Token* b)
 {
-    if (a->length != b->length) {
+    if (a->length != b->length || a->hash != b->hash) {
         return false;
     }
 
     return memcmp(a->start, b->start, a->length) == 0;
 }
 
+// Finds newest local with given name, -1 if there is none
+static int resolveLocalIndex(Compiler* compiler, Token* name)
+{
+    // Buckets list newer locals first because of Shadowing support for inner scope
+    int i = compiler->localBuckets[name->hash & (LOCAL_BUCKETS - 1)];
+
+    while (i != -1) {
+        if (identifiersEqual(name, &compiler->locals[i].name)) {
+            return i;
+        }
+        i = compiler->locals[i].nextInBucket;
+    }
+
+    return -1;
+}
+
 // Creates a new local and appends it to compiler's array of variable
 static void addLocal(Token name)
 {
     // VM support 1 byte of indexing 
     // Hence 256 local variables are supported
-    if (current->localCount == UINT8_COUNT) {
+    if (context->current->localCount == UINT8_COUNT) {
         error("Too many local variables in function.");
         return;
     }
 
-    Local* local = &current->locals[current->localCount++];
+    int index = context->current->localCount++;
+    Local* local = &context->current->locals[index];
     local->name = name;
 
+    int* bucket = &context->current->localBuckets[name.hash & (LOCAL_BUCKETS - 1)];
+    local->nextInBucket = *bucket;
+    *bucket = index;
+
     // Marking the variable uniniatilized but declared
     // Declarting is when its added to scope
     // Defining is when it becomes available for use
     local->depth = -1;
+    local->type = STATIC_UNKNOWN;
+    local->isConst = false;
 }
 
 static void declareVariable()
 {
-    if (current->scopeDepth == 0) {
+    if (context->current->scopeDepth == 0) {
         // Global variables are implicitly declared
         return;
     }
 
-    Token* name = &parser.previous;
+    Token* name = &context->parser.previous;
 
     // Lox allows shadowing of variables 
     // Detection of two variables having same name in same scope
-    for (int i = current->localCount - 1; i >= 0; i--) {
-        Local* local = &current->locals[i];
-
-        if (local->depth != -1 && local->depth < current->scopeDepth) {
-            break;
-        }
+    // Only the newest local with that name can be from current scope
+    int existing = resolveLocalIndex(context->current, name);
+    if (existing != -1) {
+        Local* local = &context->current->locals[existing];
 
-        if (identifiersEqual(name, &local->name)) {
+        if (local->depth == -1 || local->depth >= context->current->scopeDepth) {
             error("Already variable with this name in this scope.");
         }
     }
@@ -322,36 +552,67 @@ static void declareVariable()
     addLocal(*name);
 }
 
+// Finds value of global const with given name
+static bool resolveConst(Token* name, Value* value)
+{
+    if (context->consts.count == 0) {
+        return false;
+    }
+
+    ObjString* string = copyString(name->start, name->length);
+    return tableGet(&context->consts, string, value);
+}
+
+// Records global name compiled to a runtime read or assignment
+static void useGlobal(Token* name, bool assigned)
+{
+    ObjString* key = copyString(name->start, name->length);
+    Value wasAssigned;
+    if (tableGet(&context->globalUses, key, &wasAssigned) && (AS_BOOL(wasAssigned) || !assigned)) {
+        return;
+    }
+
+    // Table may grow before key is in it
+    protectValue(OBJ_VAL(key));
+    tableSet(&context->globalUses, key, BOOL_VAL(assigned));
+    unprotectValue();
+}
+
 static uint8_t parseVariable(const char* errorMessage)
 {
     consume(TOKEN_IDENTIFIER, errorMessage);
 
     declareVariable();
-    if (current->scopeDepth > 0) {
+    if (context->current->scopeDepth > 0) {
         // Returning dummy index since at runtime
         // locals arent looked up by name
         return 0;
     }
 
-    return identifierConstant(&parser.previous);
+    Value value;
+    if (resolveConst(&context->parser.previous, &value)) {
+        error("Already a const with this name.");
+    }
+
+    return identifierConstant(&context->parser.previous);
 }
 
 // Changing depth of local variable to mark it initialized
 static void markInitialized()
 {
     // Bound to be globalVariable
-    if (current->scopeDepth == 0) {
+    if (context->current->scopeDepth == 0) {
         return;
     }
 
-    current->locals[current->localCount - 1].depth = current->scopeDepth;
+    context->current->locals[context->current->localCount - 1].depth = context->current->scopeDepth;
 }
 
 static void defineVariable(uint8_t global)
 {
     // If not global scope
     // No need to create variable at runtime
-    if (current->scopeDepth > 0) {
+    if (context->current->scopeDepth > 0) {
         // No code to create local variable at runtime
         markInitialized();
         return;
@@ -386,6 +647,9 @@ static void patchJump(int offset)
     // Storing Higher byte of offset in lower address
     currentChunk()->code[offset] = (jump >> 8) & 0xff;
     currentChunk()->code[offset + 1] = (jump) & 0xff;
+
+    // Code at the target can be reached without the chain before it
+    context->current->lastConcat = -1;
 }
 
 // Emitjump and patchJump combined to configure OP_LOOP instruction
@@ -403,460 +667,2691 @@ static void emitLoop(int loopStart)
     emitByte(offset & 0xff);
 }
 
-static void expression()
+// LOOP INVARIANT CODE MOTION
+
+// Most number of values hoisted out of a single loop
+#define LICM_MAX_HOISTED 8
+
+// Value on stack while simulating straight line code at start of a loop
+typedef struct {
+    int start;          // Offset of first instruction computing the value
+    int end;            // Offset just past the last one
+    bool invariant;     // Same value on every iteration
+    bool trivial;       // Constant or local read, nothing gained by hoisting
+} LoopValue;
+
+static uint16_t readJump(Chunk* chunk, int offset)
 {
-    parsePrecedence(PREC_ASSIGNMENT);
+    return (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
 }
 
-// Parsing number literal consisting of single token
-static void number(bool canAssign)
+// Target offset of jump or loop instruction at given offset
+static int jumpTarget(Chunk* chunk, int offset)
 {
-    double value = strtod(parser.previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+    if (chunk->code[offset] == OP_LOOP) {
+        return offset + 3 - readJump(chunk, offset);
+    }
+
+    return offset + 3 + readJump(chunk, offset);
 }
 
-// Parsing grouping expressions
-static void grouping(bool canAssign)
+static bool isJump(uint8_t instruction)
 {
-    // '(' is assumed to be consumed earlier before calling grouping()
-
-    // This takes care of generating bytecode for expression inside the parenthesis
-    expression();   
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+    return instruction == OP_JUMP ||
+           instruction == OP_JUMP_IF_FALSE ||
+           instruction == OP_JUMP_IF_TRUE ||
+           instruction == OP_LOOP;
 }
 
-static void unary(bool canAssign)
+// Checks if global with given name is assigned anywhere in [start, end)
+static bool globalWritten(Chunk* chunk, int start, int end, ObjString* name)
 {
-    TokenType operatorType = parser.previous.type;
+    for (int offset = start; offset < end; offset += 1 + operandCount(chunk->code[offset])) {
+        uint8_t instruction = chunk->code[offset];
 
-    // Since operand is evaluated first which pushes the value to stack
-    // Then its negation is done
-    // Compile the operand
-    parsePrecedence(PREC_UNARY);
+        if ((instruction == OP_SET_GLOBAL || instruction == OP_DEFINE_GLOBAL) &&
+            AS_STRING(chunk->constants.values[chunk->code[offset + 1]]) == name) {
+            return true;
+        }
+    }
 
-    // Emiting the operator instruction
-    switch (operatorType) {
-        case TOKEN_MINUS: emitByte(OP_NEGATE); break;
-        case TOKEN_BANG: emitByte(OP_NOT); break;
+    return false;
+}
+
+// Checks if instruction found in straight line code at top of a loop can raise a runtime error
+// Instructions ending in _NUMBER only get operands proven to be numbers
+static bool canFail(uint8_t instruction)
+{
+    switch (instruction) {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_NOT:
+        case OP_EQUAL:
+        case OP_NEGATE_NUMBER:
+        case OP_ADD_NUMBER:
+        case OP_SUBTRACT_NUMBER:
+        case OP_MULTIPLY_NUMBER:
+        case OP_DIVIDE_NUMBER:
+        case OP_GREATER_NUMBER:
+        case OP_LESS_NUMBER:
+            return false;
 
         default:
-            return;
+            return true;
     }
 }
 
-static void binary(bool canAssign)
+/*
+ Hoists invariant computations of loop which starts at loopStart and ends
+ at context->current end of chunk. depth is the stack depth at loop start.
+
+ Only straight line code at the top of the loop is considered, which is
+ the condition in most loops. It runs every time the loop is entered so
+ computing it once before the loop cannot raise errors that would not happen.
+ Reading an undefined global or operands of wrong type still raise errors,
+ so a piece is only hoisted if nothing left in the loop before it can fail.
+ Each hoisted value gets a new local slot right above locals live at loop
+ start, and the slot is popped after the loop exits.
+*/
+static void hoistLoopInvariants(int loopStart, int depth)
 {
-    // The value of left operand will end up on stack
-    // Get operator
-    TokenType operatorType = parser.previous.type;
+    if (!compilerOptions.hoistInvariants || context->parser.hadError) {
+        return;
+    }
 
-    // Compiling right operand which have higher precedence than current operator
-    ParseRule* rule = getRule(operatorType);
-    parsePrecedence((Precedence)(rule->precedence + 1));
+    Chunk* chunk = currentChunk();
+    int loopEnd = chunk->count;
 
-    // Emiting operator instruction that performs the binary operation
-    switch (operatorType) {
-        case TOKEN_PLUS: {
-            emitByte(OP_ADD);
-            break;
-        }
+    // Finding what loop body may change
+    bool hasCall = false;
+    bool writtenSlots[UINT8_COUNT];
+    memset(writtenSlots, 0, sizeof(writtenSlots));
+    int maxSlot = depth - 1;
 
-        case TOKEN_MINUS: {
-            emitByte(OP_SUBTRACT);
-            break;
+    for (int offset = loopStart; offset < loopEnd; offset += 1 + operandCount(chunk->code[offset])) {
+        uint8_t instruction = chunk->code[offset];
+
+        switch (instruction) {
+            case OP_CALL:
+                hasCall = true;
+                break;
+
+            case OP_SET_LOCAL:
+                writtenSlots[chunk->code[offset + 1]] = true;
+                // fallthrough
+            case OP_GET_LOCAL:
+                if (chunk->code[offset + 1] > maxSlot) {
+                    maxSlot = chunk->code[offset + 1];
+                }
+                break;
+
+            default:
+                break;
         }
+    }
 
-        case TOKEN_STAR: {
-            emitByte(OP_MULTIPLY);
-            break;
+    // Simulating straight line code at top of loop to find invariant values
+    LoopValue stack[UINT8_COUNT];
+    int top = 0;
+
+    int hoisted[LICM_MAX_HOISTED][2];
+    int hoistCount = 0;
+
+    #define HOIST(value) \
+        do { \
+            if ((value).invariant && !(value).trivial && hoistCount < LICM_MAX_HOISTED) { \
+                hoisted[hoistCount][0] = (value).start; \
+                hoisted[hoistCount][1] = (value).end; \
+                hoistCount++; \
+            } \
+        } while (false)
+
+    for (int offset = loopStart; offset < loopEnd && top < UINT8_COUNT;) {
+        uint8_t instruction = chunk->code[offset];
+        int next = offset + 1 + operandCount(instruction);
+        bool stop = false;
+
+        switch (instruction) {
+            case OP_CONSTANT: {
+                LoopValue value = { offset, next, true, true };
+                stack[top++] = value;
+                break;
+            }
+
+            case OP_GET_GLOBAL: {
+                ObjString* name = AS_STRING(chunk->constants.values[chunk->code[offset + 1]]);
+                LoopValue value = {
+                    offset, next,
+                    !hasCall && !globalWritten(chunk, loopStart, loopEnd, name),
+                    false
+                };
+                stack[top++] = value;
+                break;
+            }
+
+            case OP_GET_LOCAL: {
+                uint8_t slot = chunk->code[offset + 1];
+                LoopValue value = { offset, next, slot < depth && !writtenSlots[slot], true };
+                stack[top++] = value;
+                break;
+            }
+
+            case OP_NEGATE:
+            case OP_NEGATE_NUMBER:
+            case OP_NOT: {
+                if (top < 1) {
+                    stop = true;
+                    break;
+                }
+
+                stack[top - 1].end = next;
+                stack[top - 1].trivial = false;
+                break;
+            }
+
+            case OP_ADD:
+            case OP_ADD_GUARDED:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+            case OP_EQUAL:
+            case OP_GREATER:
+            case OP_LESS:
+            case OP_ADD_NUMBER:
+            case OP_SUBTRACT_NUMBER:
+            case OP_MULTIPLY_NUMBER:
+            case OP_DIVIDE_NUMBER:
+            case OP_GREATER_NUMBER:
+            case OP_LESS_NUMBER: {
+                if (top < 2) {
+                    stop = true;
+                    break;
+                }
+
+                LoopValue b = stack[--top];
+                LoopValue a = stack[--top];
+                LoopValue value = { a.start, next, a.invariant && b.invariant, false };
+
+                // Operands are largest invariant pieces if result is not invariant
+                if (!value.invariant) {
+                    HOIST(a);
+                    HOIST(b);
+                }
+
+                stack[top++] = value;
+                break;
+            }
+
+            default:
+                stop = true;
+                break;
         }
 
-        case TOKEN_SLASH: {
-            emitByte(OP_DIVIDE);
+        if (stop) {
             break;
         }
 
-        // a != b <==> !(a == b)
-        case TOKEN_BANG_EQUAL: {
-            emitBytes(OP_EQUAL, OP_NOT);
-            break;
+        offset = next;
+    }
+
+    for (int i = 0; i < top; i++) {
+        HOIST(stack[i]);
+    }
+
+    #undef HOIST
+
+    // Ordering hoisted pieces by offset
+    for (int i = 1; i < hoistCount; i++) {
+        for (int j = i; j > 0 && hoisted[j][0] < hoisted[j - 1][0]; j--) {
+            int start = hoisted[j][0], end = hoisted[j][1];
+            hoisted[j][0] = hoisted[j - 1][0];
+            hoisted[j][1] = hoisted[j - 1][1];
+            hoisted[j - 1][0] = start;
+            hoisted[j - 1][1] = end;
         }
+    }
 
-        case TOKEN_EQUAL_EQUAL: {
-            emitByte(OP_EQUAL);
+    // Pieces after an instruction that stays in loop and can fail are kept in place,
+    // since computing them first would report their error instead of its one
+    int kept = 0;
+    for (int offset = loopStart; kept < hoistCount;) {
+        if (offset == hoisted[kept][0]) {
+            offset = hoisted[kept][1];
+            kept++;
+        } else if (canFail(chunk->code[offset])) {
             break;
+        } else {
+            offset += 1 + operandCount(chunk->code[offset]);
         }
+    }
+    hoistCount = kept;
 
-        case TOKEN_GREATER: {
-            emitByte(OP_GREATER);
-            break;
+    if (hoistCount == 0 || maxSlot + hoistCount > UINT8_MAX) {
+        return;
+    }
+
+    int preheaderLength = 0;
+    for (int i = 0; i < hoistCount; i++) {
+        preheaderLength += hoisted[i][1] - hoisted[i][0];
+    }
+
+    // Mapping old offsets of loop to new ones
+    int length = loopEnd - loopStart;
+    int* newOffsets = ALLOCATE(int, length + 1);
+    int position = preheaderLength;
+    int piece = 0;
+
+    for (int offset = loopStart; offset < loopEnd;) {
+        if (piece < hoistCount && offset == hoisted[piece][0]) {
+            // Whole piece is replaced by a local read
+            for (int i = offset; i < hoisted[piece][1]; i++) {
+                newOffsets[i - loopStart] = position;
+            }
+            position += 2;
+            offset = hoisted[piece][1];
+            piece++;
+            continue;
         }
 
-        // a >= b <==> !(a < b)
-        case TOKEN_GREATER_EQUAL: {
-            emitBytes(OP_LESS, OP_NOT);
-            break;
+        int size = 1 + operandCount(chunk->code[offset]);
+        for (int i = 0; i < size; i++) {
+            newOffsets[offset - loopStart + i] = position + i;
+        }
+        position += size;
+        offset += size;
+    }
+    newOffsets[length] = position;
+
+    int newLength = position + hoistCount;
+    uint8_t* code = ALLOCATE(uint8_t, newLength);
+    int* lines = ALLOCATE(int, newLength);
+    bool valid = true;
+
+    // Pre-header computing hoisted values into new slots
+    position = 0;
+    for (int i = 0; i < hoistCount; i++) {
+        for (int offset = hoisted[i][0]; offset < hoisted[i][1]; offset++) {
+            code[position] = chunk->code[offset];
+            lines[position] = getLine(chunk, offset);
+            position++;
         }
+    }
 
-        case TOKEN_LESS: {
-            emitByte(OP_LESS);
-            break;
+    piece = 0;
+    for (int offset = loopStart; offset < loopEnd;) {
+        if (piece < hoistCount && offset == hoisted[piece][0]) {
+            code[position] = OP_GET_LOCAL;
+            code[position + 1] = (uint8_t)(depth + piece);
+            lines[position] = lines[position + 1] = getLine(chunk, offset);
+            position += 2;
+            offset = hoisted[piece][1];
+            piece++;
+            continue;
         }
 
-        // a <= b <==> !(a > b)
-        case TOKEN_LESS_EQUAL: {
-            emitBytes(OP_GREATER, OP_NOT);
-            break;
+        uint8_t instruction = chunk->code[offset];
+        int size = 1 + operandCount(instruction);
+        for (int i = 0; i < size; i++) {
+            code[position + i] = chunk->code[offset + i];
+            lines[position + i] = getLine(chunk, offset + i);
         }
 
-        default:
-            return;
-    }
+        if (instruction == OP_GET_LOCAL || instruction == OP_SET_LOCAL) {
+            // Locals declared inside loop sit above the hoisted slots now
+            if (code[position + 1] >= depth) {
+                code[position + 1] += hoistCount;
+            }
+        } else if (isJump(instruction)) {
+            int target = jumpTarget(chunk, offset);
+
+            // Back edge to loop start must skip the pre-header
+            int newTarget = target == loopStart
+                ? preheaderLength
+                : newOffsets[target - loopStart];
+
+            // Jumps into the middle of a hoisted piece cannot be relinked
+            if (target > loopStart && target < loopEnd &&
+                newOffsets[target - loopStart] == newOffsets[target - loopStart - 1]) {
+                valid = false;
+            }
 
-    /*
-     The VM will execute the left and right operand code 
-     and leave their values on the stack.
-    */
-}
+            int jump = instruction == OP_LOOP
+                ? position + 3 - newTarget
+                : newTarget - position - 3;
 
-static void literal(bool canAssign)
-{
-    switch (parser.previous.type) {
-        case TOKEN_FALSE: {
-            emitByte(OP_FALSE); 
-            break;
-        }
+            if (jump < 0 || jump > UINT16_MAX) {
+                valid = false;
+            }
 
-        case TOKEN_TRUE: {
-            emitByte(OP_TRUE);
-            break;
+            code[position + 1] = (jump >> 8) & 0xff;
+            code[position + 2] = jump & 0xff;
         }
 
-        case TOKEN_NIL: {
-            emitByte(OP_NIL);
-            break;
+        position += size;
+        offset += size;
+    }
+
+    // Dropping hoisted slots once loop exits
+    for (int i = 0; i < hoistCount; i++) {
+        code[position] = OP_POP;
+        lines[position] = getLine(chunk, loopEnd - 1);
+        position++;
+    }
+
+    if (valid) {
+        truncateChunk(chunk, loopStart);
+        for (int i = 0; i < newLength; i++) {
+            writeChunk(chunk, code[i], lines[i]);
         }
 
-        default:
-            break;
+        context->current->lastGlobalGet = -1;
+        context->current->lastConcat = -1;
     }
+
+    FREE_ARRAY(int, newOffsets, length + 1);
+    FREE_ARRAY(uint8_t, code, newLength);
+    FREE_ARRAY(int, lines, newLength);
 }
 
-static void string(bool canAssign)
+// LOOP UNROLLING
+
+// Largest unrolled part of a loop in bytes, not counting remainder loop
+#define UNROLL_MAX_BYTES 512
+
+// Offsets of parts of a for loop as it was compiled
+typedef struct {
+    int initStart;      // Declaration of loop variable, -1 if loop declares none
+    int slot;           // Local slot of loop variable
+    int conditionStart;
+    int conditionEnd;   // Offset of OP_JUMP_IF_FALSE leaving the loop, -1 if no condition
+    int incrementStart;
+    int incrementEnd;   // Offset of OP_LOOP back to condition, -1 if no increment
+    int bodyStart;
+    int bodyEnd;        // Offset of OP_LOOP back to increment
+} ForLoop;
+
+// Numbers that stay exact when small integers are added to them
+static bool isSmallInteger(Value value)
 {
-    // +1 and -2 trims the leading and trailing quotation marks
-    emitConstant(OBJ_VAL(copyString(
-        parser.previous.start + 1,
-        parser.previous.length - 2
-    )));
+    if (!IS_NUMBER(value)) {
+        return false;
+    }
+
+    double number = AS_NUMBER(value);
+    return number > -4503599627370496.0 && number < 4503599627370496.0 &&
+        number == (double)(long long)number;
 }
 
-// Compiles and keyword
-static void and_(bool canAssign)
+/*
+ Unrolls a counted loop which ends at end of current chunk, like
+    for (var i = 0; i < n; i = i + 1) body
+ where i starts and steps by integers, only the increment writes it,
+ and n does not change inside the loop.
+
+ Unrolled loop checks whether i is still in range factor - 1 steps ahead
+ and then runs body and increment factor times without checking again.
+ Original loop follows as remainder for iterations left over.
+*/
+static void unrollLoop(ForLoop* loop)
 {
-    // Since logical operators support short circuting
-    // Need to use jumps
-    int endJump = emitJump(OP_JUMP_IF_FALSE);
+    int factor = compilerOptions.unrollFactor;
+    if (factor < 2 || context->parser.hadError ||
+        loop->initStart == -1 || loop->conditionEnd == -1 || loop->incrementEnd == -1) {
+        return;
+    }
 
-    emitByte(OP_POP);
+    Chunk* chunk = currentChunk();
+    uint8_t* code = chunk->code;
+    int loopStart = loop->conditionStart;
+    int loopEnd = chunk->count;
+    int slot = loop->slot;
+
+    // var i = integer
+    if (loop->conditionStart - loop->initStart != 2 || code[loop->initStart] != OP_CONSTANT ||
+        !isSmallInteger(chunk->constants.values[code[loop->initStart + 1]])) {
+        return;
+    }
+
+    // i = i + step or i = i - step
+    int increment = loop->incrementStart;
+    uint8_t stepOp = code[increment + 4];
+    if (loop->incrementEnd - increment != 8 ||
+        code[increment] != OP_GET_LOCAL || code[increment + 1] != slot ||
+        code[increment + 2] != OP_CONSTANT ||
+        code[increment + 5] != OP_SET_LOCAL || code[increment + 6] != slot ||
+        code[increment + 7] != OP_POP) {
+        return;
+    }
+
+    Value step = chunk->constants.values[code[increment + 3]];
+    if (!isSmallInteger(step) || AS_NUMBER(step) == 0) {
+        return;
+    }
+
+    bool increasing;
+    switch (stepOp) {
+        case OP_ADD:
+        case OP_ADD_GUARDED:
+        case OP_ADD_NUMBER:
+            increasing = AS_NUMBER(step) > 0;
+            break;
+
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_NUMBER:
+            increasing = AS_NUMBER(step) < 0;
+            break;
+
+        default:
+            return;
+    }
+
+    // i < n, i <= n, i > n or i >= n, matching direction of the step
+    int condition = loop->conditionStart;
+    int conditionLength = loop->conditionEnd - condition;
+    if ((conditionLength != 5 && conditionLength != 6) ||
+        code[condition] != OP_GET_LOCAL || code[condition + 1] != slot) {
+        return;
+    }
+
+    uint8_t compare = code[condition + 4];
+    bool less = compare == OP_LESS || compare == OP_LESS_NUMBER;
+    if (!less && compare != OP_GREATER && compare != OP_GREATER_NUMBER) {
+        return;
+    }
+
+    bool negated = conditionLength == 6;
+    if (negated && code[condition + 5] != OP_NOT) {
+        return;
+    }
+
+    if ((less != negated) != increasing) {
+        return;
+    }
+
+    // Bound has to stay the same, which also rules out writes to i
+    bool hasCall = false;
+    for (int offset = loopStart; offset < loopEnd; offset += 1 + operandCount(code[offset])) {
+        if (code[offset] == OP_CALL) {
+            hasCall = true;
+        }
+
+        if (code[offset] == OP_SET_LOCAL && offset != increment + 5 &&
+            (code[offset + 1] == slot ||
+             (code[condition + 2] == OP_GET_LOCAL && code[offset + 1] == code[condition + 3]))) {
+            return;
+        }
+    }
+
+    switch (code[condition + 2]) {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+            break;
+
+        case OP_GET_GLOBAL: {
+            ObjString* name = AS_STRING(chunk->constants.values[code[condition + 3]]);
+            if (hasCall || globalWritten(chunk, loopStart, loopEnd, name)) {
+                return;
+            }
+            break;
+        }
+
+        default:
+            return;
+    }
+
+    int bodyLength = loop->bodyEnd - loop->bodyStart;
+    int unrolledLength = 5 + (conditionLength - 2) + 4 + factor * (bodyLength + 8) + 3;
+    if (unrolledLength > UNROLL_MAX_BYTES || chunk->constants.count == UINT8_COUNT) {
+        return;
+    }
+
+    // Value of i factor - 1 steps ahead
+    uint8_t reach = makeConstant(NUMBER_VAL(AS_NUMBER(step) * (factor - 1)));
+
+    int length = unrolledLength + 1 + (loopEnd - loopStart);
+    uint8_t* unrolled = ALLOCATE(uint8_t, length);
+    int* lines = ALLOCATE(int, length);
+    int position = 0;
+    int conditionLine = getLine(chunk, condition);
+
+    #define UNROLL_EMIT(byte, line) \
+        do { \
+            unrolled[position] = (byte); \
+            lines[position] = (line); \
+            position++; \
+        } while (false)
+
+    #define UNROLL_COPY(start, end) \
+        do { \
+            for (int i = (start); i < (end); i++) { \
+                UNROLL_EMIT(code[i], getLine(chunk, i)); \
+            } \
+        } while (false)
+
+    UNROLL_EMIT(OP_GET_LOCAL, conditionLine);
+    UNROLL_EMIT(slot, conditionLine);
+    UNROLL_EMIT(OP_CONSTANT, conditionLine);
+    UNROLL_EMIT(reach, conditionLine);
+    UNROLL_EMIT(stepOp, conditionLine);
+    UNROLL_COPY(condition + 2, loop->conditionEnd);
+
+    // Leaving for remainder loop, which pops the condition
+    int exitJump = unrolledLength - position - 3;
+    UNROLL_EMIT(OP_JUMP_IF_FALSE, conditionLine);
+    UNROLL_EMIT((exitJump >> 8) & 0xff, conditionLine);
+    UNROLL_EMIT(exitJump & 0xff, conditionLine);
+    UNROLL_EMIT(OP_POP, conditionLine);
+
+    for (int i = 0; i < factor; i++) {
+        UNROLL_COPY(loop->bodyStart, loop->bodyEnd);
+        UNROLL_COPY(increment, loop->incrementEnd);
+    }
+
+    int backJump = position + 3;
+    UNROLL_EMIT(OP_LOOP, getLine(chunk, loop->bodyEnd));
+    UNROLL_EMIT((backJump >> 8) & 0xff, getLine(chunk, loop->bodyEnd));
+    UNROLL_EMIT(backJump & 0xff, getLine(chunk, loop->bodyEnd));
+
+    UNROLL_EMIT(OP_POP, conditionLine);
+    UNROLL_COPY(loopStart, loopEnd);
+
+    #undef UNROLL_EMIT
+    #undef UNROLL_COPY
+
+    truncateChunk(chunk, loopStart);
+    for (int i = 0; i < length; i++) {
+        writeChunk(chunk, unrolled[i], lines[i]);
+    }
+
+    context->current->lastGlobalGet = -1;
+    context->current->lastConcat = -1;
+
+    FREE_ARRAY(uint8_t, unrolled, length);
+    FREE_ARRAY(int, lines, length);
+}
+
+// TYPE INFERENCE
+
+// Types of all locals at some point of compilation
+typedef struct {
+    StaticType types[UINT8_COUNT];
+    int count;
+} TypeSnapshot;
+
+// State at top of a loop, to compile it again when
+// types assumed at the top turn out to be wrong
+typedef struct {
+    Scanner scanner;
+    Parser parser;
+    int codeCount;
+    int constantCount;
+    int stackDepth;
+
+    // Profile sites of loop get the same numbers each time it is compiled
+    int siteLine;
+    int siteIndex;
+    int typeSiteLine;
+    int typeSiteIndex;
+
+    // Types assumed at loop head
+    TypeSnapshot types;
+
+    // Locals treated as unknown when entering increment clause of for loop
+    bool widenAtIncrement[UINT8_COUNT];
+} LoopCheckpoint;
+
+static StaticType valueType(Value value)
+{
+    if (IS_NUMBER(value)) return STATIC_NUMBER;
+    if (IS_BOOL(value)) return STATIC_BOOL;
+    if (IS_NIL(value)) return STATIC_NIL;
+    if (IS_STRING(value)) return STATIC_STRING;
+    return STATIC_UNKNOWN;
+}
+
+static bool provenNumbers(StaticType a, StaticType b)
+{
+    return compilerOptions.inferTypes && a == STATIC_NUMBER && b == STATIC_NUMBER;
+}
+
+static void saveTypes(TypeSnapshot* snapshot)
+{
+    snapshot->count = context->current->localCount;
+    for (int i = 0; i < context->current->localCount; i++) {
+        snapshot->types[i] = context->current->locals[i].type;
+    }
+}
+
+static void restoreTypes(TypeSnapshot* snapshot)
+{
+    for (int i = 0; i < snapshot->count && i < context->current->localCount; i++) {
+        context->current->locals[i].type = snapshot->types[i];
+    }
+}
+
+// Joining types of another path that reaches the current point
+static void mergeTypes(TypeSnapshot* other)
+{
+    for (int i = 0; i < other->count && i < context->current->localCount; i++) {
+        if (context->current->locals[i].type != other->types[i]) {
+            context->current->locals[i].type = STATIC_UNKNOWN;
+        }
+    }
+}
+
+// Widens assumed types that current types do not agree with
+// Returns true if any assumption was wrong
+static bool widenTypes(TypeSnapshot* assumed)
+{
+    bool widened = false;
+
+    for (int i = 0; i < assumed->count && i < context->current->localCount; i++) {
+        if (assumed->types[i] != STATIC_UNKNOWN &&
+            assumed->types[i] != context->current->locals[i].type) {
+            assumed->types[i] = STATIC_UNKNOWN;
+            widened = true;
+        }
+    }
+
+    return widened;
+}
+
+static void saveCheckpoint(LoopCheckpoint* checkpoint)
+{
+    checkpoint->scanner = context->scanner;
+    checkpoint->parser = context->parser;
+    checkpoint->codeCount = currentChunk()->count;
+    checkpoint->constantCount = currentChunk()->constants.count;
+    checkpoint->stackDepth = context->current->stackDepth;
+    checkpoint->siteLine = context->siteLine;
+    checkpoint->siteIndex = context->siteIndex;
+    checkpoint->typeSiteLine = context->typeSiteLine;
+    checkpoint->typeSiteIndex = context->typeSiteIndex;
+    saveTypes(&checkpoint->types);
+    memset(checkpoint->widenAtIncrement, 0, sizeof(checkpoint->widenAtIncrement));
+}
+
+// Throws away code emitted since checkpoint to compile the loop again
+static void restoreCheckpoint(LoopCheckpoint* checkpoint)
+{
+    context->scanner = checkpoint->scanner;
+    context->parser = checkpoint->parser;
+    truncateChunk(currentChunk(), checkpoint->codeCount);
+    currentChunk()->constants.count = checkpoint->constantCount;
+    context->current->stackDepth = checkpoint->stackDepth;
+    context->siteLine = checkpoint->siteLine;
+    context->siteIndex = checkpoint->siteIndex;
+    context->typeSiteLine = checkpoint->typeSiteLine;
+    context->typeSiteIndex = checkpoint->typeSiteIndex;
+    context->current->pendingOperands = 0;
+    context->current->lastGlobalGet = -1;
+    context->current->lastConcat = -1;
+    restoreTypes(&checkpoint->types);
+}
+
+static void expression()
+{
+    parsePrecedence(PREC_ASSIGNMENT);
+}
+
+// Parsing number literal consisting of single token
+static void number(bool canAssign)
+{
+    double value = strtod(context->parser.previous.start, NULL);
+    emitConstant(NUMBER_VAL(value));
+    context->current->exprType = STATIC_NUMBER;
+}
+
+// Parsing grouping expressions
+static void grouping(bool canAssign)
+{
+    // '(' is assumed to be consumed earlier before calling grouping()
+
+    // This takes care of generating bytecode for expression inside the parenthesis
+    expression();   
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+}
+
+static void unary(bool canAssign)
+{
+    TokenType operatorType = context->parser.previous.type;
+
+    // Since operand is evaluated first which pushes the value to stack
+    // Then its negation is done
+    // Compile the operand
+    parsePrecedence(PREC_UNARY);
+
+    bool number = provenNumbers(context->current->exprType, STATIC_NUMBER);
+
+    // Emiting the operator instruction
+    switch (operatorType) {
+        case TOKEN_MINUS: {
+            emitByte(number ? OP_NEGATE_NUMBER : OP_NEGATE);
+            context->current->exprType = STATIC_NUMBER;
+            break;
+        }
+
+        case TOKEN_BANG: {
+            emitByte(OP_NOT);
+            context->current->exprType = STATIC_BOOL;
+            break;
+        }
+
+        default:
+            return;
+    }
+}
+
+// TYPE FEEDBACK
+
+// Numbers sites of a line in the order they are compiled, 0 if site can't be profiled
+static uint32_t nextSite(int* siteLine, int* siteIndex, int line)
+{
+    if (line == *siteLine) {
+        (*siteIndex)++;
+    } else {
+        *siteLine = line;
+        *siteIndex = 0;
+    }
+
+    if (line > UINT16_MAX || *siteIndex > UINT8_MAX) {
+        return 0;
+    }
+
+    return PROFILE_SITE(line, *siteIndex);
+}
+
+// Identifies operator, call or function whose first token was just consumed
+static uint32_t nextTypeSite()
+{
+    return nextSite(&context->typeSiteLine, &context->typeSiteIndex, context->parser.previous.line);
+}
+
+// Records kinds of values from depth down to top of stack when profiling types
+static void emitTypeProfile(uint32_t site, int depth)
+{
+    if (!compilerOptions.profileTypes || site == 0) {
+        return;
+    }
+
+    emitByte(OP_PROFILE_TYPES);
+    emitBytes((site >> 16) & 0xff, (site >> 8) & 0xff);
+    emitBytes(site & 0xff, (uint8_t)depth);
+}
+
+// Kinds of values seen at site in an earlier run, NULL if never reached
+static TypeSite* typeFeedback(uint32_t site)
+{
+    if (compilerOptions.typeProfile == NULL || site == 0) {
+        return NULL;
+    }
+
+    return findTypeProfileEntry(compilerOptions.typeProfile, site);
+}
+
+static bool onlyNumbers(TypeSite* feedback, int operand)
+{
+    return feedback != NULL && feedback->seen[operand] == SEEN_NUMBER;
+}
+
+// Number of values added by instruction ending a + chain
+static int chainOperands(Chunk* chunk, int offset)
+{
+    return chunk->code[offset] == OP_ADD ? 2 : chunk->code[offset + 1];
+}
+
+// Drops instruction ending last + chain when nothing was emitted after it
+// Returns how many values it added, 0 if there is no such chain
+static int takeChain()
+{
+    Chunk* chunk = currentChunk();
+    int chain = context->current->lastConcat;
+
+    if (chain == -1 || chain + 1 + operandCount(chunk->code[chain]) != chunk->count) {
+        return 0;
+    }
+
+    int operands = chainOperands(chunk, chain);
+    context->current->stackDepth -= stackEffect(chunk->code[chain], operands);
+    truncateChunk(chunk, chain);
+    context->current->lastConcat = -1;
+
+    return operands;
+}
+
+/*
+ In a + b + c every partial sum is a string that is interned and
+ becomes garbage right after. Instead operands of a chain are all
+ pushed and added by one OP_CONCAT that joins strings in a scratch
+ buffer and only interns the final string.
+ An operand is only moved after the additions before it when it cannot
+ fail or have side effects, so errors still happen in the same order.
+*/
+static void emitAdd(int leftEnd)
+{
+    Chunk* chunk = currentChunk();
+    int chain = context->current->lastConcat;
+    uint8_t instruction = chunk->code[leftEnd];
+
+    // Reading a global fails if it is not defined, so it ends the chain
+    bool pure = chunk->count - leftEnd == 2 &&
+        (instruction == OP_CONSTANT || instruction == OP_GET_LOCAL);
+    bool chained = compilerOptions.concatChains && pure && chain != -1 &&
+        chain + 1 + operandCount(chunk->code[chain]) == leftEnd &&
+        chainOperands(chunk, chain) < UINT8_MAX;
+
+    if (!chained) {
+        emitByte(OP_ADD);
+        context->current->lastConcat = chunk->count - 1;
+        return;
+    }
+
+    uint8_t operand = chunk->code[leftEnd + 1];
+    int line = getLine(chunk, leftEnd);
+
+    // Right operand moves in front of the chain's instruction
+    context->current->stackDepth--;
+    truncateChunk(chunk, leftEnd);
+    int operands = takeChain();
+
+    writeChunk(chunk, instruction, line);
+    trackStack(instruction);
+    writeChunk(chunk, operand, line);
+    trackStack(operand);
+
+    emitBytes(OP_CONCAT, (uint8_t)(operands + 1));
+    context->current->lastConcat = chunk->count - 2;
+
+    // Code was moved, so a global read recorded before may now seem to end it
+    context->current->lastGlobalGet = -1;
+}
+
+static void binary(bool canAssign)
+{
+    // The value of left operand will end up on stack
+    // Get operator
+    TokenType operatorType = context->parser.previous.type;
+    StaticType leftType = context->current->exprType;
+    int leftEnd = currentChunk()->count;
+    uint32_t site = nextTypeSite();
+
+    // Compiling right operand which have higher precedence than current operator
+    ParseRule* rule = getRule(operatorType);
+    parsePrecedence((Precedence)(rule->precedence + 1));
+
+    StaticType rightType = context->current->exprType;
+    bool numbers = provenNumbers(leftType, rightType);
+
+    if (!numbers) {
+        emitTypeProfile(site, 1);
+    }
+    TypeSite* feedback = typeFeedback(site);
+
+    // Arithmetic either fails at runtime or produces a number
+    // Rest of operators produce booleans
+    context->current->exprType = STATIC_BOOL;
+
+    // Emiting operator instruction that performs the binary operation
+    switch (operatorType) {
+        case TOKEN_PLUS: {
+            if (numbers) {
+                emitByte(OP_ADD_NUMBER);
+            } else if (onlyNumbers(feedback, 0) && onlyNumbers(feedback, 1)) {
+                emitByte(OP_ADD_GUARDED);
+            } else {
+                emitAdd(leftEnd);
+            }
+
+            if (leftType == rightType &&
+                (leftType == STATIC_NUMBER || leftType == STATIC_STRING)) {
+                context->current->exprType = leftType;
+            } else {
+                context->current->exprType = STATIC_UNKNOWN;
+            }
+            break;
+        }
+
+        case TOKEN_MINUS: {
+            emitByte(numbers ? OP_SUBTRACT_NUMBER : OP_SUBTRACT);
+            context->current->exprType = STATIC_NUMBER;
+            break;
+        }
+
+        case TOKEN_STAR: {
+            emitByte(numbers ? OP_MULTIPLY_NUMBER : OP_MULTIPLY);
+            context->current->exprType = STATIC_NUMBER;
+            break;
+        }
+
+        case TOKEN_SLASH: {
+            emitByte(numbers ? OP_DIVIDE_NUMBER : OP_DIVIDE);
+            context->current->exprType = STATIC_NUMBER;
+            break;
+        }
+
+        // a != b <==> !(a == b)
+        case TOKEN_BANG_EQUAL: {
+            emitBytes(OP_EQUAL, OP_NOT);
+            break;
+        }
+
+        case TOKEN_EQUAL_EQUAL: {
+            emitByte(OP_EQUAL);
+            break;
+        }
+
+        case TOKEN_GREATER: {
+            emitByte(numbers ? OP_GREATER_NUMBER : OP_GREATER);
+            break;
+        }
+
+        // a >= b <==> !(a < b)
+        case TOKEN_GREATER_EQUAL: {
+            emitBytes(numbers ? OP_LESS_NUMBER : OP_LESS, OP_NOT);
+            break;
+        }
+
+        case TOKEN_LESS: {
+            emitByte(numbers ? OP_LESS_NUMBER : OP_LESS);
+            break;
+        }
+
+        // a <= b <==> !(a > b)
+        case TOKEN_LESS_EQUAL: {
+            emitBytes(numbers ? OP_GREATER_NUMBER : OP_GREATER, OP_NOT);
+            break;
+        }
+
+        default:
+            return;
+    }
+
+    /*
+     The VM will execute the left and right operand code 
+     and leave their values on the stack.
+    */
+}
+
+static void literal(bool canAssign)
+{
+    switch (context->parser.previous.type) {
+        case TOKEN_FALSE: {
+            emitByte(OP_FALSE); 
+            context->current->exprType = STATIC_BOOL;
+            break;
+        }
+
+        case TOKEN_TRUE: {
+            emitByte(OP_TRUE);
+            context->current->exprType = STATIC_BOOL;
+            break;
+        }
+
+        case TOKEN_NIL: {
+            emitByte(OP_NIL);
+            context->current->exprType = STATIC_NIL;
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+static void string(bool canAssign)
+{
+    // +1 and -2 trims the leading and trailing quotation marks
+    emitConstant(OBJ_VAL(copyString(
+        context->parser.previous.start + 1,
+        context->parser.previous.length - 2
+    )));
+    context->current->exprType = STATIC_STRING;
+}
+
+// Compiles and keyword
+static void and_(bool canAssign)
+{
+    // Since logical operators support short circuting
+    // Need to use jumps
+    StaticType leftType = context->current->exprType;
+    TypeSnapshot skipped;
+    saveTypes(&skipped);
+
+    int endJump = emitJump(OP_JUMP_IF_FALSE);
+
+    emitByte(OP_POP);
     parsePrecedence(PREC_AND);
 
-    patchJump(endJump);
+    patchJump(endJump);
+
+    // Right operand may or may not have run
+    mergeTypes(&skipped);
+    if (context->current->exprType != leftType) {
+        context->current->exprType = STATIC_UNKNOWN;
+    }
+}
+
+// Compiles or keyword
+static void or_(bool canAssign)
+{
+    // Also supports short circuiting
+    StaticType leftType = context->current->exprType;
+    TypeSnapshot skipped;
+    saveTypes(&skipped);
+
+    int elseJump = emitJump(OP_JUMP_IF_FALSE);
+    int endJump = emitJump(OP_JUMP);
+
+    patchJump(elseJump);
+    emitByte(OP_POP);
+
+    parsePrecedence(PREC_OR);
+    patchJump(endJump);
+
+    mergeTypes(&skipped);
+    if (context->current->exprType != leftType) {
+        context->current->exprType = STATIC_UNKNOWN;
+    }
+
+    // OR can be much more efficient than this
+}
+
+// Returns local variable index otherwise -1 for global
+static int resolveLocal(Compiler* compiler, Token* name)
+{
+    int i = resolveLocalIndex(compiler, name);
+
+    if (i != -1 && compiler->locals[i].depth == -1) {
+        error("Can't read local variable in its own initializer.");
+    }
+
+    return i;
+}
+
+// Compiling arguements list for function call
+// Offsets where code of first arguements starts are stored in argStarts,
+// followed by offset where code of last of them ends
+static uint8_t arguementList(int* argStarts)
+{
+    uint8_t argCount = 0;
+    if (!check(TOKEN_RIGHT_PAREN)) {
+        do {
+            if (argCount < CLONE_MAX_ARITY) {
+                argStarts[argCount] = currentChunk()->count;
+            }
+
+            expression();
+
+            if (argCount == 255) {
+                error("Can't have more than 255 arguements.");
+            }
+
+            argCount++;
+        } while (match(TOKEN_COMMA));
+    }
+
+    if (argCount <= CLONE_MAX_ARITY) {
+        argStarts[argCount] = currentChunk()->count;
+    }
+
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguements.");
+    return argCount;
+}
+
+static void namedVariable(Token name, bool canAssign)
+{
+    uint8_t getOp, setOp;
+    // Getting index of variable name in constant table
+    int arg = resolveLocal(context->current, &name);
+
+    Value constant;
+    bool isConst = false;
+    if (arg != -1 && context->current->locals[arg].isConst) {
+        constant = context->current->locals[arg].constant;
+        isConst = true;
+    } else if (arg == -1) {
+        isConst = resolveConst(&name, &constant);
+    }
+
+    // Clone assigning a constant parameter is given up on and compiled on as usual
+    if (isConst && arg != -1 && arg <= context->current->function->arity &&
+        context->current->clone != NULL && canAssign && check(TOKEN_EQUAL)) {
+        context->current->cloneFailed = true;
+        isConst = false;
+    }
+
+    if (isConst) {
+        if (canAssign && match(TOKEN_EQUAL)) {
+            error("Can't assign to const.");
+            return;
+        }
+
+        emitConstant(constant);
+        context->current->exprType = valueType(constant);
+        return;
+    }
+
+    if (arg != -1) {
+        getOp = OP_GET_LOCAL;
+        setOp = OP_SET_LOCAL;
+    } else {
+        arg = identifierConstant(&name);
+        getOp = OP_GET_GLOBAL;
+        setOp = OP_SET_GLOBAL;
+    }
+
+    // Checking if its variable assignment or lookup
+    bool assigned = canAssign && match(TOKEN_EQUAL);
+    if (getOp == OP_GET_GLOBAL) {
+        useGlobal(&name, assigned);
+    }
+
+    if (assigned) {
+        expression();
+        emitBytes(setOp, (uint8_t)arg);
+
+        // Assigned value is result of the expression too
+        if (setOp == OP_SET_LOCAL) {
+            context->current->locals[arg].type = context->current->exprType;
+        }
+    } else {
+        if (getOp == OP_GET_GLOBAL) {
+            context->current->lastGlobalGet = currentChunk()->count;
+        }
+        emitBytes(getOp, (uint8_t)arg);
+
+        // Globals can be changed from anywhere
+        context->current->exprType = getOp == OP_GET_LOCAL
+            ? context->current->locals[arg].type
+            : STATIC_UNKNOWN;
+    }
+}
+
+static void variable(bool canAssign) 
+{
+    namedVariable(context->parser.previous, canAssign);
+}
+
+// COMMON SUBEXPRESSIONS
+
+// Value on stack while simulating code of one statement
+typedef struct {
+    int start;          // Offset of first instruction computing the value in rewritten code
+    int end;            // Offset just past the last one
+    bool reusable;      // Running its code again now would give the same value
+} StatementValue;
+
+// Checks if code in [start, end) reads given local slot
+static bool readsLocal(uint8_t* code, int start, int end, int slot)
+{
+    for (int offset = start; offset < end; offset += 1 + operandCount(code[offset])) {
+        if (code[offset] == OP_GET_LOCAL && code[offset + 1] == slot) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Checks if code in [start, end) reads global with given name, or any global if name is NULL
+static bool readsGlobal(Chunk* chunk, uint8_t* code, int start, int end, ObjString* name)
+{
+    for (int offset = start; offset < end; offset += 1 + operandCount(code[offset])) {
+        if (code[offset] == OP_GET_GLOBAL &&
+            (name == NULL || AS_STRING(chunk->constants.values[code[offset + 1]]) == name)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ Replaces computations in code of a statement emitted from start which
+ give a value that is still on the stack by a read of its stack slot, like
+ second a + b in (a + b) * (a + b). depth is stack depth at start.
+
+ Values are compared by their code, which only works on constants, locals
+ and globals, so equal code gives equal values as long as none of them is
+ written in between. Calls may write any global. Code with jumps is left
+ as it is.
+*/
+static void eliminateCommonSubexpressions(int start, int depth)
+{
+    if (!compilerOptions.eliminateSubexpressions || context->parser.hadError) {
+        return;
+    }
+
+    Chunk* chunk = currentChunk();
+    int length = chunk->count - start;
+    uint8_t* code = ALLOCATE(uint8_t, length);
+    int* lines = ALLOCATE(int, length);
+
+    StatementValue stack[UINT8_COUNT];
+    int top = 0;
+    int position = 0;
+    bool changed = false;
+    bool valid = true;
+
+    for (int offset = start; offset < chunk->count && valid;) {
+        uint8_t instruction = chunk->code[offset];
+        int size = 1 + operandCount(instruction);
+        int operand = size > 1 ? chunk->code[offset + 1] : 0;
+
+        for (int i = 0; i < size; i++) {
+            code[position + i] = chunk->code[offset + i];
+            lines[position + i] = getLine(chunk, offset + i);
+        }
+
+        int valueStart = position;
+        position += size;
+        offset += size;
+
+        // Number of values instruction takes, -1 for those that push one without taking any
+        int taken;
+        bool pure = true;
+
+        switch (instruction) {
+            case OP_CONSTANT:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+            case OP_GET_GLOBAL:
+                taken = -1;
+                break;
+
+            // Other slots on the stack of this statement can change underneath
+            case OP_GET_LOCAL:
+                taken = -1;
+                pure = operand < depth;
+                break;
+
+            case OP_NEGATE:
+            case OP_NEGATE_NUMBER:
+            case OP_NOT:
+                taken = 1;
+                break;
+
+            case OP_ADD:
+            case OP_ADD_GUARDED:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+            case OP_EQUAL:
+            case OP_GREATER:
+            case OP_LESS:
+            case OP_ADD_NUMBER:
+            case OP_SUBTRACT_NUMBER:
+            case OP_MULTIPLY_NUMBER:
+            case OP_DIVIDE_NUMBER:
+            case OP_GREATER_NUMBER:
+            case OP_LESS_NUMBER:
+                taken = 2;
+                break;
+
+            case OP_CONCAT:
+                taken = operand;
+                break;
+
+            case OP_SET_LOCAL: {
+                taken = 1;
+                pure = false;
+
+                for (int i = 0; i < top; i++) {
+                    if (readsLocal(code, stack[i].start, stack[i].end, operand)) {
+                        stack[i].reusable = false;
+                    }
+                }
+
+                // Inlined calls write to slots of this statement
+                if (operand >= depth && operand - depth < top) {
+                    stack[operand - depth].reusable = false;
+                }
+                break;
+            }
+
+            case OP_SET_GLOBAL:
+            case OP_DEFINE_GLOBAL:
+            case OP_CALL: {
+                ObjString* name = instruction == OP_CALL
+                    ? NULL
+                    : AS_STRING(chunk->constants.values[operand]);
+
+                for (int i = 0; i < top; i++) {
+                    if (readsGlobal(chunk, code, stack[i].start, stack[i].end, name)) {
+                        stack[i].reusable = false;
+                    }
+                }
+
+                taken = instruction == OP_CALL ? operand + 1 : 1;
+                pure = false;
+
+                // Defining consumes value without leaving one
+                if (instruction == OP_DEFINE_GLOBAL) {
+                    top--;
+                    valid = top >= 0;
+                    continue;
+                }
+                break;
+            }
+
+            case OP_PROFILE_TYPES:
+                continue;
+
+            case OP_POP:
+            case OP_PRINT:
+            case OP_PRINT_CONCAT:
+                top -= instruction == OP_PRINT_CONCAT ? operand : 1;
+                valid = top >= 0;
+                continue;
+
+            case OP_RETURN:
+                continue;
+
+            default:
+                valid = false;
+                continue;
+        }
+
+        StatementValue value = { valueStart, position, pure };
+        if (taken > 0) {
+            if (top < taken) {
+                valid = false;
+                break;
+            }
+
+            top -= taken;
+            value.start = stack[top].start;
+            for (int i = 0; i < taken; i++) {
+                value.reusable = value.reusable && stack[top + i].reusable;
+            }
+        }
+
+        if (top == UINT8_COUNT || depth + top > UINT8_MAX) {
+            valid = false;
+            break;
+        }
+
+        // Single reads of constants and locals cost as much as reading a slot
+        int valueLength = value.end - value.start;
+        bool trivial = valueLength <= 2 && code[value.start] != OP_GET_GLOBAL;
+
+        for (int i = 0; i < top && value.reusable && !trivial; i++) {
+            if (stack[i].reusable && stack[i].end - stack[i].start == valueLength &&
+                memcmp(&code[stack[i].start], &code[value.start], valueLength) == 0) {
+                position = value.start;
+                code[position] = OP_GET_LOCAL;
+                code[position + 1] = (uint8_t)(depth + i);
+                lines[position + 1] = lines[position];
+                position += 2;
+
+                // Slot read is not code that could be matched again later
+                value.end = position;
+                value.reusable = false;
+                changed = true;
+                break;
+            }
+        }
+
+        stack[top++] = value;
+    }
+
+    if (valid && changed) {
+        truncateChunk(chunk, start);
+        for (int i = 0; i < position; i++) {
+            writeChunk(chunk, code[i], lines[i]);
+        }
+
+        context->current->lastGlobalGet = -1;
+        context->current->lastConcat = -1;
+    }
+
+    FREE_ARRAY(uint8_t, code, length);
+    FREE_ARRAY(int, lines, length);
+}
+
+static void printStatement()
+{
+    int start = currentChunk()->count;
+    int depth = context->current->stackDepth;
+
+    // Print statement first evaluates the expression then prints it
+    expression();
+
+    // Expects a semicolon in the end of statement
+    consume(TOKEN_SEMICOLON, "Expect ';' after value.");
+
+    // Joined string of a + chain is printed from scratch buffer of VM
+    int operands = compilerOptions.concatChains ? takeChain() : 0;
+    if (operands > 0) {
+        emitBytes(OP_PRINT_CONCAT, (uint8_t)operands);
+    } else {
+        emitByte(OP_PRINT);
+    }
+
+    eliminateCommonSubexpressions(start, depth);
 }
 
-// Compiles or keyword
-static void or_(bool canAssign)
+static void expressionStatement()
 {
-    // Also supports short circuiting
-    int elseJump = emitJump(OP_JUMP_IF_FALSE);
-    int endJump = emitJump(OP_JUMP);
+    int start = currentChunk()->count;
+    int depth = context->current->stackDepth;
 
-    patchJump(elseJump);
+    expression();
+    consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
+
+    // An expression evalutates the expression and discard the result
+    // Hence POP operation is used to remove top element of Stack
+    emitByte(OP_POP);
+
+    eliminateCommonSubexpressions(start, depth);
+}
+
+static void block()
+{
+    // Keeps parsing declarations and statements until it hits the closing brace
+    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+        declaration();
+    }
+
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+}
+
+
+// BRANCH LAYOUT
+
+// Identifies if statement whose keyword was just consumed
+static uint32_t nextBranchSite()
+{
+    return nextSite(&context->siteLine, &context->siteIndex, context->parser.previous.line);
+}
+
+static bool mostlyFalse(uint32_t site)
+{
+    if (compilerOptions.branchProfile == NULL || site == 0) {
+        return false;
+    }
+
+    BranchCount* count = findProfileEntry(compilerOptions.branchProfile, site);
+    return count != NULL && count->falseCount > count->trueCount;
+}
+
+// Moves else branch of an if statement in front of then branch
+// thenJump and elseJump are operands of jumps emitted by ifStatement
+static void layOutElseFirst(int thenJump, int elseJump)
+{
+    Chunk* chunk = currentChunk();
+
+    int start = thenJump - 1;
+    int thenStart = thenJump + 2;
+    int thenLength = elseJump - 1 - thenStart;
+    int elseStart = elseJump + 2;
+    int elseLength = chunk->count - elseStart;
+
+    if (elseLength + 3 > UINT16_MAX) {
+        return;
+    }
+
+    int length = chunk->count - start;
+    uint8_t* code = ALLOCATE(uint8_t, length);
+    int* lines = ALLOCATE(int, length);
+
+    // True condition jumps over else branch and its jump to end
+    int jump = elseLength + 3;
+    code[0] = OP_JUMP_IF_TRUE;
+    code[1] = (jump >> 8) & 0xff;
+    code[2] = jump & 0xff;
+    lines[0] = lines[1] = lines[2] = getLine(chunk, start);
+
+    // Branches only jump within themselves, so they move as they are
+    for (int i = 0; i < elseLength; i++) {
+        code[3 + i] = chunk->code[elseStart + i];
+        lines[3 + i] = getLine(chunk, elseStart + i);
+    }
+
+    int position = 3 + elseLength;
+    code[position] = OP_JUMP;
+    code[position + 1] = (thenLength >> 8) & 0xff;
+    code[position + 2] = thenLength & 0xff;
+    lines[position] = lines[position + 1] = lines[position + 2] = getLine(chunk, elseJump - 1);
+    position += 3;
+
+    for (int i = 0; i < thenLength; i++) {
+        code[position + i] = chunk->code[thenStart + i];
+        lines[position + i] = getLine(chunk, thenStart + i);
+    }
+
+    truncateChunk(chunk, start);
+    for (int i = 0; i < length; i++) {
+        writeChunk(chunk, code[i], lines[i]);
+    }
+
+    context->current->lastGlobalGet = -1;
+    context->current->lastConcat = -1;
+
+    FREE_ARRAY(uint8_t, code, length);
+    FREE_ARRAY(int, lines, length);
+}
+
+// Compiles branch whose code is dropped if it can never run
+static void branch(bool live)
+{
+    int start = currentChunk()->count;
+    int returnDepth = context->current->returnDepth;
+    statement();
+
+    if (!live) {
+        truncateChunk(currentChunk(), start);
+        context->current->returnDepth = returnDepth;
+        context->current->lastGlobalGet = -1;
+        context->current->lastConcat = -1;
+    }
+}
+
+// If statement whose condition is known at compile time
+// Both branches are compiled but only the one taken is kept
+static void constantIf(Value condition)
+{
+    bool taken = !(IS_NIL(condition) || (IS_BOOL(condition) && !AS_BOOL(condition)));
+
+    TypeSnapshot conditionTypes;
+    saveTypes(&conditionTypes);
+
+    branch(taken);
+
+    TypeSnapshot thenTypes;
+    saveTypes(&thenTypes);
+    restoreTypes(&conditionTypes);
+
+    if (match(TOKEN_ELSE)) {
+        branch(!taken);
+    }
+
+    // Types after the if are the ones of the branch kept
+    if (taken) {
+        restoreTypes(&thenTypes);
+    }
+}
+
+static void ifStatement()
+{
+    uint32_t site = nextBranchSite();
+
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+    // Compiling condition of if statement
+    // Leaves the condition at top of stack
+    int conditionStart = currentChunk()->count;
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+    Value condition;
+    if (!context->parser.hadError && foldConstant(conditionStart, &condition)) {
+        truncateChunk(currentChunk(), conditionStart);
+        context->current->stackDepth--;
+        context->current->lastGlobalGet = -1;
+        context->current->lastConcat = -1;
+
+        constantIf(condition);
+        return;
+    }
+
+    if (compilerOptions.profileBranches && site != 0) {
+        emitByte(OP_PROFILE_BRANCH);
+        emitBytes((site >> 16) & 0xff, (site >> 8) & 0xff);
+        emitByte(site & 0xff);
+    }
+
+    TypeSnapshot conditionTypes;
+    saveTypes(&conditionTypes);
+
+    int thenJump = emitJump(OP_JUMP_IF_FALSE);
+    // Popping the condition evaluated by expression of If statement
+    emitByte(OP_POP);
+    statement();
+
+    // Else branch starts from types right after condition
+    TypeSnapshot thenTypes;
+    saveTypes(&thenTypes);
+    restoreTypes(&conditionTypes);
+
+    int elseJump = emitJump(OP_JUMP);
+
+    // Patching if branch offset
+    patchJump(thenJump);
+
+    // Condition is still on stack when jumping here
+    context->current->stackDepth++;
     emitByte(OP_POP);
 
-    parsePrecedence(PREC_OR);
-    patchJump(endJump);
+    // Handling Else Branch if found
+    bool hasElse = match(TOKEN_ELSE);
+    if (hasElse) {
+        statement();
+    }
+
+    // Patching Else branch offset
+    patchJump(elseJump);
+
+    mergeTypes(&thenTypes);
+
+    // Hot branch falls through when condition was mostly false
+    // Without else there is nothing to gain, one jump is taken either way
+    if (hasElse && mostlyFalse(site) && !context->parser.hadError) {
+        layOutElseFirst(thenJump, elseJump);
+    }
+}
+
+static void whileStatement()
+{
+    // How far to jump back after completing an iteration of loop
+    int loopStart = currentChunk()->count;
+    int loopDepth = context->current->stackDepth;
+
+    // Loop is compiled again if the body changes types assumed at the top
+    LoopCheckpoint checkpoint;
+    saveCheckpoint(&checkpoint);
+
+    for (;;) {
+        consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+        // Evaluating While loop expression
+        expression();
+        consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+        TypeSnapshot exitTypes;
+        saveTypes(&exitTypes);
+
+        int exitJump = emitJump(OP_JUMP_IF_FALSE);
+
+        emitByte(OP_POP);
+        // Compiling body of while loop
+        statement();
+
+        bool widened = widenTypes(&checkpoint.types);
+
+        emitLoop(loopStart);
+
+        patchJump(exitJump);
+        context->current->stackDepth++;
+        emitByte(OP_POP);
+
+        if (!widened || context->parser.hadError) {
+            restoreTypes(&exitTypes);
+            break;
+        }
+
+        restoreCheckpoint(&checkpoint);
+    }
+
+    hoistLoopInvariants(loopStart, loopDepth);
+}
+
+static void forStatement()
+{
+    // Since forloop has local scope
+    beginScope();
+
+    // Consuming Mandatory punctuations for the loop
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+
+    ForLoop loop;
+    loop.initStart = -1;
+
+    // Initializer Clause
+    if (match(TOKEN_SEMICOLON)) {
+        // No initializer
+    } else  if (match(TOKEN_VAR)) {
+        loop.initStart = currentChunk()->count;
+        varDeclaration();
+        loop.slot = context->current->localCount - 1;
+    } else {
+        expressionStatement();
+    }
+
+    // Offset at top of the body
+    int hoistStart = currentChunk()->count;
+    int loopDepth = context->current->stackDepth;
+
+    // Loop is compiled again if the body changes types assumed at the top
+    LoopCheckpoint checkpoint;
+    saveCheckpoint(&checkpoint);
+
+    for (;;) {
+        int loopStart = hoistStart;
+        bool widened = false;
+
+        loop.conditionStart = loopStart;
+        loop.conditionEnd = -1;
+        loop.incrementEnd = -1;
+
+        // Condition Clause
+        int exitJump = -1;
+        if (!match(TOKEN_SEMICOLON)) {
+            expression();
+            consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+
+            // Jump out of loop if condition is false
+            loop.conditionEnd = currentChunk()->count;
+            exitJump = emitJump(OP_JUMP_IF_FALSE);
+
+            // Popping out evaluated condition
+            emitByte(OP_POP);
+        }
+
+        TypeSnapshot exitTypes;
+        saveTypes(&exitTypes);
+
+        // Increment runs after the body, with the types body leaves behind
+        bool hasIncrement = false;
+        TypeSnapshot incrementTypes;
+
+        // Increment Clause
+        if (!match(TOKEN_RIGHT_PAREN)) {
+            hasIncrement = true;
+
+            int bodyJump = emitJump(OP_JUMP);
+            int incrementStart = currentChunk()->count;
+
+            for (int i = 0; i < context->current->localCount; i++) {
+                if (checkpoint.widenAtIncrement[i]) {
+                    context->current->locals[i].type = STATIC_UNKNOWN;
+                }
+            }
+            saveTypes(&incrementTypes);
+
+            expression();
+            emitByte(OP_POP);
+            consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+            widened = widenTypes(&checkpoint.types);
+
+            // Since the compiler is single pass
+            // We jump over the increment, run the body, jump back up to the increment
+            // run it then go to next iteration
+            loop.incrementStart = incrementStart;
+            loop.incrementEnd = currentChunk()->count;
+            emitLoop(loopStart);
+            loopStart = incrementStart;
+            patchJump(bodyJump);
+
+            restoreTypes(&exitTypes);
+        }
+
+        loop.bodyStart = currentChunk()->count;
+        statement();
+        loop.bodyEnd = currentChunk()->count;
+
+        if (hasIncrement) {
+            for (int i = 0; i < incrementTypes.count && i < context->current->localCount; i++) {
+                if (incrementTypes.types[i] != STATIC_UNKNOWN &&
+                    incrementTypes.types[i] != context->current->locals[i].type) {
+                    checkpoint.widenAtIncrement[i] = true;
+                    widened = true;
+                }
+            }
+        } else if (widenTypes(&checkpoint.types)) {
+            widened = true;
+        }
+
+        emitLoop(loopStart);
+
+        // Patching Jump instructiono
+        if (exitJump != -1) {
+            // Only done if there is condition clause
+            patchJump(exitJump);
+            context->current->stackDepth++;
+            emitByte(OP_POP);
+        }
+
+        if (!widened || context->parser.hadError) {
+            restoreTypes(&exitTypes);
+            break;
+        }
+
+        restoreCheckpoint(&checkpoint);
+    }
+
+    unrollLoop(&loop);
+    hoistLoopInvariants(hoistStart, loopDepth);
+
+    endScope();
+}
+
+static void returnStatement()
+{
+    if (context->current->type == TYPE_SCRIPT) {
+        error("Can't return from top-level code.");
+    }
+
+    if (match(TOKEN_SEMICOLON)) {
+        emitReturn();
+    } else {
+        int start = currentChunk()->count;
+        int depth = context->current->stackDepth;
+
+        // Calculating return expression 
+        // which will push the result on top of stack
+        expression();
+        consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+        emitByte(OP_RETURN);
+
+        eliminateCommonSubexpressions(start, depth);
+    }
+}
+
+static void statement()
+{
+    if (match(TOKEN_PRINT)) {
+        printStatement();
+    } else if (match(TOKEN_LEFT_BRACE)) {
+        beginScope();
+        block();
+        endScope();
+    } else if (match(TOKEN_IF)) {
+        ifStatement();
+    } else if (match(TOKEN_WHILE)) {
+        whileStatement();
+    } else if (match(TOKEN_FOR)) {
+        forStatement();
+    } else if (match(TOKEN_SWITCH)) {
+        switchStatement();
+    } else if (match(TOKEN_RETURN)) {
+        returnStatement();
+    } else {
+        expressionStatement();
+    }
+}
+
+static void varDeclaration()
+{
+    // Compiles the variable name
+    // Adds variable name to constants table of chunk
+    uint8_t global = parseVariable("Expect variable name.");
+    int start = currentChunk()->count;
+    int depth = context->current->stackDepth;
+
+    // Checking if there is r-value for the variable declaration
+    if (match(TOKEN_EQUAL)) {
+        expression();
+    } else {
+        // If no assignment then variable assigned to NIL
+        emitByte(OP_NIL);
+        context->current->exprType = STATIC_NIL;
+    }
+
+    if (context->current->scopeDepth > 0) {
+        context->current->locals[context->current->localCount - 1].type = context->current->exprType;
+    }
+
+    consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+
+    // Adding Byte code with OP code and Constants index
+    defineVariable(global);
 
-    // OR can be much more efficient than this
+    eliminateCommonSubexpressions(start, depth);
 }
 
-// Returns local variable index otherwise -1 for global
-static int resolveLocal(Compiler* compiler, Token* name)
+// Joins two strings like OP_ADD does at runtime
+// Result is protected, joinedCount counts values protected so far
+static Value joinStrings(ObjString* a, ObjString* b, int* joinedCount)
+{
+    int length = a->length + b->length;
+    char* chars = ALLOCATE(char, length + 1);
+    memcpy(chars, a->chars, a->length);
+    memcpy(chars + a->length, b->chars, b->length);
+    chars[length] = '\0';
+
+    Value joined = OBJ_VAL(takeString(chars, length));
+    protectValue(joined);
+    (*joinedCount)++;
+    return joined;
+}
+
+// Body of foldConstant(), strings it joins stay protected till it is done
+static bool evaluateConstant(int start, Value* result, int* joinedCount)
 {
-    // Loops from backward because of Shadowing support for inner scope
-    for (int i = compiler->localCount - 1; i >= 0; i--) {
-        Local* local = &compiler->locals[i];
+    Chunk* chunk = currentChunk();
+    Value stack[UINT8_COUNT];
+    int count = 0;
+
+    for (int offset = start; offset < chunk->count; offset += 1 + operandCount(chunk->code[offset])) {
+        uint8_t instruction = chunk->code[offset];
+
+        // Every instruction below pushes one value
+        if (count == UINT8_COUNT) {
+            return false;
+        }
 
-        if (identifiersEqual(name, &local->name)) {
-            if (local->depth == -1) {
-                error("Can't read local variable in its own initializer.");
+        switch (instruction) {
+            case OP_CONSTANT:
+                stack[count++] = chunk->constants.values[chunk->code[offset + 1]];
+                continue;
+            case OP_NIL: stack[count++] = NIL_VAL; continue;
+
+            // Recording types has no effect on the value
+            case OP_PROFILE_TYPES: continue;
+            case OP_TRUE: stack[count++] = BOOL_VAL(true); continue;
+            case OP_FALSE: stack[count++] = BOOL_VAL(false); continue;
+
+            case OP_NOT: {
+                Value value = stack[count - 1];
+                stack[count - 1] = BOOL_VAL(IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)));
+                continue;
             }
-            return i;
+
+            case OP_NEGATE:
+            case OP_NEGATE_NUMBER:
+                if (!IS_NUMBER(stack[count - 1])) {
+                    return false;
+                }
+                stack[count - 1] = NUMBER_VAL(-AS_NUMBER(stack[count - 1]));
+                continue;
+
+            case OP_EQUAL:
+                stack[count - 2] = BOOL_VAL(valuesEqual(stack[count - 2], stack[count - 1]));
+                count--;
+                continue;
+
+            case OP_CONCAT: {
+                int operands = chunk->code[offset + 1];
+                if (operands > count) {
+                    return false;
+                }
+
+                if (IS_STRING(stack[count - operands])) {
+                    Value joined = stack[count - operands];
+                    for (int i = count - operands + 1; i < count; i++) {
+                        if (!IS_STRING(stack[i])) {
+                            return false;
+                        }
+                        joined = joinStrings(AS_STRING(joined), AS_STRING(stack[i]), joinedCount);
+                    }
+
+                    count -= operands - 1;
+                    stack[count - 1] = joined;
+                    continue;
+                }
+
+                if (!IS_NUMBER(stack[count - operands])) {
+                    return false;
+                }
+
+                double sum = AS_NUMBER(stack[count - operands]);
+                for (int i = count - operands + 1; i < count; i++) {
+                    if (!IS_NUMBER(stack[i])) {
+                        return false;
+                    }
+                    // Same order as OP_ADD at runtime, which decides NaN that comes out
+                    sum = sum + AS_NUMBER(stack[i]);
+                }
+
+                count -= operands - 1;
+                stack[count - 1] = NUMBER_VAL(sum);
+                continue;
+            }
+
+            default:
+                break;
+        }
+
+        if (count >= 2 && (instruction == OP_ADD || instruction == OP_ADD_GUARDED) &&
+            IS_STRING(stack[count - 2]) && IS_STRING(stack[count - 1])) {
+            stack[count - 2] = joinStrings(AS_STRING(stack[count - 2]), AS_STRING(stack[count - 1]), joinedCount);
+            count--;
+            continue;
+        }
+
+        // Remaining foldable instructions are binary operations on numbers
+        if (count < 2 || !IS_NUMBER(stack[count - 2]) || !IS_NUMBER(stack[count - 1])) {
+            return false;
+        }
+
+        double a = AS_NUMBER(stack[count - 2]);
+        double b = AS_NUMBER(stack[count - 1]);
+        Value value;
+
+        switch (instruction) {
+            case OP_ADD: case OP_ADD_GUARDED: case OP_ADD_NUMBER: value = NUMBER_VAL(a + b); break;
+            case OP_SUBTRACT: case OP_SUBTRACT_NUMBER: value = NUMBER_VAL(a - b); break;
+            case OP_MULTIPLY: case OP_MULTIPLY_NUMBER: value = NUMBER_VAL(a * b); break;
+            case OP_DIVIDE: case OP_DIVIDE_NUMBER: value = NUMBER_VAL(a / b); break;
+            case OP_GREATER: case OP_GREATER_NUMBER: value = BOOL_VAL(a > b); break;
+            case OP_LESS: case OP_LESS_NUMBER: value = BOOL_VAL(a < b); break;
+            default: return false;
         }
+
+        stack[count - 2] = value;
+        count--;
     }
 
-    return -1;
+    if (count != 1) {
+        return false;
+    }
+
+    *result = stack[0];
+    return true;
 }
 
-// Compiling arguements list for function call
-static uint8_t arguementList()
+// Evaluates code emitted from start if it only works on literals
+// Returns false if the code needs anything known only at runtime
+// A joined string in result is no longer protected, caller keeps it alive
+static bool foldConstant(int start, Value* result)
 {
-    uint8_t argCount = 0;
-    if (!check(TOKEN_RIGHT_PAREN)) {
-        do {
-            expression();
+    int joinedCount = 0;
+    bool folded = evaluateConstant(start, result, &joinedCount);
 
-            if (argCount == 255) {
-                error("Can't have more than 255 arguements.");
-            }
+    for (int i = 0; i < joinedCount; i++) {
+        unprotectValue();
+    }
 
-            argCount++;
-        } while (match(TOKEN_COMMA));
+    return folded;
+}
+
+// Compiles an expression whose value has to be known at compile time
+// Its code is dropped and only the value is returned
+static Value constantExpression(const char* errorMessage)
+{
+    int start = currentChunk()->count;
+    int constantCount = currentChunk()->constants.count;
+    expression();
+
+    Value value = NIL_VAL;
+    if (!foldConstant(start, &value)) {
+        error(errorMessage);
     }
 
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguements.");
-    return argCount;
+    truncateChunk(currentChunk(), start);
+    currentChunk()->constants.count = constantCount;
+    context->current->stackDepth--;
+    context->current->lastGlobalGet = -1;
+    context->current->lastConcat = -1;
+
+    return value;
 }
 
-static void namedVariable(Token name, bool canAssign)
+static void constDeclaration()
 {
-    uint8_t getOp, setOp;
-    // Getting index of variable name in constant table
-    int arg = resolveLocal(current, &name);
+    uint8_t global = parseVariable("Expect const name.");
+    Token name = context->parser.previous;
+
+    // Code compiled before declaration reads or assigns name as a global
+    Value assigned = BOOL_VAL(false);
+    bool used = context->current->scopeDepth == 0 &&
+        tableGet(&context->globalUses, copyString(name.start, name.length), &assigned);
+    if (AS_BOOL(assigned)) {
+        error("Can't assign to const before its declaration.");
+    }
 
-    if (arg != -1) {
-        getOp = OP_GET_LOCAL;
-        setOp = OP_SET_LOCAL;
-    } else {
-        arg = identifierConstant(&name);
-        getOp = OP_GET_GLOBAL;
-        setOp = OP_SET_GLOBAL;
+    consume(TOKEN_EQUAL, "Expect '=' after const name.");
+    Value value = constantExpression("Const initializer must be a constant expression.");
+    consume(TOKEN_SEMICOLON, "Expect ';' after const declaration.");
+
+    if (context->current->scopeDepth > 0) {
+        // Slot still holds the value so that later slots stay in place
+        emitConstant(value);
+
+        Local* local = &context->current->locals[context->current->localCount - 1];
+        local->type = valueType(value);
+        local->isConst = true;
+        local->constant = value;
+
+        markInitialized();
+        return;
     }
 
-    // Checking if its variable assignment or lookup
-    if (canAssign && match(TOKEN_EQUAL)) {
-        expression();
-        emitBytes(setOp, (uint8_t)arg);
-    } else {
-        emitBytes(getOp, (uint8_t)arg);
+    // Value is no longer in constants of chunk while name is allocated
+    protectValue(value);
+    tableSet(&context->consts, copyString(name.start, name.length), value);
+    unprotectValue();
+
+    // Code compiled earlier or by later calls to compile() reads it as a global
+    if (used || compilerOptions.constGlobals || compilerOptions.lazyFunctions) {
+        emitConstant(value);
+        emitBytes(OP_DEFINE_GLOBAL, global);
     }
 }
 
-static void variable(bool canAssign) 
+// SWITCH
+
+// Dense number cases of a switch may span at most this many times their count
+#define SWITCH_MAX_SPREAD 2
+
+typedef struct {
+    Value value;
+    uint8_t constant;   // Index of value in constants of chunk
+    int bodyStart;
+} SwitchCase;
+
+// Checks if every case can be dispatched by an ObjSwitch
+// Strings always can, numbers only if they are close together integers
+static bool switchTableFits(SwitchCase* cases, int caseCount, int* low, int* high)
 {
-    namedVariable(parser.previous, canAssign);
+    int numberCount = 0;
+
+    for (int i = 0; i < caseCount; i++) {
+        Value value = cases[i].value;
+
+        if (IS_STRING(value)) {
+            continue;
+        }
+
+        if (!IS_NUMBER(value)) {
+            return false;
+        }
+
+        double number = AS_NUMBER(value);
+        if (number != (int)number || number < -INT16_MAX || number > INT16_MAX) {
+            return false;
+        }
+
+        if (numberCount == 0 || number < *low) *low = (int)number;
+        if (numberCount == 0 || number > *high) *high = (int)number;
+        numberCount++;
+    }
+
+    return numberCount == 0 || *high - *low + 1 <= numberCount * SWITCH_MAX_SPREAD;
 }
 
-static void printStatement()
+// Emits code choosing the case body to run
+// Case bodies are behind it, so every body is reached by a backward jump
+static void emitSwitchDispatch(int slot, SwitchCase* cases, int caseCount, int defaultStart)
 {
-    // Print statement first evaluates the expression then prints it
-    expression();
+    int low = 0, high = -1;
+
+    if (caseCount > 0 && switchTableFits(cases, caseCount, &low, &high)) {
+        // Distances are from end of OP_SWITCH back to body, 0 falls through
+        int end = currentChunk()->count + 2;
+        int defaultDistance = defaultStart == -1 ? 0 : end - defaultStart;
+
+        ObjSwitch* jumpTable = newSwitch();
+        emitBytes(OP_SWITCH, makeConstant(OBJ_VAL(jumpTable)));
+
+        jumpTable->defaultDistance = defaultDistance;
+        jumpTable->low = low;
+        jumpTable->count = high - low + 1;
+        jumpTable->distances = ALLOCATE(int, jumpTable->count);
+        for (int i = 0; i < jumpTable->count; i++) {
+            jumpTable->distances[i] = defaultDistance;
+        }
 
-    // Expects a semicolon in the end of statement
-    consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-    emitByte(OP_PRINT);
+        for (int i = 0; i < caseCount; i++) {
+            int distance = end - cases[i].bodyStart;
+
+            if (IS_STRING(cases[i].value)) {
+                tableSet(&jumpTable->strings, AS_STRING(cases[i].value), NUMBER_VAL((double)distance));
+            } else {
+                jumpTable->distances[(int)AS_NUMBER(cases[i].value) - low] = distance;
+            }
+        }
+        return;
+    }
+
+    // Comparing subject with every case in order
+    for (int i = 0; i < caseCount; i++) {
+        emitBytes(OP_GET_LOCAL, (uint8_t)slot);
+        emitBytes(OP_CONSTANT, cases[i].constant);
+        emitByte(OP_EQUAL);
+
+        int nextCase = emitJump(OP_JUMP_IF_FALSE);
+        emitByte(OP_POP);
+        emitLoop(cases[i].bodyStart);
+
+        patchJump(nextCase);
+
+        // Comparison result is still on stack when jumping here
+        context->current->stackDepth++;
+        emitByte(OP_POP);
+    }
+
+    if (defaultStart != -1) {
+        emitLoop(defaultStart);
+    }
 }
 
-static void expressionStatement()
+static void switchStatement()
 {
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'switch'.");
+
+    // Subject stays in a hidden local while dispatching
+    beginScope();
     expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
 
-    // An expression evalutates the expression and discard the result
-    // Hence POP operation is used to remove top element of Stack
-    emitByte(OP_POP);
-}
+    addLocal(syntheticToken(""));
+    context->current->locals[context->current->localCount - 1].type = context->current->exprType;
+    markInitialized();
+    int slot = context->current->localCount - 1;
+
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after value.");
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before switch cases.");
+
+    // Case bodies are compiled first, dispatch is emitted after them
+    int dispatchJump = emitJump(OP_JUMP);
+
+    SwitchCase cases[UINT8_COUNT];
+    int caseCount = 0;
+    int defaultStart = -1;
+    int exitJumps[UINT8_COUNT + 1];
+    int exitCount = 0;
+
+    // Every body starts from types of subject, end of switch joins all of them
+    TypeSnapshot entryTypes;
+    TypeSnapshot exitTypes;
+    saveTypes(&entryTypes);
 
-static void block()
-{
-    // Keeps parsing declarations and statements until it hits the closing brace
     while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
-        declaration();
+        if (match(TOKEN_CASE)) {
+            if (defaultStart != -1) {
+                error("Can't have case after default.");
+            }
+
+            Value value = constantExpression("Case value must be a constant expression.");
+
+            for (int i = 0; i < caseCount; i++) {
+                if (valuesEqual(cases[i].value, value)) {
+                    error("Duplicate case value.");
+                }
+            }
+
+            consume(TOKEN_COLON, "Expect ':' after case value.");
+
+            if (caseCount == UINT8_COUNT) {
+                error("Too many cases in switch.");
+                caseCount--;
+            }
+
+            cases[caseCount].value = value;
+            cases[caseCount].constant = makeConstant(value);
+            cases[caseCount].bodyStart = currentChunk()->count;
+            caseCount++;
+        } else if (match(TOKEN_DEFAULT)) {
+            if (defaultStart != -1) {
+                error("Can't have more than one default.");
+            }
+
+            consume(TOKEN_COLON, "Expect ':' after 'default'.");
+            defaultStart = currentChunk()->count;
+        } else {
+            errorAtCurrent("Expect 'case' or 'default' in switch.");
+            break;
+        }
+
+        restoreTypes(&entryTypes);
+
+        // Cases do not fall through to the next one
+        beginScope();
+        while (!check(TOKEN_CASE) && !check(TOKEN_DEFAULT) &&
+               !check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+            declaration();
+        }
+        endScope();
+
+        if (exitCount > 0) {
+            mergeTypes(&exitTypes);
+        }
+        saveTypes(&exitTypes);
+
+        if (exitCount <= UINT8_COUNT) {
+            exitJumps[exitCount++] = emitJump(OP_JUMP);
+        }
     }
 
-    consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after switch cases.");
+
+    patchJump(dispatchJump);
+    emitSwitchDispatch(slot, cases, caseCount, defaultStart);
+
+    for (int i = 0; i < exitCount; i++) {
+        patchJump(exitJumps[i]);
+    }
+
+    // Subject flows straight to the end when no case matches
+    if (exitCount > 0) {
+        restoreTypes(&exitTypes);
+        if (defaultStart == -1) {
+            mergeTypes(&entryTypes);
+        }
+    }
+
+    endScope();
 }
 
+// INLINING
 
-static void ifStatement()
+// Counts writes to global names by skimming through all tokens of source
+// Declarations at top level and assignments anywhere are counted
+// Shadowing locals are counted too, which only makes it conservative
+static void countGlobalWrites(const char* source)
 {
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
-    // Compiling condition of if statement
-    // Leaves the condition at top of stack
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+    Scanner scanner;
+    initScanner(&scanner, source);
 
-    int thenJump = emitJump(OP_JUMP_IF_FALSE);
-    // Popping the condition evaluated by expression of If statement
-    emitByte(OP_POP);
-    statement();
+    int braceDepth = 0;
+    Token previous;
+    previous.type = TOKEN_EOF;
 
-    int elseJump = emitJump(OP_JUMP);
+    for (;;) {
+        Token token = scanToken(&scanner);
+        if (token.type == TOKEN_EOF) {
+            break;
+        }
 
-    // Patching if branch offset
-    patchJump(thenJump);
-    emitByte(OP_POP);
+        Token* name = NULL;
+        switch (token.type) {
+            case TOKEN_LEFT_BRACE: braceDepth++; break;
+            case TOKEN_RIGHT_BRACE: braceDepth--; break;
 
-    // Handling Else Branch if found
-    if (match(TOKEN_ELSE)) {
-        statement();
-    }
+            case TOKEN_IDENTIFIER: {
+                if (braceDepth == 0 &&
+                    (previous.type == TOKEN_VAR || previous.type == TOKEN_FUN)) {
+                    name = &token;
+                }
+                break;
+            }
 
-    // Patching Else branch offset
-    patchJump(elseJump);
+            case TOKEN_EQUAL: {
+                if (previous.type == TOKEN_IDENTIFIER) {
+                    name = &previous;
+                }
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        if (name != NULL) {
+            ObjString* key = copyString(name->start, name->length);
+            Value count = NUMBER_VAL(0);
+            tableGet(&context->globalWrites, key, &count);
+
+            // Table may grow before key is in it
+            protectValue(OBJ_VAL(key));
+            tableSet(&context->globalWrites, key, NUMBER_VAL(AS_NUMBER(count) + 1));
+            unprotectValue();
+        }
+
+        previous = token;
+    }
 }
 
-static void whileStatement()
+// Records function just compiled if its body is small and straight enough
+// to be copied into call sites
+static void addInlineCandidate(Compiler* compiler)
 {
-    // How far to jump back after completing an iteration of loop
-    int loopStart = currentChunk()->count;
+    ObjFunction* function = compiler->function;
+    Chunk* chunk = &function->chunk;
 
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
-    // Evaluating While loop expression
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+    if (context->inlineCandidateCount == UINT8_COUNT) {
+        return;
+    }
 
-    int exitJump = emitJump(OP_JUMP_IF_FALSE);
+    // Name must never be rebound, else call sites could see other function
+    Value writes;
+    if (!tableGet(&context->globalWrites, function->name, &writes) || AS_NUMBER(writes) != 1) {
+        return;
+    }
 
-    emitByte(OP_POP);
-    // Compiling body of while loop
-    statement();
+    // Call sites get the generic copy of a specialized function
+    // since types of their arguements were not checked
+    int bodyOffset = 0;
+    if (chunk->code[0] == OP_GUARD_NUMBERS) {
+        bodyOffset = 4 + ((chunk->code[2] << 8) | chunk->code[3]);
+    }
 
-    emitLoop(loopStart);
+    // Body ends at first OP_RETURN, which has to be the only way out
+    int returnOffset = -1;
+    for (int offset = bodyOffset; offset < chunk->count;) {
+        uint8_t instruction = chunk->code[offset];
 
-    patchJump(exitJump);
-    emitByte(OP_POP);
+        if (instruction == OP_RETURN) {
+            returnOffset = offset;
+            break;
+        }
+
+        switch (instruction) {
+            case OP_LOOP:
+            case OP_SWITCH:
+            case OP_GUARD_NUMBERS:
+                return;
+
+            // Recursive functions are never inlined
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL: {
+                Value name = chunk->constants.values[chunk->code[offset + 1]];
+                if (AS_STRING(name) == function->name) {
+                    return;
+                }
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        offset += 1 + operandCount(instruction);
+    }
+
+    if (returnOffset == -1 || returnOffset - bodyOffset > compilerOptions.inlineBudget) {
+        return;
+    }
+
+    // Jumps may not skip over the return to reach the implicit one
+    for (int offset = bodyOffset; offset < returnOffset;) {
+        uint8_t instruction = chunk->code[offset];
+        if (instruction == OP_JUMP || instruction == OP_JUMP_IF_FALSE || instruction == OP_JUMP_IF_TRUE) {
+            uint16_t jump = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+            if (offset + 3 + jump > returnOffset) {
+                return;
+            }
+        }
+        offset += 1 + operandCount(instruction);
+    }
 
+    InlineCandidate* candidate = &context->inlineCandidates[context->inlineCandidateCount++];
+    candidate->name = function->name;
+    candidate->function = function;
+    candidate->bodyOffset = bodyOffset;
+    candidate->returnOffset = returnOffset;
+    candidate->returnDepth = compiler->returnDepth;
 }
 
-static void forStatement()
+static InlineCandidate* findInlineCandidate(ObjString* name)
 {
-    // Since forloop has local scope
-    beginScope();
+    for (int i = 0; i < context->inlineCandidateCount; i++) {
+        if (context->inlineCandidates[i].name == name) {
+            return &context->inlineCandidates[i];
+        }
+    }
 
-    // Consuming Mandatory punctuations for the loop
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    return NULL;
+}
 
-    // Initializer Clause
-    if (match(TOKEN_SEMICOLON)) {
-        // No initializer
-    } else  if (match(TOKEN_VAR)) {
-        varDeclaration();
-    } else {
-        expressionStatement();
+// Line to write code copied from line of body with, so that stack traces
+// show callee called at callLine, name is index of its name in current chunk
+static int inlinedLine(Chunk* body, int line, int name, int callLine)
+{
+    if (line >= 0) {
+        return addInlinedLine(currentChunk(), line, name, callLine);
     }
 
-    // Offset at top of the body
-    int loopStart = currentChunk()->count;
+    // Body had a call inlined itself, whose frame is kept above the one of body
+    InlinedLine inlined = body->inlined[-1 - line];
+    int calleeName = makeConstant(body->constants.values[inlined.name]);
+    int calleeCallLine = inlinedLine(body, inlined.callLine, name, callLine);
+    return addInlinedLine(currentChunk(), inlined.line, calleeName, calleeCallLine);
+}
+
+// Copies callee body in place of OP_CALL
+// base is slot of the callee with arguements right above it
+// which makes them the locals of the inlined body
+static bool inlineCall(InlineCandidate* candidate, int base)
+{
+    Chunk* body = &candidate->function->chunk;
+
+    if (base + candidate->returnDepth > UINT8_COUNT ||
+        currentChunk()->constants.count + body->constants.count >= UINT8_COUNT) {
+        return false;
+    }
+
+    // Name is already a constant, as callee was read from global
+    int name = makeConstant(OBJ_VAL(candidate->name));
+    int callLine = context->parser.previous.line;
+
+    for (int offset = candidate->bodyOffset; offset < candidate->returnOffset;) {
+        uint8_t instruction = body->code[offset];
+        int line = inlinedLine(body, getLine(body, offset), name, callLine);
+
+        switch (instruction) {
+            case OP_CONSTANT:
+            case OP_DEFINE_GLOBAL:
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL: {
+                Value constant = body->constants.values[body->code[offset + 1]];
+                uint8_t index = makeConstant(constant);
+                emitByteAt(instruction, line);
+                emitByteAt(index, line);
+                break;
+            }
+
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+                emitByteAt(instruction, line);
+                emitByteAt((uint8_t)(base + body->code[offset + 1]), line);
+                break;
+
+            // Jump offsets are relative and stay valid since
+            // every instruction keeps its size
+            default:
+                for (int i = 0; i <= operandCount(instruction); i++) {
+                    emitByteAt(body->code[offset + i], line);
+                }
+                break;
+        }
 
-    // Condition Clause
-    int exitJump = -1;
-    if (!match(TOKEN_SEMICOLON)) {
-        expression();
-        consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+        offset += 1 + operandCount(instruction);
+    }
 
-        // Jump out of loop if condition is false
-        exitJump = emitJump(OP_JUMP_IF_FALSE);
+    // Linear tracking is unaware of branches inside body
+    context->current->stackDepth = base + candidate->returnDepth;
 
-        // Popping out evaluated condition
+    // Result replaces callee, then arguements and body locals are dropped
+    emitBytes(OP_SET_LOCAL, (uint8_t)base);
+    for (int i = 1; i < candidate->returnDepth; i++) {
         emitByte(OP_POP);
     }
 
-    // Increment Clause
-    if (!match(TOKEN_RIGHT_PAREN)) {
-        int bodyJump = emitJump(OP_JUMP);
-        int incrementStart = currentChunk()->count;
+    return true;
+}
+// Compiling function 
+// Skips body of a function only checking that braces are balanced
+static void skimBlock()
+{
+    int depth = 1;
 
-        expression();
-        emitByte(OP_POP);
-        consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+    while (depth > 0 && !check(TOKEN_EOF)) {
+        if (check(TOKEN_LEFT_BRACE)) {
+            depth++;
+        } else if (check(TOKEN_RIGHT_BRACE)) {
+            depth--;
+        }
 
-        // Since the compiler is single pass
-        // We jump over the increment, run the body, jump back up to the increment
-        // run it then go to next iteration
-        emitLoop(loopStart);
-        loopStart = incrementStart;
-        patchJump(bodyJump);
+        advance();
     }
 
-    statement();
-    emitLoop(loopStart);
-
-    // Patching Jump instructiono
-    if (exitJump != -1) {
-        // Only done if there is condition clause
-        patchJump(exitJump);
-        emitByte(OP_POP);
+    if (depth > 0) {
+        errorAtCurrent("Expect '}' after block.");
     }
-
-    endScope();
 }
 
-static void returnStatement()
+// Mask of parameters only seen holding numbers in type profile, bit 0 for first
+static uint8_t numberParameters(uint32_t site)
 {
-    if (current->type == TYPE_SCRIPT) {
-        error("Can't return from top-level code.");
-    }
+    TypeSite* feedback = typeFeedback(site);
+    uint8_t mask = 0;
 
-    if (match(TOKEN_SEMICOLON)) {
-        emitReturn();
-    } else {
-        // Calculating return expression 
-        // which will push the result on top of stack
-        expression();
-        consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
-        emitByte(OP_RETURN);
+    for (int i = 0; i < context->current->function->arity && i < TYPE_OPERANDS; i++) {
+        if (onlyNumbers(feedback, i)) {
+            mask |= 1 << i;
+        }
     }
+
+    return mask;
 }
 
-static void statement()
+static void setParameterTypes(uint8_t mask, StaticType type)
 {
-    if (match(TOKEN_PRINT)) {
-        printStatement();
-    } else if (match(TOKEN_LEFT_BRACE)) {
-        beginScope();
-        block();
-        endScope();
-    } else if (match(TOKEN_IF)) {
-        ifStatement();
-    } else if (match(TOKEN_WHILE)) {
-        whileStatement();
-    } else if (match(TOKEN_FOR)) {
-        forStatement();
-    } else if (match(TOKEN_RETURN)) {
-        returnStatement();
-    } else {
-        expressionStatement();
+    for (int i = 0; i < TYPE_OPERANDS; i++) {
+        if (mask & (1 << i)) {
+            context->current->locals[i + 1].type = type;
+        }
     }
 }
 
-static void varDeclaration()
+/*
+ Parameters that only held numbers in the type profile are assumed to be
+ numbers, so type inference emits unchecked arithmetic in the body.
+ OP_GUARD_NUMBERS checks the assumption on entry and otherwise jumps to a
+ second, generic copy of the body compiled again from the same tokens.
+*/
+static void specializedBlock(uint8_t mask)
 {
-    // Compiles the variable name
-    // Adds variable name to constants table of chunk
-    uint8_t global = parseVariable("Expect variable name.");
+    Chunk* chunk = currentChunk();
+    Scanner scanner = context->scanner;
+    Parser parser = context->parser;
+    int siteLine = context->siteLine, siteIndex = context->siteIndex;
+    int typeSiteLine = context->typeSiteLine, typeSiteIndex = context->typeSiteIndex;
+    int guardStart = chunk->count;
+    int constantCount = chunk->constants.count;
+    int localCount = context->current->localCount;
+    int stackDepth = context->current->stackDepth;
+
+    emitBytes(OP_GUARD_NUMBERS, mask);
+    emitBytes(0xff, 0xff);
+    int guard = chunk->count - 2;
+
+    setParameterTypes(mask, STATIC_NUMBER);
+    block();
 
-    // Checking if there is r-value for the variable declaration
-    if (match(TOKEN_EQUAL)) {
-        expression();
-    } else {
-        // If no assignment then variable assigned to NIL
-        emitByte(OP_NIL);
+    // Specialized copy must not fall into the generic one
+    emitReturn();
+
+    if (context->parser.hadError) {
+        return;
     }
 
-    consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+    // Compiling body again from its first token
+    context->scanner = scanner;
+    context->parser = parser;
+    context->siteLine = siteLine;
+    context->siteIndex = siteIndex;
+    context->typeSiteLine = typeSiteLine;
+    context->typeSiteIndex = typeSiteIndex;
+    setParameterTypes(mask, STATIC_UNKNOWN);
+
+    // Locals of specialized copy are gone once it returns
+    while (context->current->localCount > localCount) {
+        Local* local = &context->current->locals[--context->current->localCount];
+        context->current->localBuckets[local->name.hash & (LOCAL_BUCKETS - 1)] = local->nextInBucket;
+    }
+    context->current->stackDepth = stackDepth;
+
+    // Both copies have to fit in one chunk, otherwise only generic one is kept
+    if (chunk->constants.count * 2 - constantCount > UINT8_MAX ||
+        chunk->count - guard - 2 > UINT16_MAX) {
+        truncateChunk(chunk, guardStart);
+        chunk->constants.count = constantCount;
+        context->current->lastGlobalGet = -1;
+        context->current->lastConcat = -1;
+    } else {
+        patchJump(guard);
+    }
 
-    // Adding Byte code with OP code and Constants index
-    defineVariable(global);
+    block();
 }
 
-// Compiling function 
-static void function(FunctionType type)
+// Compiles parameter list and body into current compiler
+// When skimming, the body is only scanned and compiled on first call
+static void functionBody(bool skim)
 {
-    // Defining seperate compiler for each function being compiled
-    Compiler compiler;
-    initCompiler(&compiler, type);
-
     // Defining scope for current function body
     beginScope();
 
@@ -864,8 +3359,8 @@ static void function(FunctionType type)
     consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
     if (!check(TOKEN_RIGHT_PAREN)) {
         do {
-            current->function->arity++;
-            if (current->function->arity > 255) {
+            context->current->function->arity++;
+            if (context->current->function->arity > 255) {
                 errorAtCurrent("Can't have more than 255 parameters.");
             }
 
@@ -875,13 +3370,206 @@ static void function(FunctionType type)
 
             // Only defining arguements and not initialising
             defineVariable(paramConstant);
+
+            // Arguements are already on stack when frame starts
+            context->current->stackDepth++;
         } while (match(TOKEN_COMMA));
     }
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameter.");
 
+    // Clones read their constant arguements from constant table instead
+    int arity = context->current->function->arity;
+    FunctionClone* clone = context->current->clone;
+    for (int i = 0; clone != NULL && i < arity; i++) {
+        if (clone->isConstant[i]) {
+            Local* local = &context->current->locals[i + 1];
+            local->isConst = true;
+            local->constant = clone->values[i];
+            local->type = valueType(clone->values[i]);
+        }
+    }
+
+    // Arguements are recorded as they arrive
+    uint32_t site = nextTypeSite();
+    if (!skim && arity > 0) {
+        emitTypeProfile(site, arity - 1);
+    }
+
     // Compiling Body
     consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
-    block();
+
+    uint8_t mask = skim ? 0 : numberParameters(site);
+    if (skim) {
+        skimBlock();
+    } else if (mask != 0) {
+        specializedBlock(mask);
+    } else {
+        block();
+    }
+}
+
+// CLONING
+
+// Records global function that calls with constant arguements can get clones of
+// source and line point to its parameter list
+static void addCloneTarget(ObjFunction* function, const char* source, int line)
+{
+    if (context->cloneTargetCount == CLONE_TARGETS_MAX ||
+        function->arity == 0 || function->arity > CLONE_MAX_ARITY) {
+        return;
+    }
+
+    // Name must never be rebound, else call sites could see other function
+    Value writes;
+    if (!tableGet(&context->globalWrites, function->name, &writes) || AS_NUMBER(writes) != 1) {
+        return;
+    }
+
+    CloneTarget* target = &context->cloneTargets[context->cloneTargetCount++];
+    target->name = function->name;
+    target->function = function;
+    target->source = source;
+    target->line = line;
+    target->cloneCount = 0;
+}
+
+static CloneTarget* findCloneTarget(ObjString* name)
+{
+    for (int i = 0; i < context->cloneTargetCount; i++) {
+        if (context->cloneTargets[i].name == name) {
+            return &context->cloneTargets[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Checks if arguement compiled between start and end is a literal
+// Only numbers and strings are taken, other constants are functions
+static bool constantArguement(int start, int end, Value* value)
+{
+    Chunk* chunk = currentChunk();
+
+    if (end - start == 2 && chunk->code[start] == OP_CONSTANT) {
+        *value = chunk->constants.values[chunk->code[start + 1]];
+        return IS_NUMBER(*value) || IS_STRING(*value);
+    }
+
+    if (end - start == 1) {
+        switch (chunk->code[start]) {
+            case OP_NIL: *value = NIL_VAL; return true;
+            case OP_TRUE: *value = BOOL_VAL(true); return true;
+            case OP_FALSE: *value = BOOL_VAL(false); return true;
+            default: break;
+        }
+    }
+
+    return false;
+}
+
+// Compiles function of target again from its parameter list
+// with parameters of clone fixed to its constants
+static void compileClone(CloneTarget* target, FunctionClone* clone)
+{
+    Scanner scanner = context->scanner;
+    Parser parser = context->parser;
+    int siteLine = context->siteLine, siteIndex = context->siteIndex;
+    int typeSiteLine = context->typeSiteLine, typeSiteIndex = context->typeSiteIndex;
+
+    initScanner(&context->scanner, target->source);
+    context->scanner.line = target->line;
+
+    // Profile sites are numbered as they were in original function
+    context->siteLine = 0;
+    context->typeSiteLine = 0;
+
+    Compiler compiler;
+    initCompiler(&compiler, TYPE_FUNCTION, clone->function);
+    compiler.clone = clone;
+
+    advance();
+    functionBody(false);
+    endCompiler();
+
+    // Clone only pays off when constants let it drop code
+    if (compiler.cloneFailed || context->parser.hadError ||
+        clone->function->chunk.count >= target->function->chunk.count) {
+        clone->function = NULL;
+    }
+
+    context->scanner = scanner;
+    context->parser = parser;
+    context->siteLine = siteLine;
+    context->siteIndex = siteIndex;
+    context->typeSiteLine = typeSiteLine;
+    context->typeSiteIndex = typeSiteIndex;
+}
+
+// Finds function to call instead of target for arguements compiled at argStarts
+// A clone is compiled the first time a set of constant arguements is seen
+// Returns NULL if call should stay with original function
+static ObjFunction* cloneFor(CloneTarget* target, int* argStarts, int argCount)
+{
+    if (argCount != target->function->arity) {
+        return NULL;
+    }
+
+    FunctionClone wanted;
+    wanted.function = NULL;
+    bool anyConstant = false;
+    for (int i = 0; i < argCount; i++) {
+        wanted.isConstant[i] = constantArguement(argStarts[i], argStarts[i + 1], &wanted.values[i]);
+        anyConstant = anyConstant || wanted.isConstant[i];
+    }
+
+    if (!anyConstant) {
+        return NULL;
+    }
+
+    for (int i = 0; i < target->cloneCount; i++) {
+        FunctionClone* clone = &target->clones[i];
+        bool same = true;
+        for (int j = 0; same && j < argCount; j++) {
+            same = clone->isConstant[j] == wanted.isConstant[j] &&
+                (!wanted.isConstant[j] || valuesEqual(clone->values[j], wanted.values[j]));
+        }
+
+        if (same) {
+            return clone->function;
+        }
+    }
+
+    if (target->cloneCount == compilerOptions.maxClones || target->cloneCount == CLONES_MAX) {
+        return NULL;
+    }
+
+    // Registered before compiling so that recursive calls with same arguements use it
+    FunctionClone* clone = &target->clones[target->cloneCount++];
+    *clone = wanted;
+    clone->function = newFunction();
+    clone->function->name = target->name;
+
+    compileClone(target, clone);
+    return clone->function;
+}
+
+// Compiling function 
+static ObjFunction* function(FunctionType type)
+{
+    // Defining seperate compiler for each function being compiled
+    Compiler compiler;
+    initCompiler(&compiler, type, NULL);
+
+    // Parameters are compiled again along with the body on first call
+    const char* lazySource = context->parser.current.start;
+    int lazyLine = context->parser.current.line;
+
+    functionBody(compilerOptions.lazyFunctions);
+
+    if (compilerOptions.lazyFunctions) {
+        context->current->function->lazySource = lazySource;
+        context->current->function->lazyLine = lazyLine;
+    }
 
     // Creating function object
     // endCompiler also sets the current compiler object to enclosing
@@ -891,25 +3579,38 @@ static void function(FunctionType type)
     // Storing function object in constant table
     emitBytes(OP_CONSTANT, makeConstant(OBJ_VAL(function)));
 
+    // Skimmed functions have no body to copy yet
+    if (context->inlineFunctions && function->lazySource == NULL &&
+        context->current->scopeDepth == 0 && !context->parser.hadError) {
+        addInlineCandidate(&compiler);
+    }
+
+    if (compilerOptions.maxClones > 0 && function->lazySource == NULL &&
+        context->current->scopeDepth == 0 && !context->parser.hadError) {
+        addCloneTarget(function, lazySource, lazyLine);
+    }
+
+    return function;
 }
 
 static void synchronize()
 {
-    parser.panicMode = false;
+    context->parser.panicMode = false;
 
-    while (parser.current.type != TOKEN_EOF) {
+    while (context->parser.current.type != TOKEN_EOF) {
 
         // Using Statement boundaries to synchronize
-        if (parser.previous.type == TOKEN_SEMICOLON) {
+        if (context->parser.previous.type == TOKEN_SEMICOLON) {
             return;
         }
 
         // Looing subsequent token that begins a statement
         // usually one of flow control or declaration keywords
-        switch (parser.current.type) {
+        switch (context->parser.current.type) {
             case TOKEN_CLASS:
             case TOKEN_FUN:
             case TOKEN_VAR:
+            case TOKEN_CONST:
             case TOKEN_FOR:
             case TOKEN_IF:
             case TOKEN_WHILE:
@@ -943,18 +3644,61 @@ static void declaration()
         funDeclaration();
     } else if (match(TOKEN_VAR)) {
         varDeclaration();
+    } else if (match(TOKEN_CONST)) {
+        constDeclaration();
     } else {
         statement();
     }
 
-    if (parser.panicMode) {
+    if (context->parser.panicMode) {
         synchronize();
     }
 }
 
 static void call(bool canAssign)
 {
-    uint8_t argCount = arguementList();
+    // Callee is known when call directly follows read of a global
+    ObjString* callee = NULL;
+    InlineCandidate* candidate = NULL;
+    if (context->current->lastGlobalGet == currentChunk()->count - 2) {
+        Value name = currentChunk()->constants.values[currentChunk()->code[context->current->lastGlobalGet + 1]];
+        callee = AS_STRING(name);
+    }
+
+    if (context->inlineFunctions && callee != NULL) {
+        candidate = findInlineCandidate(callee);
+    }
+
+    int base = context->current->stackDepth - 1;
+    int calleeOffset = context->current->lastGlobalGet;
+    uint32_t site = nextTypeSite();
+    int argStarts[CLONE_MAX_ARITY + 1];
+    uint8_t argCount = arguementList(argStarts);
+
+    context->current->exprType = STATIC_UNKNOWN;
+
+    if (candidate != NULL && argCount == candidate->function->arity &&
+        inlineCall(candidate, base)) {
+        context->current->hasInlined = true;
+        // Callee slot only holds the result now
+        // so the global lookup is replaced by a cheaper constant load
+        currentChunk()->code[calleeOffset] = OP_CONSTANT;
+        currentChunk()->code[calleeOffset + 1] =
+            makeConstant(OBJ_VAL(candidate->function));
+        return;
+    }
+
+    // Calls with constant arguements go to a clone compiled for them
+    CloneTarget* target = callee != NULL ? findCloneTarget(callee) : NULL;
+    if (target != NULL && !context->parser.hadError) {
+        ObjFunction* clone = cloneFor(target, argStarts, argCount);
+        if (clone != NULL) {
+            currentChunk()->code[calleeOffset] = OP_CONSTANT;
+            currentChunk()->code[calleeOffset + 1] = makeConstant(OBJ_VAL(clone));
+        }
+    }
+
+    emitTypeProfile(site, argCount);
     emitBytes(OP_CALL, argCount);
 }
 
@@ -972,6 +3716,7 @@ ParseRule rules[] = {
     [TOKEN_SEMICOLON]       = { NULL,       NULL,      PREC_NONE    },
     [TOKEN_SLASH]           = { NULL,       binary,    PREC_FACTOR  },
     [TOKEN_STAR]            = { NULL,       binary,    PREC_FACTOR  },
+    [TOKEN_COLON]           = { NULL,       NULL,      PREC_NONE    },
     [TOKEN_BANG]            = { unary,      NULL,      PREC_NONE    },
     [TOKEN_BANG_EQUAL]      = { NULL,       binary,    PREC_EQUALITY},
     [TOKEN_EQUAL]           = { NULL,       NULL,      PREC_NONE    },
@@ -984,7 +3729,10 @@ ParseRule rules[] = {
     [TOKEN_STRING]          = { string,     NULL,      PREC_NONE    },
     [TOKEN_NUMBER]          = { number,     NULL,      PREC_NONE    },
     [TOKEN_AND]             = { NULL,       and_,      PREC_AND     },
+    [TOKEN_CASE]            = { NULL,       NULL,      PREC_NONE    },
     [TOKEN_CLASS]           = { NULL,       NULL,      PREC_NONE    },
+    [TOKEN_CONST]           = { NULL,       NULL,      PREC_NONE    },
+    [TOKEN_DEFAULT]         = { NULL,       NULL,      PREC_NONE    },
     [TOKEN_ELSE]            = { NULL,       NULL,      PREC_NONE    },
     [TOKEN_FALSE]           = { literal,    NULL,      PREC_NONE    },
     [TOKEN_FOR]             = { NULL,       NULL,      PREC_NONE    },
@@ -995,6 +3743,7 @@ ParseRule rules[] = {
     [TOKEN_PRINT]           = { NULL,       NULL,      PREC_NONE    },
     [TOKEN_RETURN]          = { NULL,       NULL,      PREC_NONE    },
     [TOKEN_SUPER]           = { NULL,       NULL,      PREC_NONE    },
+    [TOKEN_SWITCH]          = { NULL,       NULL,      PREC_NONE    },
     [TOKEN_THIS]            = { NULL,       NULL,      PREC_NONE    },
     [TOKEN_TRUE]            = { literal,    NULL,      PREC_NONE    },
     [TOKEN_VAR]             = { NULL,       NULL,      PREC_NONE    },
@@ -1009,15 +3758,52 @@ static ParseRule* getRule(TokenType type)
     return &rules[type];
 }
 
-ObjFunction* compile(const char* source)
+// Consts declared by successful calls to compileAt(), known to later calls
+static Table keptConsts = { 0, -1, NULL };
+
+// One pass over whole source, inlineOverflow is set when it has to be compiled again without inlining
+static ObjFunction* compilePass(const char* source, int line, bool keepConsts, bool inlineFunctions, bool* inlineOverflow)
 {
-    initScanner(source);
+    // Compile may be entered again while compiling, so context is restored at the end
+    CompileContext compileContext;
+    CompileContext* enclosing = context;
+    compileContext.enclosing = context;
+    context = &compileContext;
+
+    context->current = NULL;
+    context->inlineCandidateCount = 0;
+    context->cloneTargetCount = 0;
+    context->siteLine = 0;
+    context->siteIndex = 0;
+    context->typeSiteLine = 0;
+    context->typeSiteIndex = 0;
+    context->inlineFunctions = inlineFunctions;
+    context->inlineOverflow = false;
+#ifdef DEBUG_PRINT_CODE
+    context->finished = NULL;
+    context->finishedCount = 0;
+    context->finishedCapacity = 0;
+#endif
+    initTable(&context->globalWrites);
+    initTable(&context->consts);
+    initTable(&context->globalUses);
+
+    if (keepConsts) {
+        tableAddAll(&keptConsts, &context->consts);
+    }
+
+    if (inlineFunctions) {
+        countGlobalWrites(source);
+    }
+
+    initScanner(&context->scanner, source);
+    context->scanner.line = line;
 
     Compiler compiler;
-    initCompiler(&compiler, TYPE_SCRIPT);
+    initCompiler(&compiler, TYPE_SCRIPT, NULL);
 
-    parser.hadError = false;
-    parser.panicMode = false;
+    context->parser.hadError = false;
+    context->parser.panicMode = false;
 
     advance();
     
@@ -1028,16 +3814,258 @@ ObjFunction* compile(const char* source)
 
     // If there is error in compiler, we return NULL
     ObjFunction* function = endCompiler();
-    return parser.hadError ? NULL : function;
+    bool hadError = context->parser.hadError || context->inlineOverflow;
+    *inlineOverflow = context->inlineOverflow;
+
+    if (keepConsts && !hadError) {
+        // Script is not reachable from any root until it is returned
+        protectValue(OBJ_VAL(function));
+        tableAddAll(&context->consts, &keptConsts);
+        unprotectValue();
+    }
+
+#ifdef DEBUG_PRINT_CODE
+    printFinished(!hadError);
+#endif
+
+    freeTable(&context->globalWrites);
+    freeTable(&context->consts);
+    freeTable(&context->globalUses);
+
+    context = enclosing;
+    return hadError ? NULL : function;
+}
+
+static ObjFunction* compileSource(const char* source, int line, bool keepConsts)
+{
+    // Copied bodies can take up constants a function needs for its own code
+    // It compiles without inlining whenever source does
+    bool inlineOverflow = false;
+    ObjFunction* function = compilePass(source, line, keepConsts, compilerOptions.inlineFunctions, &inlineOverflow);
+    if (inlineOverflow) {
+        function = compilePass(source, line, keepConsts, false, &inlineOverflow);
+    }
+
+    return function;
+}
+
+ObjFunction* compile(const char* source)
+{
+    return compileSource(source, 1, false);
+}
+
+ObjFunction* compileAt(const char* source, int line)
+{
+    return compileSource(source, line, true);
+}
+
+// One pass over body of function, inlineOverflow is set when it has to be compiled again without inlining
+static bool lazyPass(ObjFunction* function, bool inlineFunctions, bool* inlineOverflow)
+{
+    CompileContext compileContext;
+    CompileContext* enclosing = context;
+    compileContext.enclosing = context;
+    context = &compileContext;
+
+    context->current = NULL;
+    context->inlineCandidateCount = 0;
+    context->cloneTargetCount = 0;
+    context->siteLine = 0;
+    context->siteIndex = 0;
+    context->typeSiteLine = 0;
+    context->typeSiteIndex = 0;
+    context->inlineFunctions = inlineFunctions;
+    context->inlineOverflow = false;
+#ifdef DEBUG_PRINT_CODE
+    context->finished = NULL;
+    context->finishedCount = 0;
+    context->finishedCapacity = 0;
+#endif
+    initTable(&context->globalWrites);
+    initTable(&context->consts);
+    initTable(&context->globalUses);
+
+    // Scanning again from parameter list with line numbers as they were
+    const char* lazySource = function->lazySource;
+    initScanner(&context->scanner, lazySource);
+    context->scanner.line = function->lazyLine;
+
+    Compiler compiler;
+    initCompiler(&compiler, TYPE_FUNCTION, function);
+
+    context->parser.hadError = false;
+    context->parser.panicMode = false;
+
+    // Parameters are counted again by functionBody
+    function->lazySource = NULL;
+    function->arity = 0;
+
+    advance();
+    functionBody(false);
+    endCompiler();
+
+    bool hadError = context->parser.hadError || context->inlineOverflow;
+    *inlineOverflow = context->inlineOverflow;
+    if (hadError) {
+        // Errors are reported again if function is called again
+        freeChunk(&function->chunk);
+        function->lazySource = lazySource;
+    } else if (function->obj.isPermanent) {
+        // Body follows function into permanent space
+        ValueArray* constants = &function->chunk.constants;
+        for (int i = 0; i < constants->count; i++) {
+            if (IS_OBJ(constants->values[i])) {
+                makePermanent(AS_OBJ(constants->values[i]));
+            }
+        }
+    }
+
+#ifdef DEBUG_PRINT_CODE
+    printFinished(!hadError);
+#endif
+
+    freeTable(&context->globalWrites);
+    freeTable(&context->consts);
+    freeTable(&context->globalUses);
+
+    context = enclosing;
+    return !hadError;
+}
+
+bool compileLazyFunction(ObjFunction* function)
+{
+    bool inlineOverflow = false;
+    bool compiled = lazyPass(function, compilerOptions.inlineFunctions, &inlineOverflow);
+    if (inlineOverflow) {
+        compiled = lazyPass(function, false, &inlineOverflow);
+    }
+
+    return compiled;
 }
 
 void markCompilerRoots()
 {
-    Compiler* compiler = current;
+    // Contexts of enclosing compilations on this thread are marked too
+    // Compilations on other threads use heaps that are never collected
+    for (CompileContext* compile = context; compile != NULL; compile = compile->enclosing) {
+        Compiler* compiler = compile->current;
+
+        // Marking Function objects for garbage collector by walking whole list
+        while (compiler != NULL) {
+            markObject((Obj*)compiler->function);
+
+            // Marking stops at a permanent function getting its lazy body,
+            // while constants added to it so far are not permanent yet
+            if (compiler->function != NULL && compiler->function->obj.isPermanent) {
+                ValueArray* constants = &compiler->function->chunk.constants;
+                for (int i = 0; i < constants->count; i++) {
+                    markValue(constants->values[i]);
+                }
+            }
+            compiler = compiler->enclosing;
+        }
+
+        // Clones are only reachable from call sites already compiled
+        for (int i = 0; i < compile->cloneTargetCount; i++) {
+            CloneTarget* target = &compile->cloneTargets[i];
+            for (int j = 0; j < target->cloneCount; j++) {
+                FunctionClone* clone = &target->clones[j];
+                markObject((Obj*)clone->function);
+                for (int k = 0; k < target->function->arity; k++) {
+                    if (clone->isConstant[k]) {
+                        markValue(clone->values[k]);
+                    }
+                }
+            }
+        }
+
+        markTable(&compile->globalWrites);
+        markTable(&compile->consts);
+        markTable(&compile->globalUses);
+
+#ifdef DEBUG_PRINT_CODE
+        // Clones given up on are only reachable from here until printed
+        for (int i = 0; i < compile->finishedCount; i++) {
+            markObject((Obj*)compile->finished[i]);
+        }
+#endif
+    }
+
+    markTable(&keptConsts);
+}
+
+// Jobs shared by all worker threads of compileJobs()
+typedef struct {
+    CompileJob* jobs;
+    int count;
+    int next;               // Index of next job to be picked
+    pthread_mutex_t lock;
+} JobQueue;
+
+static void* compileWorker(void* arg)
+{
+    JobQueue* queue = (JobQueue*)arg;
+    Heap* previous = currentHeap;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        int index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (index >= queue->count) {
+            break;
+        }
+
+        // Every object created while compiling goes to job's own heap
+        CompileJob* job = &queue->jobs[index];
+        initHeap(&job->heap);
+
+        // Errors are kept with job, as threads would mix them up on stderr
+        size_t errorsLength = 0;
+        job->errors = NULL;
+        errorOutput = open_memstream(&job->errors, &errorsLength);
+
+        currentHeap = &job->heap;
+        job->function = compile(job->source);
+        currentHeap = previous;
+
+        if (errorOutput != NULL) {
+            fclose(errorOutput);
+            errorOutput = NULL;
+        }
+    }
+
+    return NULL;
+}
+
+void compileJobs(CompileJob* jobs, int count, int threadCount)
+{
+    JobQueue queue;
+    queue.jobs = jobs;
+    queue.count = count;
+    queue.next = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+
+    if (threadCount > count) {
+        threadCount = count;
+    }
+
+    // Calling thread works on the queue too
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * (threadCount > 1 ? threadCount - 1 : 1));
+    int started = 0;
+
+    for (int i = 1; i < threadCount; i++) {
+        if (pthread_create(&threads[started], NULL, compileWorker, &queue) == 0) {
+            started++;
+        }
+    }
+
+    compileWorker(&queue);
 
-    // Marking Function objects for garbage collector by walking whole list
-    while (compiler != NULL) {
-        markObject((Obj*)compiler->function);
-        compiler = compiler->enclosing;
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
     }
-}
\ No newline at end of file
+
+    free(threads);
+    pthread_mutex_destroy(&queue.lock);
+}
@@ -40,6 +40,30 @@ static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset)
     return offset + 3;
 }
 
+// Prints branch site as line:index
+static int profileInstruction(const char* name, Chunk* chunk, int offset)
+{
+    int line = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    printf("%-16s %4d:%d\n", name, line, chunk->code[offset + 3]);
+    return offset + 4;
+}
+
+// Prints type site as line:index followed by depth of first recorded value
+static int typeProfileInstruction(const char* name, Chunk* chunk, int offset)
+{
+    int line = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    printf("%-16s %4d:%d %d\n", name, line, chunk->code[offset + 3], chunk->code[offset + 4]);
+    return offset + 5;
+}
+
+// Prints mask of guarded parameters and where failing guard jumps to
+static int guardInstruction(const char* name, Chunk* chunk, int offset)
+{
+    uint16_t jump = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+    printf("%-16s %4d %d -> %d\n", name, chunk->code[offset + 1], offset, offset + 4 + jump);
+    return offset + 4;
+}
+
 void disassembleChunk(Chunk* chunk, const char* name)
 {
     printf("== %s ==\n", name);
@@ -57,11 +81,12 @@ int disassembleInstruction(Chunk* chunk, int offset)
     printf("%04d ", offset);
 
     // Printing Line number from Source code
-    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+    int line = sourceLine(chunk, offset);
+    if (offset > 0 && line == sourceLine(chunk, offset - 1)) {
         // If current instruction is from same line as precedding one
         printf("   | ");
     } else {
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", line);
     }
 
     uint8_t instruction = chunk->code[offset];
@@ -85,6 +110,8 @@ int disassembleInstruction(Chunk* chunk, int offset)
         // The arithemetic instruction do no need operand address in Stack CPU
         case OP_ADD:
             return simpleInstruction("OP_ADD", offset);
+        case OP_ADD_GUARDED:
+            return simpleInstruction("OP_ADD_GUARDED", offset);
 
         case OP_SUBTRACT:
             return simpleInstruction("OP_SUBTRACT", offset);
@@ -107,6 +134,27 @@ int disassembleInstruction(Chunk* chunk, int offset)
         case OP_LESS:
             return simpleInstruction("OP_LESS", offset);
 
+        case OP_NEGATE_NUMBER:
+            return simpleInstruction("OP_NEGATE_NUMBER", offset);
+
+        case OP_ADD_NUMBER:
+            return simpleInstruction("OP_ADD_NUMBER", offset);
+
+        case OP_SUBTRACT_NUMBER:
+            return simpleInstruction("OP_SUBTRACT_NUMBER", offset);
+
+        case OP_MULTIPLY_NUMBER:
+            return simpleInstruction("OP_MULTIPLY_NUMBER", offset);
+
+        case OP_DIVIDE_NUMBER:
+            return simpleInstruction("OP_DIVIDE_NUMBER", offset);
+
+        case OP_GREATER_NUMBER:
+            return simpleInstruction("OP_GREATER_NUMBER", offset);
+
+        case OP_LESS_NUMBER:
+            return simpleInstruction("OP_LESS_NUMBER", offset);
+
         case OP_PRINT:
             return simpleInstruction("OP_PRINT", offset);
 
@@ -133,13 +181,29 @@ int disassembleInstruction(Chunk* chunk, int offset)
 
         case OP_JUMP_IF_FALSE:
             return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+        case OP_JUMP_IF_TRUE:
+            return jumpInstruction("OP_JUMP_IF_TRUE", 1, chunk, offset);
+        case OP_PROFILE_BRANCH:
+            return profileInstruction("OP_PROFILE_BRANCH", chunk, offset);
+        case OP_PROFILE_TYPES:
+            return typeProfileInstruction("OP_PROFILE_TYPES", chunk, offset);
+        case OP_GUARD_NUMBERS:
+            return guardInstruction("OP_GUARD_NUMBERS", chunk, offset);
 
         case OP_LOOP:
             return jumpInstruction("OP_LOOP", -1, chunk, offset);
+        case OP_SWITCH:
+            return constantInstruction("OP_SWITCH", chunk, offset);
 
         case OP_CALL:
             return byteInstruction("OP_CALL", chunk, offset);
 
+        case OP_CONCAT:
+            return byteInstruction("OP_CONCAT", chunk, offset);
+
+        case OP_PRINT_CONCAT:
+            return byteInstruction("OP_PRINT_CONCAT", chunk, offset);
+
         case OP_RETURN:
             return simpleInstruction("OP_RETURN", offset);
 
@@ -0,0 +1,255 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./../include/files.h"
+#include "./../include/memory.h"
+#include "./../include/object.h"
+
+// Files opened by scripts, number of a file is its index
+// Slots of closed files are used again
+static OpenFile* files = NULL;
+static int fileCount = 0;
+static int fileCapacity = 0;
+
+static int addFile()
+{
+    for (int i = 0; i < fileCount; i++) {
+        if (!files[i].isOpen) {
+            return i;
+        }
+    }
+
+    if (fileCapacity < fileCount + 1) {
+        fileCapacity = GROW_CAPACITY(fileCapacity);
+        files = (OpenFile*)realloc(files, sizeof(OpenFile) * fileCapacity);
+        if (files == NULL) {
+            fprintf(stderr, "Not enough memory for open files.\n");
+            exit(74);
+        }
+    }
+
+    return fileCount++;
+}
+
+// File a number given by script refers to, NULL if it is not an open file
+static OpenFile* fileArgument(Value value)
+{
+    if (!IS_NUMBER(value)) {
+        return NULL;
+    }
+
+    double number = AS_NUMBER(value);
+    if (!(number >= 0 && number < fileCount) || number != (int)number) {
+        return NULL;
+    }
+
+    OpenFile* file = &files[(int)number];
+    return file->isOpen ? file : NULL;
+}
+
+static bool mapOpenFile(OpenFile* file, int fd, size_t length)
+{
+    void* data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    madvise(data, length, MADV_SEQUENTIAL);
+
+    // Whole file is already in view, so descriptor is not needed
+    close(fd);
+    file->fd = -1;
+    file->isMapped = true;
+    file->ended = true;
+    file->data = (char*)data;
+    file->length = length;
+    return true;
+}
+
+// Reads more of a file that is not mapped, moving bytes not handed out to start of buffer
+// Buffer grows when they fill most of it, which only happens for very long lines and blocks
+// Returns false when nothing more could be read
+static bool fillFile(OpenFile* file)
+{
+    if (file->ended) {
+        return false;
+    }
+
+    if (file->position > 0) {
+        memmove(file->data, file->data + file->position, file->length - file->position);
+        file->length -= file->position;
+        file->position = 0;
+    }
+
+    if (file->capacity - file->length < FILE_READ_SIZE) {
+        size_t capacity = file->capacity * 2;
+        if (capacity < file->length + FILE_READ_SIZE) {
+            capacity = file->length + FILE_READ_SIZE;
+        }
+
+        file->data = (char*)realloc(file->data, capacity);
+        if (file->data == NULL) {
+            fprintf(stderr, "Not enough memory to read file.\n");
+            exit(74);
+        }
+        file->capacity = capacity;
+    }
+
+    ssize_t bytesRead = read(file->fd, file->data + file->length, file->capacity - file->length);
+    if (bytesRead <= 0) {
+        file->ended = true;
+        return false;
+    }
+
+    file->length += (size_t)bytesRead;
+    return true;
+}
+
+// Hands out next length bytes as a string
+// Pages of mapped files far behind are dropped, so reading a large file
+// does not keep all of it resident
+static Value takeBytes(OpenFile* file, size_t length)
+{
+    ObjString* string = copyString(file->data + file->position, (int)length);
+    file->position += length;
+
+    if (file->isMapped && file->position - file->released >= FILE_RELEASE_SIZE) {
+        size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        size_t end = file->position / pageSize * pageSize;
+        madvise(file->data + file->released, end - file->released, MADV_DONTNEED);
+        file->released = end;
+    }
+
+    return OBJ_VAL(string);
+}
+
+Value openFileNative(int argCount, Value* args)
+{
+    if (argCount != 1 || !IS_STRING(args[0])) {
+        return NIL_VAL;
+    }
+
+    int fd = open(AS_CSTRING(args[0]), O_RDONLY);
+    if (fd == -1) {
+        return NIL_VAL;
+    }
+
+    int index = addFile();
+    OpenFile* file = &files[index];
+    file->isOpen = true;
+    file->isMapped = false;
+    file->fd = fd;
+    file->ended = false;
+    file->data = NULL;
+    file->length = 0;
+    file->capacity = 0;
+    file->position = 0;
+    file->released = 0;
+
+    // Empty files cannot be mapped and files in /proc report no size, both are read instead
+    struct stat status;
+    if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0) {
+        mapOpenFile(file, fd, (size_t)status.st_size);
+    }
+
+    return NUMBER_VAL((double)index);
+}
+
+Value readLineNative(int argCount, Value* args)
+{
+    OpenFile* file = argCount == 1 ? fileArgument(args[0]) : NULL;
+    if (file == NULL) {
+        return NIL_VAL;
+    }
+
+    // Bytes already searched for '\n', counted from position as filling moves them
+    size_t searched = 0;
+    for (;;) {
+        size_t from = file->position + searched;
+        if (from < file->length) {
+            const char* end = (const char*)memchr(file->data + from, '\n', file->length - from);
+            if (end != NULL) {
+                Value line = takeBytes(file, (size_t)(end - (file->data + file->position)));
+                file->position++;
+                return line;
+            }
+        }
+
+        searched = file->length - file->position;
+        if (!fillFile(file)) {
+            break;
+        }
+    }
+
+    // Last line may not end with '\n'
+    if (file->position == file->length) {
+        return NIL_VAL;
+    }
+
+    return takeBytes(file, file->length - file->position);
+}
+
+Value readBlockNative(int argCount, Value* args)
+{
+    OpenFile* file = argCount == 2 ? fileArgument(args[0]) : NULL;
+    if (file == NULL || !IS_NUMBER(args[1]) || !(AS_NUMBER(args[1]) >= 1)) {
+        return NIL_VAL;
+    }
+
+    // Strings hold their length in an int
+    double requested = AS_NUMBER(args[1]);
+    size_t size = requested > INT32_MAX ? (size_t)INT32_MAX : (size_t)requested;
+
+    while (file->length - file->position < size && fillFile(file)) {
+    }
+
+    size_t available = file->length - file->position;
+    if (available == 0) {
+        return NIL_VAL;
+    }
+
+    return takeBytes(file, available < size ? available : size);
+}
+
+static void closeFile(OpenFile* file)
+{
+    if (file->isMapped) {
+        munmap(file->data, file->length);
+    } else {
+        free(file->data);
+        close(file->fd);
+    }
+
+    file->isOpen = false;
+    file->data = NULL;
+}
+
+Value closeFileNative(int argCount, Value* args)
+{
+    OpenFile* file = argCount == 1 ? fileArgument(args[0]) : NULL;
+    if (file == NULL) {
+        return BOOL_VAL(false);
+    }
+
+    closeFile(file);
+    return BOOL_VAL(true);
+}
+
+void closeFiles()
+{
+    for (int i = 0; i < fileCount; i++) {
+        if (files[i].isOpen) {
+            closeFile(&files[i]);
+        }
+    }
+
+    free(files);
+    files = NULL;
+    fileCount = 0;
+    fileCapacity = 0;
+}
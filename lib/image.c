@@ -0,0 +1,556 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./../include/image.h"
+#include "./../include/compiler.h"
+#include "./../include/memory.h"
+#include "./../include/serialize.h"
+#include "./../include/verifier.h"
+#include "./../include/vm.h"
+
+/*
+ Layout of an image
+
+    "LOXI" version string-count native-count object-count global-count
+    strings     length chars
+    natives     name, looked up among natives of VM when loading
+    types       OBJ_FUNCTION or OBJ_SWITCH of each other object
+    objects     contents of functions and switches
+    globals     key value
+
+ Objects are numbered strings first, then natives, then the others, and
+ refer to each other by these numbers. Values start with one of the tags
+ below, objects are followed by their number.
+*/
+
+typedef enum {
+    TAG_NIL,
+    TAG_FALSE,
+    TAG_TRUE,
+    TAG_NUMBER,
+    TAG_OBJECT
+} ValueTag;
+
+// Objects of one kind in order they are numbered
+typedef struct {
+    int count;
+    int capacity;
+    Obj** objects;
+} ObjectList;
+
+// Entry of table from object to its position in list of its kind
+typedef struct {
+    Obj* object;        // NULL for empty slot
+    int position;
+} ObjectSlot;
+
+typedef struct {
+    BinaryWriter file;
+    ObjectList strings;
+    ObjectList natives;
+    ObjectList others;
+
+    // Open addressing table of objects already collected, capacity is a power of 2
+    int slotCount;
+    int slotCapacity;
+    ObjectSlot* slots;
+} ImageWriter;
+
+static void initObjectList(ObjectList* list)
+{
+    list->count = 0;
+    list->capacity = 0;
+    list->objects = NULL;
+}
+
+static int addObject(ObjectList* list, Obj* object)
+{
+    if (list->capacity < list->count + 1) {
+        list->capacity = GROW_CAPACITY(list->capacity);
+        list->objects = (Obj**)realloc(list->objects, sizeof(Obj*) * list->capacity);
+        if (list->objects == NULL) {
+            fprintf(stderr, "Not enough memory for heap image.\n");
+            exit(74);
+        }
+    }
+
+    list->objects[list->count] = object;
+    return list->count++;
+}
+
+static ObjectSlot* findSlot(ObjectSlot* slots, int capacity, Obj* object)
+{
+    // Low bits of pointers are alignment, so they are shifted out
+    uintptr_t address = (uintptr_t)object;
+    uint32_t index = (uint32_t)((address >> 4) ^ (address >> 16)) & (capacity - 1);
+
+    for (;;) {
+        ObjectSlot* slot = &slots[index];
+        if (slot->object == object || slot->object == NULL) {
+            return slot;
+        }
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+// Records position of object, growing table when it is 3/4 full
+static void addSlot(ImageWriter* writer, Obj* object, int position)
+{
+    if ((writer->slotCount + 1) * 4 > writer->slotCapacity * 3) {
+        int capacity = writer->slotCapacity < 64 ? 64 : writer->slotCapacity * 2;
+        ObjectSlot* slots = (ObjectSlot*)calloc(capacity, sizeof(ObjectSlot));
+        if (slots == NULL) {
+            fprintf(stderr, "Not enough memory for heap image.\n");
+            exit(74);
+        }
+
+        for (int i = 0; i < writer->slotCapacity; i++) {
+            if (writer->slots[i].object != NULL) {
+                *findSlot(slots, capacity, writer->slots[i].object) = writer->slots[i];
+            }
+        }
+
+        free(writer->slots);
+        writer->slots = slots;
+        writer->slotCapacity = capacity;
+    }
+
+    ObjectSlot* slot = findSlot(writer->slots, writer->slotCapacity, object);
+    slot->object = object;
+    slot->position = position;
+    writer->slotCount++;
+}
+
+// Number of object in image
+static int objectNumber(ImageWriter* writer, Obj* object)
+{
+    int position = findSlot(writer->slots, writer->slotCapacity, object)->position;
+
+    switch (object->type) {
+        case OBJ_STRING: return position;
+        case OBJ_NATIVE: return writer->strings.count + position;
+        default: return writer->strings.count + writer->natives.count + position;
+    }
+}
+
+// COLLECTING
+
+static bool collectValue(ImageWriter* writer, Value value);
+
+// Numbers object and everything it refers to
+static bool collectObject(ImageWriter* writer, Obj* object)
+{
+    if (object == NULL) {
+        return true;
+    }
+
+    if (writer->slotCapacity > 0 &&
+        findSlot(writer->slots, writer->slotCapacity, object)->object == object) {
+        return true;
+    }
+
+    switch (object->type) {
+        case OBJ_STRING:
+            addSlot(writer, object, addObject(&writer->strings, object));
+            return true;
+
+        case OBJ_NATIVE:
+            addSlot(writer, object, addObject(&writer->natives, object));
+            return nativeName(((ObjNative*)object)->function) != NULL;
+
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            addSlot(writer, object, addObject(&writer->others, object));
+
+            // Image outlives source that skimmed bodies point into
+            if (function->lazySource != NULL && !compileLazyFunction(function)) {
+                return false;
+            }
+
+            bool collected = collectObject(writer, (Obj*)function->name);
+            for (int i = 0; i < function->chunk.constants.count && collected; i++) {
+                collected = collectValue(writer, function->chunk.constants.values[i]);
+            }
+            return collected;
+        }
+
+        case OBJ_SWITCH: {
+            ObjSwitch* jumpTable = (ObjSwitch*)object;
+            addSlot(writer, object, addObject(&writer->others, object));
+
+            for (int i = 0; i <= jumpTable->strings.capacity; i++) {
+                collectObject(writer, (Obj*)jumpTable->strings.entries[i].key);
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool collectValue(ImageWriter* writer, Value value)
+{
+    return !IS_OBJ(value) || collectObject(writer, AS_OBJ(value));
+}
+
+// WRITING
+
+static void writeValue(ImageWriter* writer, Value value)
+{
+    if (IS_NIL(value)) {
+        writeInt(&writer->file, TAG_NIL);
+    } else if (IS_BOOL(value)) {
+        writeInt(&writer->file, AS_BOOL(value) ? TAG_TRUE : TAG_FALSE);
+    } else if (IS_NUMBER(value)) {
+        writeInt(&writer->file, TAG_NUMBER);
+        writeDouble(&writer->file, AS_NUMBER(value));
+    } else {
+        writeInt(&writer->file, TAG_OBJECT);
+        writeInt(&writer->file, objectNumber(writer, AS_OBJ(value)));
+    }
+}
+
+static void writeFunction(ImageWriter* writer, ObjFunction* function)
+{
+    Chunk* chunk = &function->chunk;
+
+    writeInt(&writer->file, function->arity);
+    writeInt(&writer->file, function->name == NULL ? -1 : objectNumber(writer, (Obj*)function->name));
+
+    writeInt(&writer->file, chunk->count);
+    writeBytes(&writer->file, chunk->code, chunk->count);
+
+    writeInt(&writer->file, chunk->lineCount);
+    for (int i = 0; i < chunk->lineCount; i++) {
+        writeInt(&writer->file, chunk->lines[i].offset);
+        writeInt(&writer->file, chunk->lines[i].line);
+    }
+
+    writeInt(&writer->file, chunk->inlinedCount);
+    for (int i = 0; i < chunk->inlinedCount; i++) {
+        writeInt(&writer->file, chunk->inlined[i].line);
+        writeInt(&writer->file, chunk->inlined[i].name);
+        writeInt(&writer->file, chunk->inlined[i].callLine);
+    }
+
+    writeInt(&writer->file, chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        writeValue(writer, chunk->constants.values[i]);
+    }
+}
+
+static void writeSwitch(ImageWriter* writer, ObjSwitch* jumpTable)
+{
+    writeInt(&writer->file, jumpTable->low);
+    writeInt(&writer->file, jumpTable->count);
+    for (int i = 0; i < jumpTable->count; i++) {
+        writeInt(&writer->file, jumpTable->distances[i]);
+    }
+    writeInt(&writer->file, jumpTable->defaultDistance);
+
+    int stringCount = 0;
+    for (int i = 0; i <= jumpTable->strings.capacity; i++) {
+        if (jumpTable->strings.entries[i].key != NULL) {
+            stringCount++;
+        }
+    }
+
+    writeInt(&writer->file, stringCount);
+    for (int i = 0; i <= jumpTable->strings.capacity; i++) {
+        Entry* entry = &jumpTable->strings.entries[i];
+        if (entry->key != NULL) {
+            writeInt(&writer->file, objectNumber(writer, (Obj*)entry->key));
+            writeInt(&writer->file, (int)AS_NUMBER(entry->value));
+        }
+    }
+}
+
+bool saveImage(const char* path)
+{
+    ImageWriter writer;
+    initObjectList(&writer.strings);
+    initObjectList(&writer.natives);
+    initObjectList(&writer.others);
+    writer.slotCount = 0;
+    writer.slotCapacity = 0;
+    writer.slots = NULL;
+
+    int globalCount = 0;
+    bool collected = true;
+    for (int i = 0; i <= vm.globals.capacity && collected; i++) {
+        Entry* entry = &vm.globals.entries[i];
+        if (entry->key != NULL) {
+            globalCount++;
+            collected = collectObject(&writer, (Obj*)entry->key) && collectValue(&writer, entry->value);
+        }
+    }
+
+    bool saved = collected && beginFile(&writer.file, path);
+    if (saved) {
+        writeBytes(&writer.file, "LOXI", 4);
+        writeInt(&writer.file, IMAGE_VERSION);
+        writeInt(&writer.file, writer.strings.count);
+        writeInt(&writer.file, writer.natives.count);
+        writeInt(&writer.file, writer.others.count);
+        writeInt(&writer.file, globalCount);
+
+        for (int i = 0; i < writer.strings.count; i++) {
+            writeString(&writer.file, (ObjString*)writer.strings.objects[i]);
+        }
+
+        for (int i = 0; i < writer.natives.count; i++) {
+            const char* name = nativeName(((ObjNative*)writer.natives.objects[i])->function);
+            writeInt(&writer.file, (int)strlen(name));
+            writeBytes(&writer.file, name, strlen(name));
+        }
+
+        for (int i = 0; i < writer.others.count; i++) {
+            writeInt(&writer.file, writer.others.objects[i]->type);
+        }
+
+        for (int i = 0; i < writer.others.count; i++) {
+            Obj* object = writer.others.objects[i];
+            if (object->type == OBJ_FUNCTION) {
+                writeFunction(&writer, (ObjFunction*)object);
+            } else {
+                writeSwitch(&writer, (ObjSwitch*)object);
+            }
+        }
+
+        for (int i = 0; i <= vm.globals.capacity; i++) {
+            Entry* entry = &vm.globals.entries[i];
+            if (entry->key != NULL) {
+                writeInt(&writer.file, objectNumber(&writer, (Obj*)entry->key));
+                writeValue(&writer, entry->value);
+            }
+        }
+
+        saved = endFile(&writer.file, path);
+    }
+
+    free(writer.strings.objects);
+    free(writer.natives.objects);
+    free(writer.others.objects);
+    free(writer.slots);
+    return saved;
+}
+
+// READING
+
+typedef struct {
+    BinaryReader file;
+    Obj** objects;      // Every object of image by its number
+    int objectCount;
+} ImageReader;
+
+// NULL if number is out of range or object has other type
+static Obj* objectAt(ImageReader* reader, int number, ObjType type)
+{
+    if (number < 0 || number >= reader->objectCount || reader->objects[number]->type != type) {
+        reader->file.failed = true;
+        return NULL;
+    }
+
+    return reader->objects[number];
+}
+
+static Value readValue(ImageReader* reader)
+{
+    switch (readInt(&reader->file)) {
+        case TAG_NIL: return NIL_VAL;
+        case TAG_FALSE: return BOOL_VAL(false);
+        case TAG_TRUE: return BOOL_VAL(true);
+        case TAG_NUMBER: return NUMBER_VAL(readDouble(&reader->file));
+
+        case TAG_OBJECT: {
+            int number = readInt(&reader->file);
+            if (number >= 0 && number < reader->objectCount) {
+                return OBJ_VAL(reader->objects[number]);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    reader->file.failed = true;
+    return NIL_VAL;
+}
+
+static void readFunction(ImageReader* reader, ObjFunction* function)
+{
+    Chunk* chunk = &function->chunk;
+
+    function->arity = readInt(&reader->file);
+
+    // Script has no name
+    int name = readInt(&reader->file);
+    if (name != -1) {
+        function->name = (ObjString*)objectAt(reader, name, OBJ_STRING);
+    }
+
+    int codeCount = readCount(&reader->file);
+    const uint8_t* code = readBytes(&reader->file, codeCount);
+    if (code == NULL) {
+        return;
+    }
+    chunk->code = ALLOCATE(uint8_t, codeCount);
+    chunk->capacity = codeCount;
+    chunk->count = codeCount;
+    memcpy(chunk->code, code, codeCount);
+
+    int lineCount = readCount(&reader->file);
+    chunk->lines = ALLOCATE(LineStart, lineCount);
+    chunk->lineCapacity = lineCount;
+    chunk->lineCount = lineCount;
+    for (int i = 0; i < lineCount; i++) {
+        chunk->lines[i].offset = readInt(&reader->file);
+        chunk->lines[i].line = readInt(&reader->file);
+    }
+
+    int inlinedCount = readCount(&reader->file);
+    chunk->inlined = ALLOCATE(InlinedLine, inlinedCount);
+    chunk->inlinedCapacity = inlinedCount;
+    chunk->inlinedCount = inlinedCount;
+    for (int i = 0; i < inlinedCount; i++) {
+        chunk->inlined[i].line = readInt(&reader->file);
+        chunk->inlined[i].name = readInt(&reader->file);
+        chunk->inlined[i].callLine = readInt(&reader->file);
+    }
+
+    int constantCount = readCount(&reader->file);
+    for (int i = 0; i < constantCount && !reader->file.failed; i++) {
+        addConstant(chunk, readValue(reader));
+    }
+}
+
+static void readSwitch(ImageReader* reader, ObjSwitch* jumpTable)
+{
+    jumpTable->low = readInt(&reader->file);
+    int count = readCount(&reader->file);
+    jumpTable->distances = ALLOCATE(int, count);
+    jumpTable->count = count;
+    for (int i = 0; i < count; i++) {
+        jumpTable->distances[i] = readInt(&reader->file);
+    }
+    jumpTable->defaultDistance = readInt(&reader->file);
+
+    int stringCount = readCount(&reader->file);
+    for (int i = 0; i < stringCount && !reader->file.failed; i++) {
+        ObjString* key = (ObjString*)objectAt(reader, readInt(&reader->file), OBJ_STRING);
+        int distance = readInt(&reader->file);
+        if (key != NULL) {
+            tableSet(&jumpTable->strings, key, NUMBER_VAL((double)distance));
+        }
+    }
+}
+
+bool loadImage(const char* path)
+{
+    ImageReader reader;
+    if (!mapFile(&reader.file, path)) {
+        return false;
+    }
+
+    const uint8_t* magic = readBytes(&reader.file, 4);
+    int version = readInt(&reader.file);
+    int stringCount = readCount(&reader.file);
+    int nativeCount = readCount(&reader.file);
+    int otherCount = readCount(&reader.file);
+    int globalCount = readCount(&reader.file);
+
+    if (reader.file.failed || memcmp(magic, "LOXI", 4) != 0 || version != IMAGE_VERSION) {
+        unmapFile(&reader.file);
+        return false;
+    }
+
+    // Nothing is reachable from roots until globals are defined at the end
+    bool canCollect = vm.heap.canCollect;
+    vm.heap.canCollect = false;
+
+    reader.objectCount = stringCount + nativeCount + otherCount;
+    reader.objects = (Obj**)malloc(sizeof(Obj*) * (reader.objectCount + 1));
+    Value* globals = (Value*)malloc(sizeof(Value) * (globalCount * 2 + 1));
+    if (reader.objects == NULL || globals == NULL) {
+        fprintf(stderr, "Not enough memory for heap image.\n");
+        exit(74);
+    }
+
+    int created = 0;
+    for (int i = 0; i < stringCount && !reader.file.failed; i++) {
+        ObjString* string = readString(&reader.file);
+        if (string == NULL) {
+            reader.file.failed = true;
+            break;
+        }
+        reader.objects[created++] = (Obj*)string;
+    }
+
+    for (int i = 0; i < nativeCount && !reader.file.failed; i++) {
+        int length = readCount(&reader.file);
+        const uint8_t* name = readBytes(&reader.file, length);
+        NativeFn function = name == NULL ? NULL : findNative((const char*)name, length);
+        if (function == NULL) {
+            reader.file.failed = true;
+            break;
+        }
+        reader.objects[created++] = (Obj*)newNative(function);
+    }
+
+    for (int i = 0; i < otherCount && !reader.file.failed; i++) {
+        int type = readInt(&reader.file);
+        if (type == OBJ_FUNCTION) {
+            reader.objects[created++] = (Obj*)newFunction();
+        } else if (type == OBJ_SWITCH) {
+            reader.objects[created++] = (Obj*)newSwitch();
+        } else {
+            reader.file.failed = true;
+        }
+    }
+
+    // Numbers of objects turn into pointers while contents are filled in
+    for (int i = stringCount + nativeCount; i < created && !reader.file.failed; i++) {
+        if (reader.objects[i]->type == OBJ_FUNCTION) {
+            readFunction(&reader, (ObjFunction*)reader.objects[i]);
+        } else {
+            readSwitch(&reader, (ObjSwitch*)reader.objects[i]);
+        }
+    }
+
+    for (int i = 0; i < globalCount && !reader.file.failed; i++) {
+        Obj* key = objectAt(&reader, readInt(&reader.file), OBJ_STRING);
+        globals[i * 2] = key == NULL ? NIL_VAL : OBJ_VAL(key);
+        globals[i * 2 + 1] = readValue(&reader);
+    }
+
+    bool valid = !reader.file.failed && created == reader.objectCount &&
+        reader.file.position == reader.file.length;
+    for (int i = stringCount + nativeCount; i < created && valid; i++) {
+        if (reader.objects[i]->type == OBJ_FUNCTION) {
+            valid = verifyFunction((ObjFunction*)reader.objects[i]) == NULL;
+        }
+    }
+
+    if (valid) {
+        // Functions of prelude live till the end of program
+        for (int i = stringCount + nativeCount; i < created; i++) {
+            if (reader.objects[i]->type == OBJ_FUNCTION) {
+                makePermanent(reader.objects[i]);
+            }
+        }
+
+        for (int i = 0; i < globalCount; i++) {
+            tableSet(&vm.globals, AS_STRING(globals[i * 2]), globals[i * 2 + 1]);
+        }
+    }
+
+    vm.heap.canCollect = canCollect;
+
+    free(reader.objects);
+    free(globals);
+    unmapFile(&reader.file);
+    return valid;
+}
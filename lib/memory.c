@@ -11,6 +11,36 @@
 
 #define GC_HEAP_GROW_FACTOR 2
 
+thread_local Heap* currentHeap = &vm.heap;
+
+void initHeap(Heap* heap)
+{
+    heap->objects = NULL;
+    heap->permanent = NULL;
+    initTable(&heap->strings);
+
+    heap->bytesAllocated = 0;
+    heap->nextGC = 10;
+    // heap->nextGC = 1024 * 1024;
+
+    heap->canCollect = false;
+}
+
+void protectValue(Value value)
+{
+    // Objects on stack are roots for garbage collector
+    if (currentHeap->canCollect) {
+        push(value);
+    }
+}
+
+void unprotectValue()
+{
+    if (currentHeap->canCollect) {
+        pop();
+    }
+}
+
 void markTable(Table* table)
 {
     for (int i = 0; i <= table->capacity; i++) {
@@ -107,6 +137,10 @@ static void blackenObject(Obj* object)
             break;
         }
 
+        case OBJ_SWITCH:
+            markTable(&((ObjSwitch*)object)->strings);
+            break;
+
         case OBJ_NATIVE:
         case OBJ_STRING:
             break;
@@ -117,10 +151,24 @@ static void blackenObject(Obj* object)
 static void sweep()
 {
     Obj* previous = NULL;
-    Obj* object = vm.objects;
+    Obj* object = vm.heap.objects;
 
     while (object != NULL) {
-        if (object->isMarked) {
+        if (object->isPermanent) {
+            // Unlinked from objects to be collected and never visited again
+            Obj* permanent = object;
+
+            object = object->next;
+
+            if (previous != NULL) {
+                previous->next = object;
+            } else {
+                vm.heap.objects = object;
+            }
+
+            permanent->next = vm.heap.permanent;
+            vm.heap.permanent = permanent;
+        } else if (object->isMarked) {
             object->isMarked = false;
             previous = object;
             object = object->next;
@@ -134,7 +182,7 @@ static void sweep()
             if (previous != NULL) {
                 previous->next = object;
             } else {
-                vm.objects = object;
+                vm.heap.objects = object;
             }
 
             freeObject(unreached);
@@ -156,13 +204,50 @@ static void traceReferences()
     // Every object in the heap is now either black or white
 }
 
+void makePermanent(Obj* object)
+{
+    if (object == NULL || object->isPermanent) {
+        return;
+    }
+
+    object->isPermanent = true;
+    object->isMarked = true;
+
+    switch (object->type) {
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            makePermanent((Obj*)function->name);
+
+            ValueArray* constants = &function->chunk.constants;
+            for (int i = 0; i < constants->count; i++) {
+                if (IS_OBJ(constants->values[i])) {
+                    makePermanent(AS_OBJ(constants->values[i]));
+                }
+            }
+            break;
+        }
+
+        case OBJ_SWITCH: {
+            Table* strings = &((ObjSwitch*)object)->strings;
+            for (int i = 0; i <= strings->capacity; i++) {
+                makePermanent((Obj*)strings->entries[i].key);
+            }
+            break;
+        }
+
+        case OBJ_NATIVE:
+        case OBJ_STRING:
+            break;
+    }
+}
+
 // Garbage collecting memory based on Mark Sweep Garbage Collection
 void collectGarbage()
 {
 #ifdef DEBUG_LOG_GC
     printf("--gc begin\n");
 
-    size_t before = vm.bytesAllocated;
+    size_t before = vm.heap.bytesAllocated;
 #endif
 
     markRoots();
@@ -170,31 +255,31 @@ void collectGarbage()
 
     // Strings are special case since interning of strings was implemented
     // Removing Dangling pointers from table of ObjString freed by Garbage Collectors
-    tableRemoveWhite(&vm.strings);
+    tableRemoveWhite(&vm.heap.strings);
 
     sweep();
 
-    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    vm.heap.nextGC = vm.heap.bytesAllocated * GC_HEAP_GROW_FACTOR;
 
 #ifdef DEBUG_LOG_GC
     printf("--gc end\n");
 
     printf("    collected %ld bytes (from %ld to %ld) next at %ld\n",
-        before - vm.bytesAllocated, before, vm.bytesAllocated, vm.nextGC
+        before - vm.heap.bytesAllocated, before, vm.heap.bytesAllocated, vm.heap.nextGC
     );
 #endif
 }
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize)
 {
-    vm.bytesAllocated += newSize - oldSize;
+    currentHeap->bytesAllocated += newSize - oldSize;
 
-    if (newSize > oldSize) {
+    if (newSize > oldSize && currentHeap->canCollect) {
     #ifdef DEBUG_STRESS_GC
         collectGarbage();
     #endif
 
-        if (vm.bytesAllocated > vm.nextGC) {
+        if (currentHeap->bytesAllocated > currentHeap->nextGC) {
             collectGarbage();
         }
     }
@@ -214,4 +299,103 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize)
     }
 
     return result;
+}
+
+// Finds string interned by VM which has same contents
+// Stores it as the value of the entry in heap's own interning table
+static void mergeString(Heap* heap, ObjString* string)
+{
+    ObjString* interned = tableFindString(
+        &vm.heap.strings, string->chars, string->length, string->hash
+    );
+
+    if (interned != NULL) {
+        tableSet(&heap->strings, string, OBJ_VAL(interned));
+    } else {
+        tableSet(&vm.heap.strings, string, NIL_VAL);
+    }
+}
+
+// Returns the string VM uses for given string of other heap
+static Value canonicalString(Heap* heap, Value value)
+{
+    Value interned;
+    if (IS_STRING(value) &&
+        tableGet(&heap->strings, AS_STRING(value), &interned) &&
+        !IS_NIL(interned)) {
+        return interned;
+    }
+
+    return value;
+}
+
+void adoptHeap(Heap* heap)
+{
+    // Objects of heap are not reachable from roots until merging is done
+    bool canCollect = vm.heap.canCollect;
+    vm.heap.canCollect = false;
+
+    Heap* previous = currentHeap;
+    currentHeap = &vm.heap;
+    vm.heap.bytesAllocated += heap->bytesAllocated;
+
+    for (Obj* object = heap->objects; object != NULL; object = object->next) {
+        if (object->type == OBJ_STRING) {
+            mergeString(heap, (ObjString*)object);
+        }
+    }
+
+    // Pointing functions to strings interned by VM
+    for (Obj* object = heap->objects; object != NULL; object = object->next) {
+        if (object->type == OBJ_FUNCTION) {
+            ObjFunction* function = (ObjFunction*)object;
+
+            if (function->name != NULL) {
+                function->name = AS_STRING(canonicalString(heap, OBJ_VAL(function->name)));
+            }
+
+            ValueArray* constants = &function->chunk.constants;
+            for (int i = 0; i < constants->count; i++) {
+                constants->values[i] = canonicalString(heap, constants->values[i]);
+            }
+        } else if (object->type == OBJ_SWITCH) {
+            // Keys are hashed by pointer, so table is filled again
+            ObjSwitch* jumpTable = (ObjSwitch*)object;
+            Table strings;
+            initTable(&strings);
+
+            for (int i = 0; i <= jumpTable->strings.capacity; i++) {
+                Entry* entry = &jumpTable->strings.entries[i];
+                if (entry->key != NULL) {
+                    Value key = canonicalString(heap, OBJ_VAL(entry->key));
+                    tableSet(&strings, AS_STRING(key), entry->value);
+                }
+            }
+
+            freeTable(&jumpTable->strings);
+            jumpTable->strings = strings;
+        }
+    }
+
+    // Linking objects into VM's list and freeing duplicate strings
+    Obj* object = heap->objects;
+    while (object != NULL) {
+        Obj* next = object->next;
+
+        if (AS_OBJ(canonicalString(heap, OBJ_VAL(object))) != object) {
+            freeObject(object);
+        } else {
+            object->next = vm.heap.objects;
+            vm.heap.objects = object;
+        }
+
+        object = next;
+    }
+
+    freeTable(&heap->strings);
+    heap->objects = NULL;
+    heap->bytesAllocated = 0;
+
+    currentHeap = previous;
+    vm.heap.canCollect = canCollect;
 }
\ No newline at end of file
@@ -16,10 +16,11 @@ static Obj* allocateObject(size_t size, ObjType type)
     Obj* object = (Obj*)reallocate(NULL, 0, size);
     object->type = type;
     object->isMarked = false;
+    object->isPermanent = false;
 
     // no need to maintain tail pointer this way
-    object->next = vm.objects;
-    vm.objects = object;
+    object->next = currentHeap->objects;
+    currentHeap->objects = object;
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %ld for %d\n", (void*)object, size, type);
@@ -29,7 +30,7 @@ static Obj* allocateObject(size_t size, ObjType type)
 }
 
 // Calculates hash for a string based on FNV-1a hash function
-static uint32_t hashString(const char* key, int length)
+uint32_t hashString(const char* key, int length)
 {
     uint32_t hash = 2166136261u;
 
@@ -51,13 +52,13 @@ static ObjString* allocateString(char* chars, int length, uint32_t hash)
 
     // Temporarily pushing string to stack
     // to prevent the bug of resizing and calling GC at same time
-    push(OBJ_VAL(string));
+    protectValue(OBJ_VAL(string));
 
     // Whenever we create a new unique string, 
-    // we add it to VM string interning table
-    tableSet(&vm.strings, string, NIL_VAL);
+    // we add it to heap's string interning table
+    tableSet(&currentHeap->strings, string, NIL_VAL);
 
-    pop();
+    unprotectValue();
     
 
     return string;
@@ -66,7 +67,7 @@ static ObjString* allocateString(char* chars, int length, uint32_t hash)
 ObjString* takeString(char* chars, int length)
 {
     uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString* interned = tableFindString(&currentHeap->strings, chars, length, hash);
 
     // If string already exists
     // We free the duplicate string
@@ -83,8 +84,8 @@ ObjString* copyString(const char* chars, int length)
     uint32_t hash = hashString(chars, length);
 
     // Only creating string if it does not exist in 
-    // interning table of VM
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    // interning table of heap
+    ObjString* interned = tableFindString(&currentHeap->strings, chars, length, hash);
 
     if (interned != NULL) {
         return interned;
@@ -125,6 +126,10 @@ void printObject(Value value)
             printf("<native fn>");
             break;
 
+        case OBJ_SWITCH:
+            printf("<switch>");
+            break;
+
         default:
             break;
     }
@@ -136,6 +141,10 @@ ObjFunction* newFunction()
 
     function->arity = 0;
     function->name = NULL;
+    function->maxStack = 0;
+    function->aot = NULL;
+    function->lazySource = NULL;
+    function->lazyLine = 0;
     initChunk(&function->chunk);
     return function;
 }
@@ -145,4 +154,15 @@ ObjNative* newNative(NativeFn function)
     ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
     native->function = function;
     return native;
+}
+
+ObjSwitch* newSwitch()
+{
+    ObjSwitch* jumpTable = ALLOCATE_OBJ(ObjSwitch, OBJ_SWITCH);
+    jumpTable->low = 0;
+    jumpTable->count = 0;
+    jumpTable->distances = NULL;
+    initTable(&jumpTable->strings);
+    jumpTable->defaultDistance = 0;
+    return jumpTable;
 }
\ No newline at end of file
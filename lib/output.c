@@ -0,0 +1,229 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./../include/output.h"
+#include "./../include/object.h"
+
+void initOutput(Output* output, size_t capacity, FlushPolicy policy)
+{
+    output->data = NULL;
+    output->length = 0;
+    output->capacity = 0;
+    output->policy = policy;
+
+    resizeOutput(output, capacity);
+}
+
+void freeOutput(Output* output)
+{
+    flushOutput(output);
+    free(output->data);
+    output->data = NULL;
+    output->capacity = 0;
+}
+
+void resizeOutput(Output* output, size_t capacity)
+{
+    flushOutput(output);
+
+    output->capacity = capacity < 1 ? 1 : capacity;
+    output->data = (char*)realloc(output->data, output->capacity);
+    if (output->data == NULL) {
+        fprintf(stderr, "Not enough memory for output buffer.\n");
+        exit(74);
+    }
+}
+
+void flushOutput(Output* output)
+{
+    if (output->length == 0) {
+        return;
+    }
+
+    fwrite(output->data, 1, output->length, stdout);
+    output->length = 0;
+
+    if (output->policy == FLUSH_EACH_LINE) {
+        fflush(stdout);
+    }
+}
+
+void writeOutput(Output* output, const char* chars, size_t length)
+{
+    if (output->capacity - output->length < length) {
+        flushOutput(output);
+
+        // Text that does not fit at all skips buffer
+        if (length > output->capacity) {
+            fwrite(chars, 1, length, stdout);
+            return;
+        }
+    }
+
+    memcpy(output->data + output->length, chars, length);
+    output->length += length;
+}
+
+static void endLine(Output* output)
+{
+    writeOutput(output, "\n", 1);
+
+    if (output->policy == FLUSH_EACH_LINE) {
+        flushOutput(output);
+    }
+}
+
+static void writeObject(Output* output, Obj* object)
+{
+    switch (object->type) {
+        case OBJ_STRING: {
+            ObjString* string = (ObjString*)object;
+            writeOutput(output, string->chars, string->length);
+            break;
+        }
+
+        case OBJ_FUNCTION: {
+            ObjString* name = ((ObjFunction*)object)->name;
+            if (name == NULL) {
+                writeOutput(output, "<script>", 8);
+            } else {
+                writeOutput(output, "<fn ", 4);
+                writeOutput(output, name->chars, name->length);
+                writeOutput(output, ">", 1);
+            }
+            break;
+        }
+
+        case OBJ_NATIVE:
+            writeOutput(output, "<native fn>", 11);
+            break;
+
+        case OBJ_SWITCH:
+            writeOutput(output, "<switch>", 8);
+            break;
+    }
+}
+
+void writeLine(Output* output, Value value)
+{
+    switch (value.type) {
+        case VAL_BOOL:
+            if (AS_BOOL(value)) {
+                writeOutput(output, "true", 4);
+            } else {
+                writeOutput(output, "false", 5);
+            }
+            break;
+
+        case VAL_NIL:
+            writeOutput(output, "nil", 3);
+            break;
+
+        case VAL_NUMBER: {
+            char text[32];
+            writeOutput(output, text, (size_t)formatNumber(AS_NUMBER(value), text));
+            break;
+        }
+
+        case VAL_OBJ:
+            writeObject(output, AS_OBJ(value));
+            break;
+    }
+
+    endLine(output);
+}
+
+void writeTextLine(Output* output, const char* chars, size_t length)
+{
+    writeOutput(output, chars, length);
+    endLine(output);
+}
+
+// Powers of ten up to where a double still holds them exactly
+static const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+// Writes digits of value right aligned in count places, leading zeros included
+static void writeDigits(char* end, uint32_t value, int count)
+{
+    for (int i = 0; i < count; i++) {
+        *--end = (char)('0' + value % 10);
+        value /= 10;
+    }
+}
+
+static int countDigits(uint32_t value)
+{
+    int count = 1;
+    while (value >= 10) {
+        value /= 10;
+        count++;
+    }
+
+    return count;
+}
+
+// Writes scaled / 10^places with exactly that many digits after point
+static int writeFixed(char* buffer, bool negative, double scaled, int places)
+{
+    uint32_t unit = (uint32_t)powersOfTen[places];
+    uint32_t whole = (uint32_t)scaled / unit;
+    uint32_t fraction = (uint32_t)scaled % unit;
+
+    int length = 0;
+    if (negative) {
+        buffer[length++] = '-';
+    }
+
+    int wholeDigits = countDigits(whole);
+    writeDigits(buffer + length + wholeDigits, whole, wholeDigits);
+    length += wholeDigits;
+
+    if (places > 0) {
+        buffer[length++] = '.';
+        writeDigits(buffer + length + places, fraction, places);
+        length += places;
+    }
+
+    buffer[length] = '\0';
+    return length;
+}
+
+int formatNumber(double number, char* buffer)
+{
+    if (number == 0) {
+        strcpy(buffer, signbit(number) ? "-0" : "0");
+        return (int)strlen(buffer);
+    }
+
+    // %g writes numbers outside this range with an exponent
+    double magnitude = fabs(number);
+    if (magnitude >= 1e-4 && magnitude < 1e6) {
+        // Fewest digits after point that read back as the same double
+        // Dividing two exactly held integers rounds correctly, so the check is exact
+        for (int places = 0; places <= 9; places++) {
+            double scaled = nearbyint(magnitude * powersOfTen[places]);
+            if (scaled >= 1e6) {
+                // Needs more than 6 significant digits, which %g rounds
+                break;
+            }
+
+            if (scaled / powersOfTen[places] == magnitude) {
+                return writeFixed(buffer, number < 0, scaled, places);
+            }
+        }
+
+        // Six whole digits are rounded to a whole number, which needs no scaling and so matches %g exactly
+        if (magnitude >= 1e5) {
+            double whole = nearbyint(magnitude);
+            if (whole < 1e6) {
+                return writeFixed(buffer, number < 0, whole, 0);
+            }
+        }
+    }
+
+    return snprintf(buffer, 32, "%g", number);
+}
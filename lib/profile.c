@@ -0,0 +1,250 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "./../include/profile.h"
+
+void initProfile(BranchProfile* profile)
+{
+    profile->count = 0;
+    profile->capacity = 0;
+    profile->entries = NULL;
+}
+
+void freeProfile(BranchProfile* profile)
+{
+    free(profile->entries);
+    initProfile(profile);
+}
+
+// First slot to probe for site
+static uint32_t siteSlot(uint32_t site, int capacity)
+{
+    // Sites of consecutive lines differ in high bits, so they are mixed down first
+    return (site ^ (site >> 8)) & (capacity - 1);
+}
+
+static BranchCount* findEntry(BranchCount* entries, int capacity, uint32_t site)
+{
+    uint32_t index = siteSlot(site, capacity);
+
+    for (;;) {
+        BranchCount* entry = &entries[index];
+
+        if (entry->site == site || entry->site == 0) {
+            return entry;
+        }
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void growProfile(BranchProfile* profile)
+{
+    int capacity = profile->capacity < 8 ? 8 : profile->capacity * 2;
+    BranchCount* entries = (BranchCount*)calloc(capacity, sizeof(BranchCount));
+
+    if (entries == NULL) {
+        fprintf(stderr, "Not enough memory for branch profile.\n");
+        exit(74);
+    }
+
+    for (int i = 0; i < profile->capacity; i++) {
+        if (profile->entries[i].site != 0) {
+            *findEntry(entries, capacity, profile->entries[i].site) = profile->entries[i];
+        }
+    }
+
+    free(profile->entries);
+    profile->entries = entries;
+    profile->capacity = capacity;
+}
+
+BranchCount* profileEntry(BranchProfile* profile, uint32_t site)
+{
+    // Keeping load factor at most half
+    if ((profile->count + 1) * 2 > profile->capacity) {
+        growProfile(profile);
+    }
+
+    BranchCount* entry = findEntry(profile->entries, profile->capacity, site);
+    if (entry->site == 0) {
+        entry->site = site;
+        profile->count++;
+    }
+
+    return entry;
+}
+
+BranchCount* findProfileEntry(BranchProfile* profile, uint32_t site)
+{
+    if (profile->count == 0) {
+        return NULL;
+    }
+
+    BranchCount* entry = findEntry(profile->entries, profile->capacity, site);
+    return entry->site == 0 ? NULL : entry;
+}
+
+bool saveProfile(BranchProfile* profile, const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < profile->capacity; i++) {
+        BranchCount* entry = &profile->entries[i];
+
+        if (entry->site != 0) {
+            fprintf(
+                file, "%u %u %" PRIu64 " %" PRIu64 "\n",
+                entry->site >> 8, entry->site & 0xff,
+                entry->trueCount, entry->falseCount
+            );
+        }
+    }
+
+    return fclose(file) == 0;
+}
+
+bool loadProfile(BranchProfile* profile, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+
+    unsigned line, index;
+    uint64_t trueCount, falseCount;
+
+    while (fscanf(file, "%u %u %" SCNu64 " %" SCNu64, &line, &index, &trueCount, &falseCount) == 4) {
+        // Counts of several runs add up
+        BranchCount* entry = profileEntry(profile, PROFILE_SITE(line, index));
+        entry->trueCount += trueCount;
+        entry->falseCount += falseCount;
+    }
+
+    bool valid = feof(file);
+    fclose(file);
+    return valid;
+}
+
+void initTypeProfile(TypeProfile* profile)
+{
+    profile->count = 0;
+    profile->capacity = 0;
+    profile->entries = NULL;
+}
+
+void freeTypeProfile(TypeProfile* profile)
+{
+    free(profile->entries);
+    initTypeProfile(profile);
+}
+
+static TypeSite* findTypeEntry(TypeSite* entries, int capacity, uint32_t site)
+{
+    uint32_t index = siteSlot(site, capacity);
+
+    for (;;) {
+        TypeSite* entry = &entries[index];
+
+        if (entry->site == site || entry->site == 0) {
+            return entry;
+        }
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void growTypeProfile(TypeProfile* profile)
+{
+    int capacity = profile->capacity < 8 ? 8 : profile->capacity * 2;
+    TypeSite* entries = (TypeSite*)calloc(capacity, sizeof(TypeSite));
+
+    if (entries == NULL) {
+        fprintf(stderr, "Not enough memory for type profile.\n");
+        exit(74);
+    }
+
+    for (int i = 0; i < profile->capacity; i++) {
+        if (profile->entries[i].site != 0) {
+            *findTypeEntry(entries, capacity, profile->entries[i].site) = profile->entries[i];
+        }
+    }
+
+    free(profile->entries);
+    profile->entries = entries;
+    profile->capacity = capacity;
+}
+
+TypeSite* typeProfileEntry(TypeProfile* profile, uint32_t site)
+{
+    if ((profile->count + 1) * 2 > profile->capacity) {
+        growTypeProfile(profile);
+    }
+
+    TypeSite* entry = findTypeEntry(profile->entries, profile->capacity, site);
+    if (entry->site == 0) {
+        entry->site = site;
+        profile->count++;
+    }
+
+    return entry;
+}
+
+TypeSite* findTypeProfileEntry(TypeProfile* profile, uint32_t site)
+{
+    if (profile->count == 0) {
+        return NULL;
+    }
+
+    TypeSite* entry = findTypeEntry(profile->entries, profile->capacity, site);
+    return entry->site == 0 ? NULL : entry;
+}
+
+bool saveTypeProfile(TypeProfile* profile, const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < profile->capacity; i++) {
+        TypeSite* entry = &profile->entries[i];
+
+        if (entry->site != 0) {
+            fprintf(
+                file, "%u %u %u %u %u %u\n",
+                entry->site >> 8, entry->site & 0xff,
+                entry->seen[0], entry->seen[1], entry->seen[2], entry->seen[3]
+            );
+        }
+    }
+
+    return fclose(file) == 0;
+}
+
+bool loadTypeProfile(TypeProfile* profile, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+
+    unsigned line, index;
+    unsigned seen[TYPE_OPERANDS];
+
+    while (fscanf(file, "%u %u %u %u %u %u", &line, &index, &seen[0], &seen[1], &seen[2], &seen[3]) == 6) {
+        // Kinds seen over several runs add up
+        TypeSite* entry = typeProfileEntry(profile, PROFILE_SITE(line, index));
+        for (int i = 0; i < TYPE_OPERANDS; i++) {
+            entry->seen[i] |= (uint8_t)seen[i];
+        }
+    }
+
+    bool valid = feof(file);
+    fclose(file);
+    return valid;
+}
@@ -3,74 +3,75 @@
 
 #include "./../include/common.h"
 #include "./../include/scanner.h"
+#include "./../include/object.h"
 
-Scanner scanner;
-
-static bool isAtEnd()
+static bool isAtEnd(Scanner* scanner)
 {
-    return *scanner.current == '\0';
+    return *scanner->current == '\0';
 }
 
 // Creates token based on start and current pointers in Scanner
-static Token makeToken(TokenType type)
+static Token makeToken(Scanner* scanner, TokenType type)
 {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (int)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (int)(scanner->current - scanner->start);
+    token.line = scanner->line;
+    token.hash = 0;
 
     return token;
 }
 
 // Creates error token with message as lexeme
-static Token errorToken(const char* message)
+static Token errorToken(Scanner* scanner, const char* message)
 {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = message;
     token.length = (int)strlen(message);
-    token.line = scanner.line;
+    token.line = scanner->line;
+    token.hash = 0;
 
     return token;
 }
 
 // Returns current character with advancing the current pointer 
-static char advance()
+static char advance(Scanner* scanner)
 {
-    scanner.current++;
-    return scanner.current[-1];
+    scanner->current++;
+    return scanner->current[-1];
 }
 
 // Returns current character without consuming
-static char peek()
+static char peek(Scanner* scanner)
 {
-    return *scanner.current;
+    return *scanner->current;
 }
 
 // Returns one look ahead character
-static char peekNext()
+static char peekNext(Scanner* scanner)
 {
-    if (isAtEnd()) {
+    if (isAtEnd(scanner)) {
         return '\0';
     }
 
-    return scanner.current[1];
+    return scanner->current[1];
 }
 
 // Matches current character with expected character
 // Only advances if expected character matches
-static bool match(char expected)
+static bool match(Scanner* scanner, char expected)
 {
-    if (isAtEnd()) {
+    if (isAtEnd(scanner)) {
         return false;
     }
 
-    if (*scanner.current != expected) {
+    if (*scanner->current != expected) {
         return false;
     }
 
-    scanner.current++;
+    scanner->current++;
     return true;
 }
 
@@ -86,11 +87,11 @@ static bool isAlpha(char c)
              c == '_';
 }
 
-static TokenType checkKeyword(int start, int length, const char* rest, TokenType type)
+static TokenType checkKeyword(Scanner* scanner, int start, int length, const char* rest, TokenType type)
 {
     if (
-        scanner.current - scanner.start == start + length &&    // Verifying the length of lexeme and keyword
-        memcmp(scanner.start + start, rest, length) == 0        // Comparing Bytes by pointers of lexeme and keyword
+        scanner->current - scanner->start == start + length &&    // Verifying the length of lexeme and keyword
+        memcmp(scanner->start + start, rest, length) == 0        // Comparing Bytes by pointers of lexeme and keyword
     ) {
         return type;
     }
@@ -99,27 +100,27 @@ static TokenType checkKeyword(int start, int length, const char* rest, TokenType
 }
 
 // Skips whitespaces and sets current pointer to a valid one
-static void skipWhitespace()
+static void skipWhitespace(Scanner* scanner)
 {
     for (;;) {
-        char c = peek();
+        char c = peek(scanner);
         switch (c) {
             case ' ':
             case '\r':
             case '\t':
-                advance();
+                advance(scanner);
                 break;
 
             case '\n':
-                scanner.line++;
-                advance();
+                scanner->line++;
+                advance(scanner);
                 break;
 
             // Skipping comments 
             case '/':
-                if (peekNext() == '/') {
-                    while (peek() != '\n' && !isAtEnd()) {
-                        advance();
+                if (peekNext(scanner) == '/') {
+                    while (peek(scanner) != '\n' && !isAtEnd(scanner)) {
+                        advance(scanner);
                     }
                 } else {
                     return;
@@ -133,77 +134,95 @@ static void skipWhitespace()
     }
 }
 
-static Token string()
+static Token string(Scanner* scanner)
 {
-    while (peek() != '"' && !isAtEnd()) {
+    while (peek(scanner) != '"' && !isAtEnd(scanner)) {
         // Support for multi line strings
-        if (peek() == '\n') {
-            scanner.line++;
+        if (peek(scanner) == '\n') {
+            scanner->line++;
         }
-        advance();
+        advance(scanner);
     }
 
-    if (isAtEnd()) {
-        return errorToken("Unterminated string.");
+    if (isAtEnd(scanner)) {
+        return errorToken(scanner, "Unterminated string.");
     }
 
-    advance();
-    return makeToken(TOKEN_STRING);
+    advance(scanner);
+    return makeToken(scanner, TOKEN_STRING);
 }
 
 // Return lexeme representation of number
 // Does not convert lexeme to double 
-static Token number()
+static Token number(Scanner* scanner)
 {
-    while (isDigit(peek())) {
-        advance();
+    while (isDigit(peek(scanner))) {
+        advance(scanner);
     }
 
     // Looking for fractional part
-    if (peek() == '.' && isDigit(peekNext())) {
-        advance();
+    if (peek(scanner) == '.' && isDigit(peekNext(scanner))) {
+        advance(scanner);
 
-        while (isDigit(peek())) {
-            advance();
+        while (isDigit(peek(scanner))) {
+            advance(scanner);
         }
     }
 
-    return makeToken(TOKEN_NUMBER);
+    return makeToken(scanner, TOKEN_NUMBER);
 }
 
 // Determines whether the lexeme is identifier or keyword 
-static TokenType identifierType()
+static TokenType identifierType(Scanner* scanner)
 {
-    switch (scanner.start[0]) {
+    switch (scanner->start[0]) {
         // Initial letters that correspond to single keyword
-        case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-        case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-        case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
-        case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
-        case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
-        case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-        case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-        case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-        case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
-        case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-        case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+        case 'a': return checkKeyword(scanner, 1, 2, "nd", TOKEN_AND);
+        case 'd': return checkKeyword(scanner, 1, 6, "efault", TOKEN_DEFAULT);
+        case 'e': return checkKeyword(scanner, 1, 3, "lse", TOKEN_ELSE);
+        case 'i': return checkKeyword(scanner, 1, 1, "f", TOKEN_IF);
+        case 'n': return checkKeyword(scanner, 1, 2, "il", TOKEN_NIL);
+        case 'o': return checkKeyword(scanner, 1, 1, "r", TOKEN_OR);
+        case 'p': return checkKeyword(scanner, 1, 4, "rint", TOKEN_PRINT);
+        case 'r': return checkKeyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
+        case 'v': return checkKeyword(scanner, 1, 2, "ar", TOKEN_VAR);
+        case 'w': return checkKeyword(scanner, 1, 4, "hile", TOKEN_WHILE);
 
         // Letters that could match with multiple keywords
+        case 'c': {
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'a': return checkKeyword(scanner, 2, 2, "se", TOKEN_CASE);
+                    case 'l': return checkKeyword(scanner, 2, 3, "ass", TOKEN_CLASS);
+                    case 'o': return checkKeyword(scanner, 2, 3, "nst", TOKEN_CONST);
+                }
+            }
+        }
+        break;
+        case 's': {
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'u': return checkKeyword(scanner, 2, 3, "per", TOKEN_SUPER);
+                    case 'w': return checkKeyword(scanner, 2, 4, "itch", TOKEN_SWITCH);
+                }
+            }
+        }
+        break;
         case 'f': {
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'a': return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-                    case 'o': return checkKeyword(2, 1, "r", TOKEN_FOR);
-                    case 'u': return checkKeyword(2, 1, "n", TOKEN_FUN);
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'a': return checkKeyword(scanner, 2, 3, "lse", TOKEN_FALSE);
+                    case 'o': return checkKeyword(scanner, 2, 1, "r", TOKEN_FOR);
+                    case 'u': return checkKeyword(scanner, 2, 1, "n", TOKEN_FUN);
                 }
             }
         }
         break;
         case 't': {
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-                    case 'r': return checkKeyword(2, 2, "ue", TOKEN_TRUE);
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'h': return checkKeyword(scanner, 2, 2, "is", TOKEN_THIS);
+                    case 'r': return checkKeyword(scanner, 2, 2, "ue", TOKEN_TRUE);
                 }
             }
         }
@@ -216,88 +235,96 @@ static TokenType identifierType()
 }
 
 // Scanning identifier
-static Token identifier()
+static Token identifier(Scanner* scanner)
 {
-    while (isAlpha(peek()) || isDigit(peek())) {
-        advance();
+    while (isAlpha(peek(scanner)) || isDigit(peek(scanner))) {
+        advance(scanner);
+    }
+
+    Token token = makeToken(scanner, identifierType(scanner));
+
+    // Compiler looks up identifiers by hash, so it is computed once here
+    if (token.type == TOKEN_IDENTIFIER) {
+        token.hash = hashString(token.start, token.length);
     }
 
-    return makeToken(identifierType());
+    return token;
 }
 
-void initScanner(const char* source)
+void initScanner(Scanner* scanner, const char* source)
 {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+    scanner->start = source;
+    scanner->current = source;
+    scanner->line = 1;
 }
 
-Token scanToken() 
+Token scanToken(Scanner* scanner)
 {
     // Skipping Whitespaces
-    skipWhitespace();
+    skipWhitespace(scanner);
 
-    scanner.start = scanner.current;
+    scanner->start = scanner->current;
 
     // Sent to compiler to stop asking for more tokens
-    if (isAtEnd()) {
-        return makeToken(TOKEN_EOF);
+    if (isAtEnd(scanner)) {
+        return makeToken(scanner, TOKEN_EOF);
     }
 
-    char c = advance();
+    char c = advance(scanner);
 
     if (isDigit(c)) {
-        return number();
+        return number(scanner);
     }
 
     // If first letter is alpha or _ then check for identifier
     if (isAlpha(c)) {
-        return identifier();
+        return identifier(scanner);
     }
 
     switch (c) {
     // Handling Punctutations
         // Single character token
-        case '(': return makeToken(TOKEN_LEFT_PAREN);
-        case ')': return makeToken(TOKEN_RIGHT_PAREN);
-        case '{': return makeToken(TOKEN_LEFT_BRACE);
-        case '}': return makeToken(TOKEN_RIGHT_BRACE);
-        case ';': return makeToken(TOKEN_SEMICOLON);
-        case ',': return makeToken(TOKEN_COMMA);
-        case '.': return makeToken(TOKEN_DOT);
-        case '-': return makeToken(TOKEN_MINUS);
-        case '+': return makeToken(TOKEN_PLUS);
-        case '/': return makeToken(TOKEN_SLASH);
-        case '*': return makeToken(TOKEN_STAR);
+        case '(': return makeToken(scanner, TOKEN_LEFT_PAREN);
+        case ')': return makeToken(scanner, TOKEN_RIGHT_PAREN);
+        case '{': return makeToken(scanner, TOKEN_LEFT_BRACE);
+        case '}': return makeToken(scanner, TOKEN_RIGHT_BRACE);
+        case ';': return makeToken(scanner, TOKEN_SEMICOLON);
+        case ':': return makeToken(scanner, TOKEN_COLON);
+        case ',': return makeToken(scanner, TOKEN_COMMA);
+        case '.': return makeToken(scanner, TOKEN_DOT);
+        case '-': return makeToken(scanner, TOKEN_MINUS);
+        case '+': return makeToken(scanner, TOKEN_PLUS);
+        case '/': return makeToken(scanner, TOKEN_SLASH);
+        case '*': return makeToken(scanner, TOKEN_STAR);
 
         // Two character token
         case '!':
-            return makeToken(
-                match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG
+            return makeToken(scanner,
+                match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG
             );
 
         
         case '=':
-            return makeToken(
-                match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL
+            return makeToken(scanner,
+                match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL
             );
 
         
         case '<':
-            return makeToken(
-                match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS
+            return makeToken(scanner,
+                match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS
             );
 
         
         case '>':
-            return makeToken(
-                match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER
+            return makeToken(scanner,
+                match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER
             );
 
         case '"':
-            return string();
+            return string(scanner);
         
     }
 
-    return errorToken("Unexpected character.");
+    return errorToken(scanner, "Unexpected character.");
 }
\ No newline at end of file
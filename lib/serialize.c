@@ -0,0 +1,192 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./../include/serialize.h"
+
+uint64_t checksumBytes(uint64_t hash, const void* bytes, size_t count)
+{
+    const uint8_t* data = (const uint8_t*)bytes;
+    for (size_t i = 0; i < count; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// WRITING
+
+void writeBytes(BinaryWriter* writer, const void* bytes, size_t count)
+{
+    writer->checksum = checksumBytes(writer->checksum, bytes, count);
+    if (fwrite(bytes, 1, count, writer->file) != count) {
+        writer->failed = true;
+    }
+}
+
+void writeInt(BinaryWriter* writer, int value)
+{
+    int32_t bytes = (int32_t)value;
+    writeBytes(writer, &bytes, sizeof(bytes));
+}
+
+void writeDouble(BinaryWriter* writer, double value)
+{
+    writeBytes(writer, &value, sizeof(value));
+}
+
+void writeString(BinaryWriter* writer, ObjString* string)
+{
+    if (string == NULL) {
+        writeInt(writer, -1);
+        return;
+    }
+
+    writeInt(writer, string->length);
+    writeBytes(writer, string->chars, string->length);
+}
+
+// Path of temporary file, caller frees it
+static char* temporaryPath(const char* path)
+{
+    size_t length = strlen(path);
+    char* temporary = (char*)malloc(length + 5);
+    if (temporary != NULL) {
+        memcpy(temporary, path, length);
+        memcpy(temporary + length, ".tmp", 5);
+    }
+
+    return temporary;
+}
+
+bool beginFile(BinaryWriter* writer, const char* path)
+{
+    char* temporary = temporaryPath(path);
+    writer->file = temporary == NULL ? NULL : fopen(temporary, "wb");
+    writer->failed = writer->file == NULL;
+    writer->checksum = CHECKSUM_SEED;
+    free(temporary);
+    return !writer->failed;
+}
+
+bool endFile(BinaryWriter* writer, const char* path)
+{
+    char* temporary = temporaryPath(path);
+
+    if (fclose(writer->file) != 0 || temporary == NULL) {
+        writer->failed = true;
+    }
+
+    if (temporary != NULL && (writer->failed || rename(temporary, path) != 0)) {
+        writer->failed = true;
+        remove(temporary);
+    }
+
+    free(temporary);
+    return !writer->failed;
+}
+
+// READING
+
+bool mapFile(BinaryReader* reader, const char* path)
+{
+    reader->data = NULL;
+    reader->length = 0;
+    reader->position = 0;
+    reader->failed = true;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    reader->data = (const uint8_t*)data;
+    reader->length = (size_t)status.st_size;
+    reader->failed = false;
+    return true;
+}
+
+void unmapFile(BinaryReader* reader)
+{
+    if (reader->data != NULL) {
+        munmap((void*)reader->data, reader->length);
+        reader->data = NULL;
+    }
+}
+
+const uint8_t* readBytes(BinaryReader* reader, size_t count)
+{
+    if (reader->failed || reader->length - reader->position < count) {
+        reader->failed = true;
+        return NULL;
+    }
+
+    const uint8_t* bytes = reader->data + reader->position;
+    reader->position += count;
+    return bytes;
+}
+
+int readInt(BinaryReader* reader)
+{
+    int32_t value = 0;
+    const uint8_t* bytes = readBytes(reader, sizeof(value));
+    if (bytes != NULL) {
+        memcpy(&value, bytes, sizeof(value));
+    }
+
+    return value;
+}
+
+double readDouble(BinaryReader* reader)
+{
+    double value = 0;
+    const uint8_t* bytes = readBytes(reader, sizeof(value));
+    if (bytes != NULL) {
+        memcpy(&value, bytes, sizeof(value));
+    }
+
+    return value;
+}
+
+int readCount(BinaryReader* reader)
+{
+    int count = readInt(reader);
+    if (count < 0 || (size_t)count > reader->length - reader->position) {
+        reader->failed = true;
+        return 0;
+    }
+
+    return count;
+}
+
+ObjString* readString(BinaryReader* reader)
+{
+    int length = readInt(reader);
+    if (length == -1 || reader->failed) {
+        return NULL;
+    }
+
+    if (length < 0) {
+        reader->failed = true;
+        return NULL;
+    }
+
+    const uint8_t* chars = readBytes(reader, length);
+    return chars == NULL ? NULL : copyString((const char*)chars, length);
+}
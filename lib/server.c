@@ -0,0 +1,268 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "./../include/server.h"
+#include "./../include/vm.h"
+
+// Both return false once other end has gone away
+static bool sendAll(int fd, const void* data, size_t length)
+{
+    const char* bytes = (const char*)data;
+    while (length > 0) {
+        ssize_t sent = write(fd, bytes, length);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+
+        bytes += sent;
+        length -= (size_t)sent;
+    }
+
+    return true;
+}
+
+static bool receiveAll(int fd, void* data, size_t length)
+{
+    char* bytes = (char*)data;
+    while (length > 0) {
+        ssize_t received = read(fd, bytes, length);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+
+        bytes += received;
+        length -= (size_t)received;
+    }
+
+    return true;
+}
+
+static bool socketAddress(const char* path, struct sockaddr_un* address)
+{
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Socket path \"%s\" is too long.\n", path);
+        return false;
+    }
+
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+    return true;
+}
+
+// Connection of request handled by this fork, answered by requestTimedOut()
+static int requestConnection = -1;
+
+// Set once response is being sent, from then on running out of time only ends the fork
+static volatile sig_atomic_t answering = 0;
+
+static char timeoutMessage[64];
+static int timeoutLength = 0;
+
+// Output made so far is dropped, as streams holding it are not safe to use in a signal handler
+static void requestTimedOut(int signal)
+{
+    (void)signal;
+
+    if (!answering) {
+        int32_t response[3] = { 70, 0, timeoutLength };
+        sendAll(requestConnection, response, sizeof(response));
+        sendAll(requestConnection, timeoutMessage, (size_t)timeoutLength);
+    }
+
+    _exit(0);
+}
+
+// Stream writing into a buffer of SERVER_MAX_OUTPUT bytes, writes past its end fail
+// Pages of the buffer are only used once written, so small output costs little
+static FILE* openCapture(char** buffer)
+{
+    *buffer = (char*)malloc(SERVER_MAX_OUTPUT);
+    return *buffer == NULL ? NULL : fmemopen(*buffer, SERVER_MAX_OUTPUT, "w");
+}
+
+// Closes stream and returns number of bytes kept in its buffer
+static size_t closeCapture(FILE* stream, bool* truncated)
+{
+    fflush(stream);
+    long length = ftell(stream);
+    if (ferror(stream) || length >= SERVER_MAX_OUTPUT) {
+        *truncated = true;
+    }
+    fclose(stream);
+
+    // Stream may have written a terminating null byte past what was kept
+    return length < 0 ? 0 : length > SERVER_MAX_OUTPUT ? SERVER_MAX_OUTPUT : (size_t)length;
+}
+
+// Runs in a fork of server with its own copy of VM
+static void handleRequest(int connection)
+{
+    requestConnection = connection;
+    timeoutLength = snprintf(timeoutMessage, sizeof(timeoutMessage),
+        "Script ran longer than %d seconds.\n", SERVER_TIME_LIMIT);
+    signal(SIGALRM, requestTimedOut);
+    alarm(SERVER_TIME_LIMIT);
+
+    int32_t length;
+    if (!receiveAll(connection, &length, sizeof(length)) || length < 0 || length > SERVER_MAX_SCRIPT) {
+        _exit(1);
+    }
+
+    char* source = (char*)malloc((size_t)length + 1);
+    if (source == NULL || !receiveAll(connection, source, (size_t)length)) {
+        _exit(1);
+    }
+    source[length] = '\0';
+
+    // Output of script is kept in memory instead of going to terminal of server
+    char* outText = NULL;
+    char* errText = NULL;
+    stdout = openCapture(&outText);
+    stderr = openCapture(&errText);
+    if (stdout == NULL || stderr == NULL) {
+        _exit(1);
+    }
+
+    InterpretResult result = interpret(source);
+    flushOutput(&vm.output);
+
+    // Client that stops reading cannot keep fork alive past the time limit either
+    answering = 1;
+
+    bool truncated = false;
+    size_t outLength = closeCapture(stdout, &truncated);
+    size_t errLength = closeCapture(stderr, &truncated);
+
+    char note[64];
+    int noteLength = truncated
+        ? snprintf(note, sizeof(note), "Output past %d bytes was dropped.\n", SERVER_MAX_OUTPUT)
+        : 0;
+
+    int32_t response[3];
+    response[0] = result == INTERPRET_COMPILE_ERROR ? 65 : result == INTERPRET_RUNTIME_ERROR ? 70 : 0;
+    response[1] = (int32_t)outLength;
+    response[2] = (int32_t)errLength + noteLength;
+
+    // Client going away early is no concern of server
+    sendAll(connection, response, sizeof(response));
+    sendAll(connection, outText, outLength);
+    sendAll(connection, errText, errLength);
+    sendAll(connection, note, (size_t)noteLength);
+
+    // Nothing of the fork has to be cleaned up, process goes away with it
+    _exit(0);
+}
+
+bool serve(const char* path)
+{
+    struct sockaddr_un address;
+    if (!socketAddress(path, &address)) {
+        return false;
+    }
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server == -1) {
+        return false;
+    }
+
+    // Socket left behind by a server that was stopped
+    unlink(path);
+    if (bind(server, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(server, SOMAXCONN) != 0) {
+        close(server);
+        return false;
+    }
+
+    // Forks are reaped by kernel
+    signal(SIGCHLD, SIG_IGN);
+
+    // Waiting after running out of descriptors or memory, doubled while it lasts
+    long backoff = 0;
+
+    for (;;) {
+        int connection = accept(server, NULL, NULL);
+        if (connection == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            // Forks finishing give back what accept() needs
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                backoff = backoff == 0 ? 10 : backoff < 1000 ? backoff * 2 : 1000;
+                struct timespec wait = { backoff / 1000, (backoff % 1000) * 1000000 };
+                nanosleep(&wait, NULL);
+                continue;
+            }
+
+            // Socket itself is broken, so no request could ever come in
+            close(server);
+            return false;
+        }
+        backoff = 0;
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(server);
+            handleRequest(connection);
+        }
+
+        // Request is dropped when no fork could be made
+        close(connection);
+    }
+}
+
+int submit(const char* path, const char* source, size_t length)
+{
+    struct sockaddr_un address;
+    if (!socketAddress(path, &address) || length > SERVER_MAX_SCRIPT) {
+        return -1;
+    }
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection == -1) {
+        return -1;
+    }
+
+    if (connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(connection);
+        return -1;
+    }
+
+    int32_t scriptLength = (int32_t)length;
+    int32_t response[3];
+    bool answered = sendAll(connection, &scriptLength, sizeof(scriptLength)) &&
+        sendAll(connection, source, length) &&
+        receiveAll(connection, response, sizeof(response)) &&
+        response[1] >= 0 && response[2] >= 0;
+
+    // Output is copied through in blocks so it need not fit in memory at once
+    char block[65536];
+    for (int stream = 1; stream <= 2 && answered; stream++) {
+        FILE* to = stream == 1 ? stdout : stderr;
+        size_t left = (size_t)response[stream];
+        while (left > 0 && answered) {
+            size_t count = left < sizeof(block) ? left : sizeof(block);
+            answered = receiveAll(connection, block, count);
+            if (answered) {
+                fwrite(block, 1, count, to);
+            }
+            left -= count;
+        }
+    }
+
+    close(connection);
+    return answered ? response[0] : -1;
+}
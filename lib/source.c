@@ -0,0 +1,334 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./../include/source.h"
+
+static bool mapSource(SourceFile* source, int fd, size_t length)
+{
+    // Always at least one byte past file for sentinel, a whole page when file fills its last one
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t mappedLength = (length / pageSize + 1) * pageSize;
+
+    // Zeroed pages are reserved first and file is mapped over start of them
+    void* reserved = mmap(NULL, mappedLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        return false;
+    }
+
+    void* data = mmap(reserved, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    if (data == MAP_FAILED) {
+        munmap(reserved, mappedLength);
+        return false;
+    }
+
+    // Writing sentinel gives last page a private copy, so bytes appended
+    // to file later cannot show up in place of it
+    source->text = (char*)data;
+    source->text[length] = '\0';
+    source->length = length;
+    source->mappedLength = mappedLength;
+
+    madvise(data, length, MADV_SEQUENTIAL);
+    return true;
+}
+
+// Reads until end of file, as size of pipes is not known ahead
+static bool readSource(SourceFile* source, int fd)
+{
+    size_t capacity = 0;
+    size_t length = 0;
+    char* text = NULL;
+
+    for (;;) {
+        if (capacity - length < 2) {
+            capacity = capacity < 4096 ? 4096 : capacity * 2;
+            text = (char*)realloc(text, capacity);
+            if (text == NULL) {
+                fprintf(stderr, "Not enough memory to read source.\n");
+                exit(74);
+            }
+        }
+
+        ssize_t bytesRead = read(fd, text + length, capacity - length - 1);
+        if (bytesRead == 0) {
+            break;
+        }
+
+        if (bytesRead < 0) {
+            free(text);
+            return false;
+        }
+
+        length += (size_t)bytesRead;
+    }
+
+    text[length] = '\0';
+    source->text = text;
+    source->length = length;
+    source->mappedLength = 0;
+    return true;
+}
+
+bool openSource(SourceFile* source, const char* path)
+{
+    source->text = NULL;
+    source->length = 0;
+    source->mappedLength = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    // Empty files cannot be mapped and files in /proc report no size
+    struct stat status;
+    bool mapped = fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0 &&
+        mapSource(source, fd, (size_t)status.st_size);
+
+    bool opened = mapped || readSource(source, fd);
+    close(fd);
+    return opened;
+}
+
+void closeSource(SourceFile* source)
+{
+    if (source->mappedLength != 0) {
+        munmap(source->text, source->mappedLength);
+    } else {
+        free(source->text);
+    }
+
+    source->text = NULL;
+    source->length = 0;
+    source->mappedLength = 0;
+}
+
+void openStream(SourceStream* stream, int fd, bool interactive)
+{
+    stream->fd = fd;
+    stream->interactive = interactive;
+    stream->ended = false;
+
+    stream->buffer = NULL;
+    stream->length = 0;
+    stream->capacity = 0;
+
+    stream->start = 0;
+    stream->handedOut = 0;
+    stream->replaced = '\0';
+    stream->line = 1;
+
+    stream->scanned = 0;
+    stream->state = STREAM_CODE;
+    stream->depth = 0;
+    stream->candidate = 0;
+    stream->boundary = 0;
+}
+
+void closeStream(SourceStream* stream)
+{
+    free(stream->buffer);
+    stream->buffer = NULL;
+    stream->length = 0;
+    stream->capacity = 0;
+}
+
+// Puts back byte replaced by '\0' and moves start past text handed out by last call
+static void dropHandedOut(SourceStream* stream)
+{
+    if (stream->handedOut == 0) {
+        return;
+    }
+
+    stream->buffer[stream->handedOut] = stream->replaced;
+    for (size_t i = stream->start; i < stream->handedOut; i++) {
+        if (stream->buffer[i] == '\n') {
+            stream->line++;
+        }
+    }
+
+    stream->start = stream->handedOut;
+    stream->handedOut = 0;
+}
+
+// Reads whatever is available, buffer only grows for declarations longer than it
+static void fillStream(SourceStream* stream)
+{
+    // Text handed out is moved off front of buffer once per read rather than once per declaration
+    size_t start = stream->start;
+    if (start != 0) {
+        memmove(stream->buffer, stream->buffer + start, stream->length - start);
+        stream->length -= start;
+        stream->scanned -= start;
+        stream->candidate = stream->candidate > start ? stream->candidate - start : 0;
+        stream->start = 0;
+    }
+
+    if (stream->capacity - stream->length < STREAM_READ_SIZE / 4) {
+        stream->capacity = stream->capacity < STREAM_READ_SIZE ? STREAM_READ_SIZE : stream->capacity * 2;
+        stream->buffer = (char*)realloc(stream->buffer, stream->capacity);
+        if (stream->buffer == NULL) {
+            fprintf(stderr, "Not enough memory to read source.\n");
+            exit(74);
+        }
+    }
+
+    if (stream->interactive) {
+        printf(stream->length == 0 ? "> " : "... ");
+        fflush(stdout);
+    }
+
+    // One byte is always left for '\0'
+    ssize_t bytesRead;
+    do {
+        bytesRead = read(stream->fd, stream->buffer + stream->length, stream->capacity - stream->length - 1);
+    } while (bytesRead < 0 && errno == EINTR);
+
+    if (bytesRead <= 0) {
+        stream->ended = true;
+    } else {
+        stream->length += (size_t)bytesRead;
+    }
+}
+
+static bool isIdentifierChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Stops at end of first declaration that is known to be complete
+// A declaration ending in ';' or '}' is complete once next token is not else
+static void scanStream(SourceStream* stream)
+{
+    while (stream->scanned < stream->length) {
+        size_t i = stream->scanned;
+        size_t left = stream->length - i;
+        char c = stream->buffer[i];
+
+        if (stream->state == STREAM_STRING) {
+            if (c == '"') {
+                stream->state = STREAM_CODE;
+            }
+            stream->scanned++;
+            continue;
+        }
+
+        if (stream->state == STREAM_COMMENT) {
+            if (c == '\n') {
+                stream->state = STREAM_CODE;
+            }
+            stream->scanned++;
+            continue;
+        }
+
+        if (c == ' ' || c == '\r' || c == '\t' || c == '\n') {
+            stream->scanned++;
+            continue;
+        }
+
+        // Waiting for bytes that tell what token this is
+        if (!stream->ended && ((c == '/' && left < 2) || (stream->candidate != 0 && c == 'e' && left < 5))) {
+            return;
+        }
+
+        if (c == '/' && left >= 2 && stream->buffer[i + 1] == '/') {
+            stream->state = STREAM_COMMENT;
+            stream->scanned += 2;
+            continue;
+        }
+
+        if (stream->candidate != 0) {
+            bool isElse = left >= 4 && memcmp(stream->buffer + i, "else", 4) == 0 &&
+                (left == 4 || !isIdentifierChar(stream->buffer[i + 4]));
+            size_t candidate = stream->candidate;
+            stream->candidate = 0;
+
+            // Each declaration is compiled on its own, so chunks stay within limits on constants
+            if (!isElse) {
+                stream->boundary = candidate;
+                return;
+            }
+        }
+
+        switch (c) {
+            case '"':
+                stream->state = STREAM_STRING;
+                break;
+
+            case '(':
+            case '{':
+                stream->depth++;
+                break;
+
+            case ')':
+                if (stream->depth > 0) {
+                    stream->depth--;
+                }
+                break;
+
+            case '}':
+                if (stream->depth > 0) {
+                    stream->depth--;
+                }
+                if (stream->depth == 0) {
+                    stream->candidate = i + 1;
+                }
+                break;
+
+            case ';':
+                if (stream->depth == 0) {
+                    stream->candidate = i + 1;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        stream->scanned++;
+    }
+}
+
+const char* nextDeclaration(SourceStream* stream, int* line)
+{
+    dropHandedOut(stream);
+
+    for (;;) {
+        scanStream(stream);
+
+        bool pending = stream->length > stream->start;
+        size_t end = 0;
+        if (stream->boundary != 0) {
+            end = stream->boundary;
+        } else if (stream->ended && pending) {
+            end = stream->length;
+        } else if (stream->interactive && pending && stream->scanned == stream->length &&
+                   stream->buffer[stream->length - 1] == '\n' &&
+                   stream->state != STREAM_STRING && stream->depth == 0) {
+            // Line typed outside brackets runs right away, as REPL always did
+            end = stream->length;
+            stream->candidate = 0;
+        }
+
+        if (end != 0) {
+            stream->boundary = 0;
+            stream->replaced = stream->buffer[end];
+            stream->buffer[end] = '\0';
+            stream->handedOut = end;
+            *line = stream->line;
+            return stream->buffer + stream->start;
+        }
+
+        if (stream->ended) {
+            return NULL;
+        }
+
+        fillStream(stream);
+    }
+}
@@ -88,11 +88,29 @@ static void adjustCapacity(Table* table, int capacity)
 
 }
 
+// Entries holding a key, tombstones left out
+static int liveEntries(Table* table)
+{
+    int live = 0;
+    for (int i = 0; i <= table->capacity; i++) {
+        if (table->entries[i].key != NULL) {
+            live++;
+        }
+    }
+
+    return live;
+}
+
 bool tableSet(Table* table, ObjString* key, Value value)
 {
     // Allocating and growing entry array
     if (table->count + 1 > (table->capacity + 1) * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity + 1) - 1;
+        // Table filled mostly by tombstones, like strings table after collections, is
+        // only rebuilt, otherwise it would keep growing while few keys are in it
+        int capacity = table->capacity;
+        if (liveEntries(table) + 1 > (table->capacity + 1) * TABLE_MAX_LOAD / 2) {
+            capacity = GROW_CAPACITY(table->capacity + 1) - 1;
+        }
         adjustCapacity(table, capacity);
     }
 
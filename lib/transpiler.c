@@ -0,0 +1,495 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./../include/transpiler.h"
+#include "./../include/memory.h"
+
+// Functions in order they are numbered in output, script is first
+typedef struct {
+    int count;
+    int capacity;
+    ObjFunction** functions;
+} FunctionList;
+
+static int functionIndex(FunctionList* list, ObjFunction* function)
+{
+    for (int i = 0; i < list->count; i++) {
+        if (list->functions[i] == function) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Numbers function and every function found in its constants
+static void collectFunctions(FunctionList* list, ObjFunction* function)
+{
+    if (functionIndex(list, function) != -1) {
+        return;
+    }
+
+    if (list->capacity < list->count + 1) {
+        list->capacity = GROW_CAPACITY(list->capacity);
+        list->functions = (ObjFunction**)realloc(list->functions, sizeof(ObjFunction*) * list->capacity);
+        if (list->functions == NULL) {
+            exit(1);
+        }
+    }
+    list->functions[list->count++] = function;
+
+    ValueArray* constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (IS_FUNCTION(constants->values[i])) {
+            collectFunctions(list, AS_FUNCTION(constants->values[i]));
+        }
+    }
+}
+
+static void emitString(FILE* out, const char* chars, int length)
+{
+    fputc('"', out);
+
+    for (int i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)chars[i];
+
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 32 || c > 126) {
+            // Always 3 digits so following characters are not read as part of escape
+            fprintf(out, "\\%03o", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+
+    fputc('"', out);
+}
+
+static void emitNumber(FILE* out, double number)
+{
+    if (isnan(number)) {
+        fprintf(out, "NAN");
+    } else if (isinf(number)) {
+        fprintf(out, number > 0 ? "INFINITY" : "-INFINITY");
+    } else {
+        fprintf(out, "%.17g", number);
+    }
+}
+
+// Jump targets get labels, rest of offsets do not
+static void markTargets(Chunk* chunk, bool* targets)
+{
+    for (int offset = 0; offset < chunk->count; offset += 1 + operandCount(chunk->code[offset])) {
+        uint8_t instruction = chunk->code[offset];
+        int next = offset + 1 + operandCount(instruction);
+        int jump = next > offset + 2 ? (chunk->code[offset + 1] << 8) | chunk->code[offset + 2] : 0;
+
+        switch (instruction) {
+            case OP_GUARD_NUMBERS:
+                targets[next + ((chunk->code[offset + 2] << 8) | chunk->code[offset + 3])] = true;
+                break;
+
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+            case OP_JUMP:
+                targets[next + jump] = true;
+                break;
+
+            case OP_LOOP:
+                targets[next - jump] = true;
+                break;
+
+            case OP_SWITCH: {
+                ObjSwitch* jumpTable = AS_SWITCH(chunk->constants.values[chunk->code[offset + 1]]);
+
+                targets[next - jumpTable->defaultDistance] = true;
+                for (int i = 0; i < jumpTable->count; i++) {
+                    targets[next - jumpTable->distances[i]] = true;
+                }
+
+                for (int i = 0; i <= jumpTable->strings.capacity; i++) {
+                    Entry* entry = &jumpTable->strings.entries[i];
+                    if (entry->key != NULL) {
+                        targets[next - (int)AS_NUMBER(entry->value)] = true;
+                    }
+                }
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+}
+
+// String cases of switch are appended to constants of function in setup
+// so they stay reachable for Garbage Collector
+typedef struct {
+    int count;
+    int capacity;
+    ObjString** strings;
+} CaseStrings;
+
+static int caseString(CaseStrings* cases, int firstIndex, ObjString* string)
+{
+    for (int i = 0; i < cases->count; i++) {
+        if (cases->strings[i] == string) {
+            return firstIndex + i;
+        }
+    }
+
+    if (cases->capacity < cases->count + 1) {
+        cases->capacity = GROW_CAPACITY(cases->capacity);
+        cases->strings = (ObjString**)realloc(cases->strings, sizeof(ObjString*) * cases->capacity);
+        if (cases->strings == NULL) {
+            exit(1);
+        }
+    }
+    cases->strings[cases->count++] = string;
+
+    return firstIndex + cases->count - 1;
+}
+
+static void emitSwitch(FILE* out, Chunk* chunk, int offset, int index, CaseStrings* cases)
+{
+    ObjSwitch* jumpTable = AS_SWITCH(chunk->constants.values[chunk->code[offset + 1]]);
+    int next = offset + 2;
+
+    fprintf(out, "    {\n");
+    fprintf(out, "        Value value = AOT_PEEK(0);\n");
+
+    if (jumpTable->count > 0) {
+        fprintf(out, "        if (IS_NUMBER(value)) {\n");
+        fprintf(out, "            double index = AS_NUMBER(value) - %d;\n", jumpTable->low);
+        fprintf(out, "            if (index >= 0 && index < %d && index == (int)index) {\n", jumpTable->count);
+        fprintf(out, "                switch ((int)index) {\n");
+
+        for (int i = 0; i < jumpTable->count; i++) {
+            if (jumpTable->distances[i] != jumpTable->defaultDistance) {
+                fprintf(out, "                    case %d: goto L%d;\n", i, next - jumpTable->distances[i]);
+            }
+        }
+
+        fprintf(out, "                    default: break;\n");
+        fprintf(out, "                }\n");
+        fprintf(out, "            }\n");
+        fprintf(out, "        }\n");
+    }
+
+    // Interned strings are compared by pointer
+    for (int i = 0; i <= jumpTable->strings.capacity; i++) {
+        Entry* entry = &jumpTable->strings.entries[i];
+        if (entry->key == NULL) {
+            continue;
+        }
+
+        int constant = caseString(cases, chunk->constants.count, entry->key);
+        fprintf(out, "        if (IS_STRING(value) && AS_OBJ(value) == AS_OBJ(function%d->chunk.constants.values[%d])) goto L%d;\n",
+                index, constant, next - (int)AS_NUMBER(entry->value));
+    }
+
+    fprintf(out, "        goto L%d;\n", next - jumpTable->defaultDistance);
+    fprintf(out, "    }\n");
+}
+
+// Sets line reported in stack trace if instruction fails
+static void emitLine(FILE* out, Chunk* chunk, int offset)
+{
+    fprintf(out, "    aotFrames[aotFrameCount - 1].line = %d;\n", sourceLine(chunk, offset));
+}
+
+static bool emitInstruction(FILE* out, Chunk* chunk, int offset, int index, CaseStrings* cases)
+{
+    uint8_t instruction = chunk->code[offset];
+    int next = offset + 1 + operandCount(instruction);
+    int operand = operandCount(instruction) > 0 ? chunk->code[offset + 1] : 0;
+    int jump = operandCount(instruction) == 2 ? (chunk->code[offset + 1] << 8) | chunk->code[offset + 2] : 0;
+
+    switch (instruction) {
+        case OP_CONSTANT:
+            fprintf(out, "    AOT_PUSH(function%d->chunk.constants.values[%d]);\n", index, operand);
+            return true;
+        case OP_NIL:
+            fprintf(out, "    AOT_PUSH(NIL_VAL);\n");
+            return true;
+        case OP_TRUE:
+            fprintf(out, "    AOT_PUSH(BOOL_VAL(true));\n");
+            return true;
+        case OP_FALSE:
+            fprintf(out, "    AOT_PUSH(BOOL_VAL(false));\n");
+            return true;
+        case OP_POP:
+            fprintf(out, "    vm.stackTop--;\n");
+            return true;
+
+        case OP_NEGATE:
+            emitLine(out, chunk, offset);
+            fprintf(out, "    if (!IS_NUMBER(AOT_PEEK(0))) aotRuntimeError(\"Operand must be a number.\");\n");
+            fprintf(out, "    vm.stackTop[-1] = NUMBER_VAL(-AS_NUMBER(vm.stackTop[-1]));\n");
+            return true;
+        case OP_ADD:
+            emitLine(out, chunk, offset);
+            fprintf(out, "    aotAdd();\n");
+            return true;
+        case OP_ADD_GUARDED:
+            emitLine(out, chunk, offset);
+            fprintf(out, "    if (IS_NUMBER(AOT_PEEK(0)) && IS_NUMBER(AOT_PEEK(1))) AOT_NUMBER_OP(NUMBER_VAL, +); else aotAdd();\n");
+            return true;
+        case OP_SUBTRACT:
+            emitLine(out, chunk, offset);
+            fprintf(out, "    AOT_BINARY_OP(NUMBER_VAL, -);\n");
+            return true;
+        case OP_MULTIPLY:
+            emitLine(out, chunk, offset);
+            fprintf(out, "    AOT_BINARY_OP(NUMBER_VAL, *);\n");
+            return true;
+        case OP_DIVIDE:
+            emitLine(out, chunk, offset);
+            fprintf(out, "    AOT_BINARY_OP(NUMBER_VAL, /);\n");
+            return true;
+        case OP_GREATER:
+            emitLine(out, chunk, offset);
+            fprintf(out, "    AOT_BINARY_OP(BOOL_VAL, >);\n");
+            return true;
+        case OP_LESS:
+            emitLine(out, chunk, offset);
+            fprintf(out, "    AOT_BINARY_OP(BOOL_VAL, <);\n");
+            return true;
+
+        case OP_NEGATE_NUMBER:
+            fprintf(out, "    vm.stackTop[-1] = NUMBER_VAL(-AS_NUMBER(vm.stackTop[-1]));\n");
+            return true;
+        case OP_ADD_NUMBER:
+            fprintf(out, "    AOT_NUMBER_OP(NUMBER_VAL, +);\n");
+            return true;
+        case OP_SUBTRACT_NUMBER:
+            fprintf(out, "    AOT_NUMBER_OP(NUMBER_VAL, -);\n");
+            return true;
+        case OP_MULTIPLY_NUMBER:
+            fprintf(out, "    AOT_NUMBER_OP(NUMBER_VAL, *);\n");
+            return true;
+        case OP_DIVIDE_NUMBER:
+            fprintf(out, "    AOT_NUMBER_OP(NUMBER_VAL, /);\n");
+            return true;
+        case OP_GREATER_NUMBER:
+            fprintf(out, "    AOT_NUMBER_OP(BOOL_VAL, >);\n");
+            return true;
+        case OP_LESS_NUMBER:
+            fprintf(out, "    AOT_NUMBER_OP(BOOL_VAL, <);\n");
+            return true;
+
+        case OP_NOT:
+            fprintf(out, "    vm.stackTop[-1] = BOOL_VAL(AOT_FALSEY(vm.stackTop[-1]));\n");
+            return true;
+        case OP_EQUAL:
+            fprintf(out, "    { Value b = AOT_POP(); Value a = AOT_POP(); AOT_PUSH(BOOL_VAL(valuesEqual(a, b))); }\n");
+            return true;
+        case OP_PRINT:
+            fprintf(out, "    writeLine(&vm.output, AOT_POP());\n");
+            return true;
+
+        case OP_DEFINE_GLOBAL:
+            fprintf(out, "    tableSet(&vm.globals, AS_STRING(function%d->chunk.constants.values[%d]), AOT_PEEK(0));\n", index, operand);
+            fprintf(out, "    vm.stackTop--;\n");
+            return true;
+        case OP_GET_GLOBAL:
+            emitLine(out, chunk, offset);
+            fprintf(out, "    aotGetGlobal(AS_STRING(function%d->chunk.constants.values[%d]));\n", index, operand);
+            return true;
+        case OP_SET_GLOBAL:
+            emitLine(out, chunk, offset);
+            fprintf(out, "    aotSetGlobal(AS_STRING(function%d->chunk.constants.values[%d]));\n", index, operand);
+            return true;
+        case OP_GET_LOCAL:
+            fprintf(out, "    AOT_PUSH(slots[%d]);\n", operand);
+            return true;
+        case OP_SET_LOCAL:
+            fprintf(out, "    slots[%d] = AOT_PEEK(0);\n", operand);
+            return true;
+
+        case OP_JUMP_IF_FALSE:
+            fprintf(out, "    if (AOT_FALSEY(AOT_PEEK(0))) goto L%d;\n", next + jump);
+            return true;
+        case OP_JUMP_IF_TRUE:
+            fprintf(out, "    if (!AOT_FALSEY(AOT_PEEK(0))) goto L%d;\n", next + jump);
+            return true;
+        case OP_JUMP:
+            fprintf(out, "    goto L%d;\n", next + jump);
+            return true;
+        case OP_LOOP:
+            fprintf(out, "    goto L%d;\n", next - jump);
+            return true;
+        case OP_SWITCH:
+            emitSwitch(out, chunk, offset, index, cases);
+            return true;
+
+        case OP_PROFILE_BRANCH:
+        case OP_PROFILE_TYPES:
+            // Profiles are only recorded by interpreter
+            return true;
+
+        case OP_GUARD_NUMBERS: {
+            fprintf(out, "    if (");
+            for (int slot = 1, mask = operand; mask != 0; slot++, mask >>= 1) {
+                if (mask & 1) {
+                    fprintf(out, "!IS_NUMBER(slots[%d]) || ", slot);
+                }
+            }
+            fprintf(out, "false) goto L%d;\n", next + ((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]));
+            return true;
+        }
+
+        case OP_CALL:
+            emitLine(out, chunk, offset);
+            fprintf(out, "    aotCall(%d);\n", operand);
+            return true;
+        case OP_CONCAT:
+            emitLine(out, chunk, offset);
+            fprintf(out, "    aotConcat(%d);\n", operand);
+            return true;
+        case OP_PRINT_CONCAT:
+            emitLine(out, chunk, offset);
+            fprintf(out, "    aotPrintConcat(%d);\n", operand);
+            return true;
+
+        case OP_RETURN:
+            fprintf(out, "    { Value result = AOT_POP(); vm.stackTop = slots; AOT_PUSH(result); return; }\n");
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static bool emitFunction(FILE* out, ObjFunction* function, int index, CaseStrings* cases)
+{
+    Chunk* chunk = &function->chunk;
+
+    // One more for label after last instruction
+    bool* targets = (bool*)calloc(chunk->count + 1, sizeof(bool));
+    if (targets == NULL) {
+        exit(1);
+    }
+    markTargets(chunk, targets);
+
+    fprintf(out, "\n// %s\n", function->name == NULL ? "<script>" : function->name->chars);
+    fprintf(out, "static void fn%d(Value* slots)\n{\n", index);
+
+    bool translated = true;
+    for (int offset = 0; offset < chunk->count && translated; offset += 1 + operandCount(chunk->code[offset])) {
+        if (targets[offset]) {
+            fprintf(out, "L%d:\n", offset);
+        }
+
+        translated = emitInstruction(out, chunk, offset, index, cases);
+    }
+
+    if (targets[chunk->count]) {
+        fprintf(out, "L%d:\n", chunk->count);
+    }
+    fprintf(out, "    ;\n}\n");
+
+    free(targets);
+    return translated;
+}
+
+// Fills constants of function as compiler left them, followed by case strings
+static void emitConstants(FILE* out, ObjFunction* function, int index, FunctionList* list, CaseStrings* cases)
+{
+    ValueArray* constants = &function->chunk.constants;
+
+    for (int i = 0; i < constants->count + cases->count; i++) {
+        fprintf(out, "    writeValueArray(&function%d->chunk.constants, ", index);
+
+        if (i >= constants->count) {
+            ObjString* string = cases->strings[i - constants->count];
+            fprintf(out, "OBJ_VAL(copyString(");
+            emitString(out, string->chars, string->length);
+            fprintf(out, ", %d))", string->length);
+        } else {
+            Value value = constants->values[i];
+
+            if (IS_NUMBER(value)) {
+                fprintf(out, "NUMBER_VAL(");
+                emitNumber(out, AS_NUMBER(value));
+                fprintf(out, ")");
+            } else if (IS_BOOL(value)) {
+                fprintf(out, "BOOL_VAL(%s)", AS_BOOL(value) ? "true" : "false");
+            } else if (IS_STRING(value)) {
+                fprintf(out, "OBJ_VAL(copyString(");
+                emitString(out, AS_STRING(value)->chars, AS_STRING(value)->length);
+                fprintf(out, ", %d))", AS_STRING(value)->length);
+            } else if (IS_FUNCTION(value)) {
+                fprintf(out, "OBJ_VAL(function%d)", functionIndex(list, AS_FUNCTION(value)));
+            } else {
+                // Jump tables are translated to C switch
+                fprintf(out, "NIL_VAL");
+            }
+        }
+
+        fprintf(out, ");\n");
+    }
+}
+
+bool emitC(ObjFunction* script, FILE* out)
+{
+    FunctionList list = { 0, 0, NULL };
+    collectFunctions(&list, script);
+
+    CaseStrings* cases = (CaseStrings*)calloc(list.count, sizeof(CaseStrings));
+    if (cases == NULL) {
+        exit(1);
+    }
+
+    fprintf(out, "// Generated by clox --emit-c\n\n");
+    fprintf(out, "#include <math.h>\n\n");
+    fprintf(out, "#include \"aot.h\"\n\n");
+
+    for (int i = 0; i < list.count; i++) {
+        fprintf(out, "static ObjFunction* function%d;\n", i);
+    }
+
+    bool translated = true;
+    for (int i = 0; i < list.count && translated; i++) {
+        translated = emitFunction(out, list.functions[i], i, &cases[i]);
+    }
+
+    // Objects are created with collector off since nothing roots them yet
+    fprintf(out, "\nstatic void setup()\n{\n");
+    fprintf(out, "    vm.heap.canCollect = false;\n\n");
+
+    for (int i = 0; i < list.count; i++) {
+        ObjFunction* function = list.functions[i];
+
+        fprintf(out, "    function%d = aotFunction(", i);
+        if (function->name == NULL) {
+            fprintf(out, "NULL");
+        } else {
+            emitString(out, function->name->chars, function->name->length);
+        }
+        fprintf(out, ", %d, %d, fn%d);\n", function->arity, function->maxStack, i);
+    }
+
+    for (int i = 0; i < list.count; i++) {
+        fprintf(out, "\n");
+        emitConstants(out, list.functions[i], i, &list, &cases[i]);
+    }
+
+    fprintf(out, "\n    vm.heap.canCollect = true;\n}\n\n");
+
+    fprintf(out, "int main()\n{\n");
+    fprintf(out, "    initVM();\n");
+    fprintf(out, "    setup();\n");
+    fprintf(out, "    return aotRun(function0);\n");
+    fprintf(out, "}\n");
+
+    for (int i = 0; i < list.count; i++) {
+        free(cases[i].strings);
+    }
+    free(cases);
+    free(list.functions);
+
+    return translated;
+}
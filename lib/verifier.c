@@ -0,0 +1,313 @@
+#include "./../include/verifier.h"
+#include "./../include/memory.h"
+
+// Number of values an instruction reads from top of stack
+static int stackInputs(uint8_t instruction, int operand)
+{
+    switch (instruction) {
+        case OP_CALL:
+            return operand + 1;
+
+        case OP_CONCAT:
+        case OP_PRINT_CONCAT:
+            return operand;
+
+        case OP_ADD:
+        case OP_ADD_GUARDED:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD_NUMBER:
+        case OP_SUBTRACT_NUMBER:
+        case OP_MULTIPLY_NUMBER:
+        case OP_DIVIDE_NUMBER:
+        case OP_GREATER_NUMBER:
+        case OP_LESS_NUMBER:
+            return 2;
+
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_SET_LOCAL:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_SWITCH:
+        case OP_PROFILE_BRANCH:
+        case OP_NEGATE:
+        case OP_NEGATE_NUMBER:
+        case OP_NOT:
+        case OP_PRINT:
+        case OP_POP:
+        case OP_RETURN:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+// State of following paths through a chunk
+typedef struct {
+    Chunk* chunk;
+    bool* starts;       // Offsets where an instruction begins
+    int* depths;        // Stack depth before instruction at offset, -1 if not reached yet
+    int* pending;       // Offsets of branch targets still to follow
+    int pendingCount;
+    int maxDepth;
+} Verifier;
+
+// Records depth at jump target, target is followed later if not reached before
+static const char* reach(Verifier* verifier, int target, int depth)
+{
+    if (target < 0 || target >= verifier->chunk->count || !verifier->starts[target]) {
+        return "Jump into middle of an instruction.";
+    }
+
+    if (verifier->depths[target] == -1) {
+        verifier->depths[target] = depth;
+        verifier->pending[verifier->pendingCount++] = target;
+    } else if (verifier->depths[target] != depth) {
+        return "Stack depth differs between paths.";
+    }
+
+    return NULL;
+}
+
+static const char* checkConstant(Chunk* chunk, int index, ObjType type)
+{
+    if (index >= chunk->constants.count) {
+        return "Constant index out of range.";
+    }
+
+    Value value = chunk->constants.values[index];
+    if (!IS_OBJ(value) || OBJ_TYPE(value) != type) {
+        return "Constant has wrong type for instruction.";
+    }
+
+    return NULL;
+}
+
+// Checks that every byte has a line and lines of inlined code lead back to a line of chunk
+static const char* checkLines(Chunk* chunk)
+{
+    if (chunk->lineCount == 0 || chunk->lines[0].offset != 0) {
+        return "Code has no line.";
+    }
+
+    for (int i = 0; i < chunk->lineCount; i++) {
+        if (i > 0 && chunk->lines[i].offset <= chunk->lines[i - 1].offset) {
+            return "Lines out of order.";
+        }
+
+        if (chunk->lines[i].line < -chunk->inlinedCount) {
+            return "Inlined line out of range.";
+        }
+    }
+
+    // Calls may only be inlined lines before, so following them ends
+    for (int i = 0; i < chunk->inlinedCount; i++) {
+        InlinedLine* inlined = &chunk->inlined[i];
+        if (inlined->line < 0 || inlined->callLine < -i) {
+            return "Inlined line out of range.";
+        }
+
+        const char* error = inlined->name < 0
+            ? "Constant index out of range."
+            : checkConstant(chunk, inlined->name, OBJ_STRING);
+        if (error != NULL) {
+            return error;
+        }
+    }
+
+    return NULL;
+}
+
+// Follows straight line code from offset until a path ends
+static const char* followPath(Verifier* verifier, int offset)
+{
+    Chunk* chunk = verifier->chunk;
+    int depth = verifier->depths[offset];
+
+    for (;;) {
+        if (offset >= chunk->count) {
+            return "Code runs past end of chunk.";
+        }
+
+        uint8_t instruction = chunk->code[offset];
+        if (instruction > OP_RETURN) {
+            return "Unknown opcode.";
+        }
+
+        int next = offset + 1 + operandCount(instruction);
+        if (next > chunk->count) {
+            return "Code runs past end of chunk.";
+        }
+
+        int operand = operandCount(instruction) > 0 ? chunk->code[offset + 1] : 0;
+
+        // Type profile reads down to depth given in its last operand
+        int inputs = instruction == OP_PROFILE_TYPES
+            ? chunk->code[offset + 4] + 1
+            : stackInputs(instruction, operand);
+
+        if (depth - inputs < 1) {
+            return "Stack underflow.";
+        }
+
+        switch (instruction) {
+            case OP_CONSTANT:
+                if (operand >= chunk->constants.count) {
+                    return "Constant index out of range.";
+                }
+                break;
+
+            case OP_DEFINE_GLOBAL:
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL: {
+                const char* error = checkConstant(chunk, operand, OBJ_STRING);
+                if (error != NULL) return error;
+                break;
+            }
+
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+                if (operand >= depth) {
+                    return "Local slot out of range.";
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        depth += stackEffect(instruction, operand);
+        if (depth > verifier->maxDepth) {
+            verifier->maxDepth = depth;
+        }
+
+        switch (instruction) {
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+            case OP_LOOP: {
+                uint16_t jump = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+                int target = instruction == OP_LOOP ? next - jump : next + jump;
+
+                const char* error = reach(verifier, target, depth);
+                if (error != NULL) return error;
+
+                // Only conditional jumps continue with next instruction
+                if (instruction == OP_JUMP || instruction == OP_LOOP) {
+                    return NULL;
+                }
+                break;
+            }
+
+            case OP_GUARD_NUMBERS: {
+                uint16_t jump = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+
+                // Guarded parameters have to be in the frame
+                if (operand >> (depth - 1) != 0) {
+                    return "Local slot out of range.";
+                }
+
+                const char* error = reach(verifier, next + jump, depth);
+                if (error != NULL) return error;
+                break;
+            }
+
+            case OP_SWITCH: {
+                const char* error = checkConstant(chunk, operand, OBJ_SWITCH);
+                if (error != NULL) return error;
+
+                ObjSwitch* jumpTable = AS_SWITCH(chunk->constants.values[operand]);
+
+                error = reach(verifier, next - jumpTable->defaultDistance, depth);
+                for (int i = 0; i < jumpTable->count && error == NULL; i++) {
+                    error = reach(verifier, next - jumpTable->distances[i], depth);
+                }
+                for (int i = 0; i <= jumpTable->strings.capacity && error == NULL; i++) {
+                    Entry* entry = &jumpTable->strings.entries[i];
+                    if (entry->key != NULL) {
+                        error = reach(verifier, next - (int)AS_NUMBER(entry->value), depth);
+                    }
+                }
+                if (error != NULL) return error;
+
+                // Distance 0 is the fall through path, already recorded above
+                return NULL;
+            }
+
+            case OP_RETURN:
+                return NULL;
+
+            default:
+                break;
+        }
+
+        offset = next;
+
+        if (offset < chunk->count && verifier->depths[offset] != -1) {
+            // Joining a path followed before
+            return verifier->depths[offset] == depth ? NULL : "Stack depth differs between paths.";
+        }
+
+        if (offset < chunk->count) {
+            verifier->depths[offset] = depth;
+        }
+    }
+}
+
+const char* verifyFunction(ObjFunction* function)
+{
+    Chunk* chunk = &function->chunk;
+
+    if (chunk->count == 0) {
+        return "Empty function body.";
+    }
+
+    const char* lineError = checkLines(chunk);
+    if (lineError != NULL) {
+        return lineError;
+    }
+
+    Verifier verifier;
+    verifier.chunk = chunk;
+    verifier.starts = ALLOCATE(bool, chunk->count);
+    verifier.depths = ALLOCATE(int, chunk->count);
+    verifier.pending = ALLOCATE(int, chunk->count);
+    verifier.pendingCount = 0;
+
+    // Slot zero and arguements are on stack when frame starts
+    verifier.maxDepth = function->arity + 1;
+
+    const char* error = NULL;
+
+    for (int offset = 0; offset < chunk->count; offset++) {
+        verifier.starts[offset] = false;
+        verifier.depths[offset] = -1;
+    }
+
+    for (int offset = 0; offset < chunk->count; offset += 1 + operandCount(chunk->code[offset])) {
+        verifier.starts[offset] = true;
+    }
+
+    verifier.depths[0] = function->arity + 1;
+    verifier.pending[verifier.pendingCount++] = 0;
+
+    while (error == NULL && verifier.pendingCount > 0) {
+        error = followPath(&verifier, verifier.pending[--verifier.pendingCount]);
+    }
+
+    if (error == NULL) {
+        function->maxStack = verifier.maxDepth;
+    }
+
+    FREE_ARRAY(bool, verifier.starts, chunk->count);
+    FREE_ARRAY(int, verifier.depths, chunk->count);
+    FREE_ARRAY(int, verifier.pending, chunk->count);
+
+    return error;
+}
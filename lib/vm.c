@@ -3,9 +3,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "./../include/compiler.h"
 #include "./../include/debug.h"
+#include "./../include/files.h"
 #include "./../include/vm.h"
 #include "./../include/memory.h"
 
@@ -19,6 +21,45 @@ static Value clockNative(int argCount, Value* args)
     return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
+// Natives defined in every VM
+// Heap images refer to them by name, so names must not change
+typedef struct {
+    const char* name;
+    NativeFn function;
+} NativeEntry;
+
+static NativeEntry natives[] = {
+    { "clock", clockNative },
+    { "openFile", openFileNative },
+    { "readLine", readLineNative },
+    { "readBlock", readBlockNative },
+    { "closeFile", closeFileNative },
+};
+
+#define NATIVE_COUNT ((int)(sizeof(natives) / sizeof(natives[0])))
+
+NativeFn findNative(const char* name, int length)
+{
+    for (int i = 0; i < NATIVE_COUNT; i++) {
+        if ((int)strlen(natives[i].name) == length && memcmp(natives[i].name, name, length) == 0) {
+            return natives[i].function;
+        }
+    }
+
+    return NULL;
+}
+
+const char* nativeName(NativeFn function)
+{
+    for (int i = 0; i < NATIVE_COUNT; i++) {
+        if (natives[i].function == function) {
+            return natives[i].name;
+        }
+    }
+
+    return NULL;
+}
+
 // VM FUNCTIONS
 static void defineNative(const char* name, NativeFn function);
 
@@ -28,29 +69,55 @@ static void resetStack()
     vm.frameCount = 0;
 }
 
+// Scripts may end with exit() anywhere, buffered output is written out all the same
+static void flushAtExit()
+{
+    flushOutput(&vm.output);
+}
+
 void initVM()
 {
     resetStack();
-    vm.objects = NULL;
-
-    vm.bytesAllocated = 0;
-    vm.nextGC = 10;
-    // vm.nextGC = 1024 * 1024;
+    initHeap(&vm.heap);
+    vm.heap.canCollect = true;
 
     vm.grayCount = 0;
     vm.grayCapacity = 0;
     vm.grayStack = NULL;
 
-    initTable(&vm.strings);
     initTable(&vm.globals);
+    vm.branchProfile = NULL;
+    vm.typeProfile = NULL;
+    vm.permanentFunctions = true;
+
+    vm.scratch = NULL;
+    vm.scratchLength = 0;
+    vm.scratchCapacity = 0;
+
+    // Lines show up right away on terminals, other output is written in blocks
+    initOutput(&vm.output, OUTPUT_DEFAULT_SIZE, isatty(STDOUT_FILENO) ? FLUSH_EACH_LINE : FLUSH_WHEN_FULL);
+    static bool flushRegistered = false;
+    if (!flushRegistered) {
+        atexit(flushAtExit);
+        flushRegistered = true;
+    }
 
-    defineNative("clock", clockNative);
+    for (int i = 0; i < NATIVE_COUNT; i++) {
+        defineNative(natives[i].name, natives[i].function);
+    }
 }
 
 void freeVM()
 {
     freeTable(&vm.globals);
-    freeTable(&vm.strings);
+    freeTable(&vm.heap.strings);
+
+    free(vm.scratch);
+    vm.scratch = NULL;
+    vm.scratchCapacity = 0;
+
+    freeOutput(&vm.output);
+    closeFiles();
 
     // Freeing memory when user program exits
     freeObjects();
@@ -83,6 +150,14 @@ void freeObject(Obj* object)
             break;
         }
 
+        case OBJ_SWITCH: {
+            ObjSwitch* jumpTable = (ObjSwitch*)object;
+            FREE_ARRAY(int, jumpTable->distances, jumpTable->count);
+            freeTable(&jumpTable->strings);
+            FREE(ObjSwitch, object);
+            break;
+        }
+
         default:
             break;
     }
@@ -91,7 +166,14 @@ void freeObject(Obj* object)
 void freeObjects() 
 {
     // Walking a linked list and freeing its nodes
-    Obj* object = vm.objects;
+    Obj* object = vm.heap.objects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        freeObject(object);
+        object = next;
+    }
+
+    object = vm.heap.permanent;
     while (object != NULL) {
         Obj* next = object->next;
         freeObject(object);
@@ -106,6 +188,9 @@ void freeObjects()
 // format allows to pass format string like in printf()
 static void runtimeError(const char* format, ...)
 {
+    // Everything printed before error comes before it
+    flushOutput(&vm.output);
+
     va_list args;
     va_start(args, format);
     vfprintf(stderr, format, args);
@@ -118,9 +203,18 @@ static void runtimeError(const char* format, ...)
         CallFrame* frame = &vm.frames[i];
         ObjFunction* function = frame->function;
 
-        size_t instruction = frame->ip - function->chunk.code - 1;
+        Chunk* chunk = &function->chunk;
+        size_t instruction = frame->ip - chunk->code - 1;
+        int line = getLine(chunk, instruction);
 
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+        // Calls inlined into function show frames of their own
+        while (line < 0) {
+            InlinedLine* inlined = &chunk->inlined[-1 - line];
+            fprintf(stderr, "[line %d] in %s()\n", inlined->line, AS_CSTRING(chunk->constants.values[inlined->name]));
+            line = inlined->callLine;
+        }
+
+        fprintf(stderr, "[line %d] in ", line);
 
         if (function->name == NULL) {
             fprintf(stderr, "script\n");
@@ -144,6 +238,9 @@ static void defineNative(const char* name, NativeFn function)
 
     tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
 
+    makePermanent(AS_OBJ(vm.stack[0]));
+    makePermanent(AS_OBJ(vm.stack[1]));
+
     pop();
     pop();
 }
@@ -170,11 +267,24 @@ static bool call(ObjFunction* function, int argCount)
         return false;
     }
 
+    // Body was only skimmed while compiling the script
+    if (function->lazySource != NULL && !compileLazyFunction(function)) {
+        runtimeError("Could not compile body of function.");
+        return false;
+    }
+
+    // Single check for whole frame, verifier found the deepest stack it needs
+    Value* slots = vm.stackTop - argCount - 1;
+    if (slots + function->maxStack > vm.stack + STACK_MAX) {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+
     CallFrame* frame = &vm.frames[vm.frameCount++];
     frame->function = function;
     frame->ip = function->chunk.code;
 
-    frame->slots = vm.stackTop - argCount - 1;
+    frame->slots = slots;
     return true;
 }
 
@@ -226,6 +336,66 @@ static void concatenate()
 
 }
 
+static void appendScratch(ObjString* string)
+{
+    if (vm.scratchCapacity < vm.scratchLength + string->length + 1) {
+        int capacity = vm.scratchCapacity;
+        while (capacity < vm.scratchLength + string->length + 1) {
+            capacity = GROW_CAPACITY(capacity);
+        }
+
+        vm.scratch = (char*)realloc(vm.scratch, capacity);
+        if (vm.scratch == NULL) {
+            exit(1);
+        }
+        vm.scratchCapacity = capacity;
+    }
+
+    memcpy(vm.scratch + vm.scratchLength, string->chars, string->length);
+    vm.scratchLength += string->length;
+    vm.scratch[vm.scratchLength] = '\0';
+}
+
+bool addValues(Value* operands, int count, bool* joined, double* sum)
+{
+    *joined = IS_STRING(operands[0]);
+    *sum = 0;
+    vm.scratchLength = 0;
+
+    if (*joined) {
+        appendScratch(AS_STRING(operands[0]));
+    } else if (IS_NUMBER(operands[0])) {
+        *sum = AS_NUMBER(operands[0]);
+    } else {
+        return false;
+    }
+
+    // Partial results never become objects
+    for (int i = 1; i < count; i++) {
+        if (*joined && IS_STRING(operands[i])) {
+            appendScratch(AS_STRING(operands[i]));
+        } else if (!*joined && IS_NUMBER(operands[i])) {
+            // Written as a + b like OP_ADD, since which NaN comes out depends on order
+            double a = *sum;
+            double b = AS_NUMBER(operands[i]);
+            *sum = a + b;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Kind of value recorded in type profile
+static uint8_t seenType(Value value)
+{
+    if (IS_NUMBER(value)) return SEEN_NUMBER;
+    if (IS_STRING(value)) return SEEN_STRING;
+    if (IS_FUNCTION(value)) return SEEN_FUNCTION;
+    return SEEN_OTHER;
+}
+
 // Responsible for running bytecode
 // Most performance critical part of entire virtual machine
 static InterpretResult run()
@@ -259,8 +429,18 @@ static InterpretResult run()
             push(valueType(a op b)); \
         } while (false)
 
+    // Operands already proven to be numbers by the compiler
+    #define NUMBER_OP(valueType, op) \
+        do { \
+            double b = AS_NUMBER(pop()); \
+            double a = AS_NUMBER(pop()); \
+            push(valueType(a op b)); \
+        } while (false)
+
         for (;;) {
             #ifdef DEBUG_TRACE_EXECUTION
+                flushOutput(&vm.output);
+
                 // Printing Values of Stack before executing current instruction
                 printf("             ");
                 for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
@@ -319,6 +499,16 @@ static InterpretResult run()
                     break;
                 }
 
+                case OP_ADD_GUARDED: {
+                    if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+                        NUMBER_OP(NUMBER_VAL, +);
+                        break;
+                    }
+
+                    // Profile did not see these operands, doing full OP_ADD below
+                }
+                // fallthrough
+
                 case OP_ADD: {
                     if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
                         concatenate();
@@ -373,12 +563,46 @@ static InterpretResult run()
                     break;
                 }
 
+                case OP_NEGATE_NUMBER: {
+                    vm.stackTop[-1] = NUMBER_VAL(-AS_NUMBER(vm.stackTop[-1]));
+                    break;
+                }
+
+                case OP_ADD_NUMBER: {
+                    NUMBER_OP(NUMBER_VAL, +);
+                    break;
+                }
+
+                case OP_SUBTRACT_NUMBER: {
+                    NUMBER_OP(NUMBER_VAL, -);
+                    break;
+                }
+
+                case OP_MULTIPLY_NUMBER: {
+                    NUMBER_OP(NUMBER_VAL, *);
+                    break;
+                }
+
+                case OP_DIVIDE_NUMBER: {
+                    NUMBER_OP(NUMBER_VAL, /);
+                    break;
+                }
+
+                case OP_GREATER_NUMBER: {
+                    NUMBER_OP(BOOL_VAL, >);
+                    break;
+                }
+
+                case OP_LESS_NUMBER: {
+                    NUMBER_OP(BOOL_VAL, <);
+                    break;
+                }
+
                 case OP_PRINT: {
                     // Stack effect of Print is zero
                     // Since it evaluates the expression and prints it
                     // Statment produces no values
-                    printValue(pop());
-                    printf("\n");
+                    writeLine(&vm.output, pop());
                     break;
                 }
 
@@ -405,6 +629,8 @@ static InterpretResult run()
                     // value for the variable name passed
                     if (!tableGet(&vm.globals, name, &value)) {
                         runtimeError("Undefined variable '%s'.", name->chars);
+
+                        return INTERPRET_RUNTIME_ERROR;
                     }
 
                     push(value);
@@ -453,6 +679,58 @@ static InterpretResult run()
                     break;
                 }
 
+                case OP_JUMP_IF_TRUE: {
+                    uint16_t offset = READ_SHORT();
+
+                    if (!isFalsey(peek(0))) {
+                        frame->ip += offset;
+                    }
+                    break;
+                }
+
+                case OP_PROFILE_BRANCH: {
+                    int line = READ_SHORT();
+                    int index = READ_BYTE();
+
+                    if (vm.branchProfile != NULL) {
+                        BranchCount* count = profileEntry(vm.branchProfile, PROFILE_SITE(line, index));
+                        if (isFalsey(peek(0))) {
+                            count->falseCount++;
+                        } else {
+                            count->trueCount++;
+                        }
+                    }
+                    break;
+                }
+
+                case OP_PROFILE_TYPES: {
+                    int line = READ_SHORT();
+                    int index = READ_BYTE();
+                    int depth = READ_BYTE();
+
+                    if (vm.typeProfile != NULL) {
+                        TypeSite* entry = typeProfileEntry(vm.typeProfile, PROFILE_SITE(line, index));
+                        for (int i = 0; i <= depth && i < TYPE_OPERANDS; i++) {
+                            entry->seen[i] |= seenType(peek(depth - i));
+                        }
+                    }
+                    break;
+                }
+
+                case OP_GUARD_NUMBERS: {
+                    uint8_t mask = READ_BYTE();
+                    uint16_t offset = READ_SHORT();
+
+                    // Generic copy of body runs when a parameter is not a number
+                    for (int slot = 1; mask != 0; slot++, mask >>= 1) {
+                        if ((mask & 1) && !IS_NUMBER(frame->slots[slot])) {
+                            frame->ip += offset;
+                            break;
+                        }
+                    }
+                    break;
+                }
+
                 case OP_JUMP: {
                     uint16_t offset = READ_SHORT();
                     frame->ip += offset;
@@ -468,6 +746,29 @@ static InterpretResult run()
                     break;
                 }
 
+                case OP_SWITCH: {
+                    ObjSwitch* jumpTable = AS_SWITCH(READ_CONSTANT());
+                    Value value = peek(0);
+                    int distance = jumpTable->defaultDistance;
+
+                    if (IS_NUMBER(value)) {
+                        double index = AS_NUMBER(value) - jumpTable->low;
+                        if (index >= 0 && index < jumpTable->count && index == (int)index) {
+                            distance = jumpTable->distances[(int)index];
+                        }
+                    } else if (IS_STRING(value)) {
+                        // Interned strings are found by pointer
+                        Value found;
+                        if (tableGet(&jumpTable->strings, AS_STRING(value), &found)) {
+                            distance = (int)AS_NUMBER(found);
+                        }
+                    }
+
+                    frame->ip -= distance;
+
+                    break;
+                }
+
                 case OP_CALL: {
                     int argCount = READ_BYTE();
 
@@ -482,6 +783,46 @@ static InterpretResult run()
                     break;
                 }
 
+                case OP_CONCAT: {
+                    int count = READ_BYTE();
+                    bool joined;
+                    double sum;
+
+                    if (!addValues(vm.stackTop - count, count, &joined, &sum)) {
+                        runtimeError("Operands must be two numbers or two strings.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
+                    // Operands stay on stack while result is interned
+                    Value result = joined
+                        ? OBJ_VAL(copyString(vm.scratch, vm.scratchLength))
+                        : NUMBER_VAL(sum);
+
+                    vm.stackTop -= count;
+                    push(result);
+                    break;
+                }
+
+                case OP_PRINT_CONCAT: {
+                    int count = READ_BYTE();
+                    bool joined;
+                    double sum;
+
+                    if (!addValues(vm.stackTop - count, count, &joined, &sum)) {
+                        runtimeError("Operands must be two numbers or two strings.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
+                    if (joined) {
+                        writeTextLine(&vm.output, vm.scratch, vm.scratchLength);
+                    } else {
+                        writeLine(&vm.output, NUMBER_VAL(sum));
+                    }
+
+                    vm.stackTop -= count;
+                    break;
+                }
+
                 case OP_RETURN: {
                     Value result = pop();
 
@@ -510,6 +851,7 @@ static InterpretResult run()
     #undef READ_CONSTANT
     #undef READ_STRING
     #undef BINARY_OP
+    #undef NUMBER_OP
 }
 
 InterpretResult interpret(const char* source)
@@ -519,16 +861,60 @@ InterpretResult interpret(const char* source)
         return INTERPRET_COMPILE_ERROR;
     }
 
+    return interpretFunction(function);
+}
+
+// Functions declared by script live till the end of program, script itself only while it runs
+static void makeFunctionsPermanent(ObjFunction* script)
+{
+    if (!vm.permanentFunctions) {
+        return;
+    }
+
+    ValueArray* constants = &script->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (IS_FUNCTION(constants->values[i])) {
+            makePermanent(AS_OBJ(constants->values[i]));
+        }
+    }
+}
+
+InterpretResult interpretFunction(ObjFunction* function)
+{
     push(OBJ_VAL(function));
+    makeFunctionsPermanent(function);
     
     // Setting up first frame for executing top level code
-    callValue(OBJ_VAL(function), 0);
+    if (!callValue(OBJ_VAL(function), 0)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    return run();
+}
+
+InterpretResult interpretCompiled(ObjFunction* function, Heap* heap)
+{
+    if (function == NULL) {
+        // Leftover objects become garbage of VM
+        adoptHeap(heap);
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    // Function is rooted on stack before any collection can happen
+    push(OBJ_VAL(function));
+    adoptHeap(heap);
+    makeFunctionsPermanent(function);
+
+    if (!callValue(OBJ_VAL(function), 0)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
 
     return run();
 }
 
 void push(Value value)
 {
+    // No bounds check, call() made sure the frame's verified maxStack fits
     *vm.stackTop = value;
     vm.stackTop++;
 }
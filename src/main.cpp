@@ -1,93 +1,460 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "./../include/common.h"
 #include "./../include/vm.h"
+#include "./../include/compiler.h"
+#include "./../include/transpiler.h"
+#include "./../include/cache.h"
+#include "./../include/image.h"
+#include "./../include/source.h"
+#include "./../include/server.h"
 
-// Reading file content based on path provided
-static char* readFile(const char* path)
+// Opening script at path, exiting when it cannot be read
+static void openFile(SourceFile* source, const char* path)
 {
-    FILE* file = fopen(path, "rb");
-    
-    // Cannot find file
-    if (file == NULL) {
-        fprintf(stderr, "Could not open file \"%s\".\n", path);
+    if (!openSource(source, path)) {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
         exit(74);
     }
-    
-    // Determing size of file
-    fseek(file, 0L, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
+}
 
-    // Allocating buffer for file content
-    char* buffer = (char*)malloc(fileSize + 1);
+// Setting exit code of process based on result of script
+static void checkResult(InterpretResult result)
+{
+    if (result == INTERPRET_COMPILE_ERROR) {
+        exit(65);
+    }
 
-    // Not able to allocate buffer for file content
-    if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
+    if (result == INTERPRET_RUNTIME_ERROR) {
+        exit(70);
     }
+}
+
+// Runs declarations read from stdin as soon as each one is complete
+// Memory used depends on longest declaration, not on length of input
+static void runStream(bool interactive)
+{
+    // Later declarations may redefine functions already inlined by earlier ones
+    compilerOptions.inlineFunctions = false;
 
-    // Reading file
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
+    // Text of declarations is dropped once they have run, so function bodies cannot be compiled later
+    compilerOptions.lazyFunctions = false;
 
-    // Read Failed of file
-    if (bytesRead < fileSize) {
-        fprintf(stderr, "Could not read file \"%s\". \n", path);
-        exit(74);
+    // Consts of earlier declarations are read by later ones as globals
+    compilerOptions.constGlobals = true;
+
+    // Each declaration is dropped once it has run, so memory stays bounded
+    // only if functions it declared can be collected once redefined
+    vm.permanentFunctions = false;
+
+    SourceStream stream;
+    openStream(&stream, STDIN_FILENO, interactive);
+
+    const char* declaration;
+    int line;
+    while ((declaration = nextDeclaration(&stream, &line)) != NULL) {
+        ObjFunction* script = compileAt(declaration, line);
+        InterpretResult result = script == NULL ? INTERPRET_COMPILE_ERROR : interpretFunction(script);
+
+        // Mistakes typed into REPL do not end it
+        if (!interactive) {
+            checkResult(result);
+        }
+
+        // Output of a declaration comes before next prompt
+        if (interactive) {
+            flushOutput(&vm.output);
+        }
     }
 
-    buffer[bytesRead] = '\0';
+    if (interactive) {
+        printf("\n");
+    }
 
-    fclose(file);
-    return buffer;
+    closeStream(&stream);
 }
 
-static void repl()
+// Branch counts written after running script, NULL if not asked for
+static const char* profileOutPath = NULL;
+static BranchProfile profile;
+
+// Same for kinds of values seen by operators, calls and functions
+static const char* typeProfilePath = NULL;
+static TypeProfile typeProfile;
+
+// Compiled script is kept in a .loxc file next to its source when set
+static bool useCache = false;
+
+// Runs script from its .loxc file if that was compiled from same source
+// Otherwise compiles it and writes the file for next run
+static InterpretResult runCached(const char* path, const char* source)
 {
-    char line[1024];
-    for (;;) {
-        printf("> ");
+    // script.lox is cached in script.loxc, other names get .loxc appended
+    size_t length = strlen(path);
+    bool loxName = length >= 4 && strcmp(path + length - 4, ".lox") == 0;
+    char* cachePath = (char*)malloc(length + 6);
+    if (cachePath == NULL) {
+        fprintf(stderr, "Not enough memory to cache \"%s\".\n", path);
+        exit(74);
+    }
+    strcpy(cachePath, path);
+    strcat(cachePath, loxName ? "c" : ".loxc");
 
-        if (!fgets(line, sizeof(line), stdin)) {
-            printf("\n");
-            break;
+    ObjFunction* script = loadCache(source, cachePath);
+    if (script == NULL) {
+        script = compile(source);
+        if (script == NULL) {
+            free(cachePath);
+            return INTERPRET_COMPILE_ERROR;
         }
 
-        interpret(line);
+        // Script still runs when its directory cannot be written
+        saveCache(script, source, cachePath);
     }
+
+    free(cachePath);
+    return interpretFunction(script);
 }
 
+// Globals left by script are written here after it runs, NULL if not asked for
+static const char* imageOutPath = NULL;
+
 static void runFile(const char* path)
 {
-    char* source = readFile(path);
-    InterpretResult result = interpret(source);
-    free(source);
+    SourceFile file;
+    openFile(&file, path);
+    const char* source = file.text;
+    InterpretResult result = useCache ? runCached(path, source) : interpret(source);
 
-    if (result == INTERPRET_COMPILE_ERROR) {
+    // Skimmed function bodies still point into source
+    if (imageOutPath != NULL && result == INTERPRET_OK && !saveImage(imageOutPath)) {
+        fprintf(stderr, "Could not write image \"%s\".\n", imageOutPath);
+        exit(74);
+    }
+    closeSource(&file);
+
+    if (profileOutPath != NULL && !saveProfile(&profile, profileOutPath)) {
+        fprintf(stderr, "Could not write profile \"%s\".\n", profileOutPath);
+        exit(74);
+    }
+
+    if (typeProfilePath != NULL && !saveTypeProfile(&typeProfile, typeProfilePath)) {
+        fprintf(stderr, "Could not write profile \"%s\".\n", typeProfilePath);
+        exit(74);
+    }
+
+    checkResult(result);
+}
+
+// Prints each line of errors prefixed with path of file they are in
+static void printJobErrors(const char* path, const char* errors)
+{
+    while (errors != NULL && *errors != '\0') {
+        const char* end = strchr(errors, '\n');
+        int length = end == NULL ? (int)strlen(errors) : (int)(end - errors);
+        fprintf(stderr, "%s: %.*s\n", path, length, errors);
+        errors = end == NULL ? NULL : end + 1;
+    }
+}
+
+// Compiles all files in parallel then runs them one after other in same VM
+static void runFiles(const char** paths, int count, int threadCount)
+{
+    // Later files may redefine functions already inlined by earlier ones
+    compilerOptions.inlineFunctions = false;
+
+    // Consts of earlier files are read by later ones as globals
+    compilerOptions.constGlobals = true;
+
+    CompileJob* jobs = (CompileJob*)malloc(sizeof(CompileJob) * count);
+    if (jobs == NULL) {
+        fprintf(stderr, "Not enough memory to compile %d files.\n", count);
+        exit(74);
+    }
+
+    SourceFile* files = (SourceFile*)malloc(sizeof(SourceFile) * count);
+    if (files == NULL) {
+        fprintf(stderr, "Not enough memory to compile %d files.\n", count);
+        exit(74);
+    }
+
+    for (int i = 0; i < count; i++) {
+        openFile(&files[i], paths[i]);
+        jobs[i].source = files[i].text;
+    }
+
+    compileJobs(jobs, count, threadCount);
+
+    // Errors of each file are printed together, in order files were given
+    for (int i = 0; i < count; i++) {
+        printJobErrors(paths[i], jobs[i].errors);
+        free(jobs[i].errors);
+    }
+
+    for (int i = 0; i < count; i++) {
+        checkResult(interpretCompiled(jobs[i].function, &jobs[i].heap));
+    }
+
+    // Lazily compiled function bodies are read from source while running
+    for (int i = 0; i < count; i++) {
+        closeSource(&files[i]);
+    }
+
+    free(files);
+    free(jobs);
+}
+
+// Runs script on server listening at socket path instead of in this process
+// Repeats it given number of times and reports requests per second when more than once
+static void submitFile(const char* path, const char* socketPath, int repeat)
+{
+    SourceFile file;
+    openFile(&file, path);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int status = submit(socketPath, file.text, file.length);
+    for (int i = 1; i < repeat && status != -1; i++) {
+        // Only output of first run is shown
+        FILE* out = freopen("/dev/null", "w", stdout);
+        status = out == NULL ? -1 : submit(socketPath, file.text, file.length);
+    }
+
+    if (status == -1) {
+        fprintf(stderr, "Could not run \"%s\" on server at \"%s\".\n", path, socketPath);
+        exit(74);
+    }
+
+    if (repeat > 1) {
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "%d requests in %.3fs, %.0f per second\n", repeat, seconds, repeat / seconds);
+    }
+
+    closeSource(&file);
+    exit(status);
+}
+
+// Writes script as C source instead of running it
+static void emitFile(const char* path, const char* outPath)
+{
+    // Translated functions have no chunk to find frames of inlined calls in for stack traces
+    compilerOptions.inlineFunctions = false;
+
+    SourceFile file;
+    openFile(&file, path);
+    ObjFunction* script = compile(file.text);
+    closeSource(&file);
+
+    if (script == NULL) {
         exit(65);
     }
 
-    if (result == INTERPRET_RUNTIME_ERROR) {
+    FILE* out = fopen(outPath, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", outPath);
+        exit(74);
+    }
+
+    bool translated = emitC(script, out);
+    fclose(out);
+
+    if (!translated) {
+        fprintf(stderr, "Could not translate \"%s\" to C.\n", path);
         exit(70);
     }
 }
 
+static void usage()
+{
+    fprintf(stderr, "Usage: clox [--no-inline] [--inline-budget=bytes] [--no-licm] [--no-infer] [--no-concat] [--no-cse]\n"
+                    "            [--max-clones=n] [--unroll=n] [--lazy] [--cache] [--image=file] [--save-image=file] [--serve=socket]\n"
+                    "            [--submit=socket] [--repeat=n] [--jobs=n] [--profile-out=file] [--profile-in=file] [--record-profile=file]\n"
+                    "            [--use-profile=file] [--emit-c=file] [--output-buffer=bytes]\n"
+                    "            [--flush=line|full] [path... | -]\n");
+    exit(64);
+}
+
 int main(int argc, char** argv)
 {
     initVM();
 
-    if (argc == 1) {
-        repl();
-    } else if (argc == 2) {
-        runFile(argv[1]);
-    } else {
-        fprintf(stderr, "Usage: clox [path]\n");
+    const char** paths = (const char**)malloc(sizeof(const char*) * argc);
+    int pathCount = 0;
+
+    // Threads used to compile when several scripts are given
+    int threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    initProfile(&profile);
+    initTypeProfile(&typeProfile);
+
+    // C output of script, NULL when running it
+    const char* emitPath = NULL;
+
+    // Socket scripts are taken from, and socket of server script is sent to
+    const char* servePath = NULL;
+    const char* submitPath = NULL;
+    int repeat = 1;
+
+    // Parsing compiler switches before the script path
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-inline") == 0) {
+            compilerOptions.inlineFunctions = false;
+        } else if (strncmp(argv[i], "--inline-budget=", 16) == 0) {
+            compilerOptions.inlineBudget = atoi(argv[i] + 16);
+        } else if (strcmp(argv[i], "--no-licm") == 0) {
+            compilerOptions.hoistInvariants = false;
+        } else if (strcmp(argv[i], "--no-infer") == 0) {
+            compilerOptions.inferTypes = false;
+        } else if (strcmp(argv[i], "--no-concat") == 0) {
+            compilerOptions.concatChains = false;
+        } else if (strcmp(argv[i], "--no-cse") == 0) {
+            compilerOptions.eliminateSubexpressions = false;
+        } else if (strncmp(argv[i], "--max-clones=", 13) == 0) {
+            compilerOptions.maxClones = atoi(argv[i] + 13);
+        } else if (strncmp(argv[i], "--unroll=", 9) == 0) {
+            compilerOptions.unrollFactor = atoi(argv[i] + 9);
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            compilerOptions.lazyFunctions = true;
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            useCache = true;
+        } else if (strncmp(argv[i], "--image=", 8) == 0) {
+            // Globals of a prelude run earlier, defined before anything else runs
+            if (!loadImage(argv[i] + 8)) {
+                fprintf(stderr, "Could not read image \"%s\".\n", argv[i] + 8);
+                exit(74);
+            }
+        } else if (strncmp(argv[i], "--serve=", 8) == 0) {
+            servePath = argv[i] + 8;
+        } else if (strncmp(argv[i], "--submit=", 9) == 0) {
+            submitPath = argv[i] + 9;
+        } else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+            repeat = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--save-image=", 13) == 0) {
+            imageOutPath = argv[i] + 13;
+
+            // Consts of prelude are only seen by later scripts as globals
+            compilerOptions.constGlobals = true;
+        } else if (strncmp(argv[i], "--profile-out=", 14) == 0) {
+            // Recording how often conditions of if statements are true
+            profileOutPath = argv[i] + 14;
+            compilerOptions.profileBranches = true;
+            vm.branchProfile = &profile;
+        } else if (strncmp(argv[i], "--profile-in=", 13) == 0) {
+            if (!loadProfile(&profile, argv[i] + 13)) {
+                fprintf(stderr, "Could not read profile \"%s\".\n", argv[i] + 13);
+                exit(74);
+            }
+            compilerOptions.branchProfile = &profile;
+        } else if (strncmp(argv[i], "--record-profile=", 17) == 0) {
+            // Recording kinds of operands, callees, arguements and parameters
+            typeProfilePath = argv[i] + 17;
+            compilerOptions.profileTypes = true;
+            vm.typeProfile = &typeProfile;
+        } else if (strncmp(argv[i], "--use-profile=", 14) == 0) {
+            if (!loadTypeProfile(&typeProfile, argv[i] + 14)) {
+                fprintf(stderr, "Could not read profile \"%s\".\n", argv[i] + 14);
+                exit(74);
+            }
+            compilerOptions.typeProfile = &typeProfile;
+        } else if (strncmp(argv[i], "--emit-c=", 9) == 0) {
+            emitPath = argv[i] + 9;
+        } else if (strncmp(argv[i], "--output-buffer=", 16) == 0) {
+            int size = atoi(argv[i] + 16);
+            if (size < 1) {
+                usage();
+            }
+            resizeOutput(&vm.output, (size_t)size);
+        } else if (strcmp(argv[i], "--flush=line") == 0) {
+            vm.output.policy = FLUSH_EACH_LINE;
+        } else if (strcmp(argv[i], "--flush=full") == 0) {
+            vm.output.policy = FLUSH_WHEN_FULL;
+        } else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            threadCount = atoi(argv[i] + 7);
+        } else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0) {
+            paths[pathCount++] = argv[i];
+        } else {
+            usage();
+        }
+    }
+
+    // Script is read from stdin as it arrives, a terminal gets a REPL
+    bool streaming = pathCount == 0 || (pathCount == 1 && strcmp(paths[0], "-") == 0);
+
+    // Sites in profile are lines of a single script
+    bool recording = profileOutPath != NULL || typeProfilePath != NULL;
+    bool profiling = recording || compilerOptions.branchProfile != NULL ||
+                     compilerOptions.typeProfile != NULL;
+    if (profiling && (pathCount != 1 || streaming)) {
+        fprintf(stderr, "Profiles need exactly one script.\n");
         exit(64);
     }
 
+    if (imageOutPath != NULL && (pathCount != 1 || streaming || emitPath != NULL)) {
+        fprintf(stderr, "Images need exactly one script to run.\n");
+        exit(64);
+    }
+
+    // Scripts run on top of an image may redefine functions of prelude,
+    // which callers in prelude would not see if they were inlined
+    if (imageOutPath != NULL) {
+        compilerOptions.inlineFunctions = false;
+    }
+
+    // Cached bytecode knows nothing of profiles
+    if (profiling) {
+        useCache = false;
+    }
+
+    if (servePath != NULL) {
+        // Options and image given before are what every request starts from
+        if (pathCount != 0 || profiling || imageOutPath != NULL) {
+            fprintf(stderr, "Server takes its scripts from socket and cannot use profiles.\n");
+            exit(64);
+        }
+
+        serve(servePath);
+        fprintf(stderr, "Could not serve requests on \"%s\".\n", servePath);
+        exit(74);
+    }
+
+    if (submitPath != NULL) {
+        if (pathCount != 1 || streaming) {
+            fprintf(stderr, "Exactly one script can be sent to server.\n");
+            exit(64);
+        }
+
+        submitFile(paths[0], submitPath, repeat);
+    }
+
+    if (emitPath != NULL) {
+        // Translated code can still be laid out and specialized by profiles
+        if (pathCount != 1 || recording) {
+            fprintf(stderr, "C output needs exactly one script and cannot record profiles.\n");
+            exit(64);
+        }
+
+        // Every function body has to be compiled before translating
+        compilerOptions.lazyFunctions = false;
+        emitFile(paths[0], emitPath);
+    } else if (streaming) {
+        runStream(pathCount == 0 && isatty(STDIN_FILENO));
+    } else if (pathCount == 1) {
+        runFile(paths[0]);
+    } else {
+        runFiles(paths, pathCount, threadCount < 1 ? 1 : threadCount);
+    }
+
+    free(paths);
+    freeProfile(&profile);
+    freeTypeProfile(&typeProfile);
+
     freeVM();
     return 0;
 }